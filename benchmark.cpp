@@ -0,0 +1,736 @@
+// Microbenchmark for the segmentation functions in imageSegmentation.cpp.
+// Times every algorithm directly (no GUI, no colour mapping done by the
+// caller) on synthetic and real inputs at several resolutions and writes the
+// results as JSON. With --baseline the run is compared against a saved
+// result file and regressions are reported. With --check it instead compares
+// optimized paths against their simpler reference versions.
+#define SEGMENTATION_NO_MAIN
+#include "imageSegmentation.cpp"
+
+#include <sys/resource.h>
+#include <sstream>
+
+// One benchmarked function
+struct BenchmarkFunction {
+    const char *name;
+    function<Mat(const Mat&, const SegmentationContext&)> run;
+};
+
+// Timing of one function on one input
+struct BenchmarkResult {
+    string function;
+    string input;
+    int width = 0;
+    int height = 0;
+    int repeats = 0;
+    double median_ms = 0;
+    double p95_ms = 0;
+    double mp_per_s = 0;
+    double peak_rss_mb = 0;
+    string error;
+};
+
+static vector<BenchmarkFunction> benchmark_functions() {
+    return {
+        {"activeContoursSegmentation", activeContoursSegmentation},
+        {"levelSetSegmentation", levelSetSegmentation},
+        {"kMeansSegmentation", kMeansSegmentation},
+        {"colorKMeansSegmentation", colorKMeansSegmentation},
+        {"otsuSegmentation", [](const Mat& image, const SegmentationContext& context) {
+            vector<int> thresholds;
+            return otsuSegmentation(image, context, thresholds);
+        }},
+        {"backtrackingSegmentation", backtrackingSegmentation},
+        {"backtrackingSegmentation8Dir", backtrackingSegmentation8Dir},
+        {"backtrackingSegmentationImproved", backtrackingSegmentationImproved},
+        {"backtrackingEdgeEnhancementSegmentation", backtrackingEdgeEnhancementSegmentation},
+        {"watershedSegmentation", watershedSegmentation},
+        {"graphCutSegmentation", graphCutSegmentation},
+        {"gridCutSegmentation", gridCutSegmentation},
+        {"regionGrowingSegmentation", [](const Mat& image, const SegmentationContext& context) {
+            return regionGrowingSegmentation(image, Point(image.cols / 2, image.rows / 2), context);
+        }},
+        {"multiSeedRegionGrowingSegmentation", multiSeedRegionGrowingSegmentation},
+    };
+}
+
+// Deterministic test scene: smooth background gradient, a few filled shapes
+// with distinct colours and mild noise, so every algorithm finds structure
+static Mat synthetic_image(Size size) {
+    Mat image(size, CV_8UC3);
+    for (int y = 0; y < size.height; y++) {
+        Vec3b *row = image.ptr<Vec3b>(y);
+        for (int x = 0; x < size.width; x++) {
+            row[x] = Vec3b((uchar)(40 + 60 * x / size.width), (uchar)(50 + 40 * y / size.height), 70);
+        }
+    }
+
+    int unit = min(size.width, size.height);
+    circle(image, Point(size.width / 2, size.height / 2), unit / 4, Scalar(220, 200, 180), FILLED);
+    rectangle(image, Rect(size.width / 10, size.height / 10, unit / 5, unit / 6), Scalar(30, 160, 230), FILLED);
+    ellipse(image, Point(size.width * 3 / 4, size.height * 3 / 4), Size(unit / 8, unit / 12), 30, 0, 360,
+            Scalar(200, 40, 60), FILLED);
+
+    Mat noise(size, CV_8UC3);
+    theRNG().state = 12345;
+    randu(noise, Scalar::all(0), Scalar::all(12));
+    add(image, noise, image);
+    return image;
+}
+
+// Peak resident set size since the last reset, in MB
+static double peak_rss_mb() {
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        if (line.rfind("VmHWM:", 0) == 0) {
+            return stod(line.substr(6)) / 1024.0; // Reported in kB
+        }
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+}
+
+// Reset the peak RSS counter so each function reports its own peak (Linux only)
+static void reset_peak_rss() {
+    ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5";
+}
+
+static double percentile(vector<double> values, double fraction) {
+    sort(values.begin(), values.end());
+    size_t rank = (size_t)ceil(fraction * values.size());
+    return values[min(values.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+static BenchmarkResult run_benchmark(const BenchmarkFunction& function, const string& input_name, const Mat& image,
+                                     int warmup, int repeats) {
+    BenchmarkResult result;
+    result.function = function.name;
+    result.input = input_name;
+    result.width = image.cols;
+    result.height = image.rows;
+    result.repeats = repeats;
+
+    // One context for all runs, so the workspace buffers are reused like in
+    // a long-running caller
+    SegmentationContext context;
+    vector<double> times;
+    reset_peak_rss();
+    try {
+        for (int i = 0; i < warmup + repeats; i++) {
+            // A fresh copy per run so cached preprocessing is not reused across runs
+            Mat input = image.clone();
+            auto start_time = chrono::high_resolution_clock::now();
+            Mat output = function.run(input, context);
+            auto end_time = chrono::high_resolution_clock::now();
+            if (i >= warmup) {
+                times.push_back(chrono::duration<double, milli>(end_time - start_time).count());
+            }
+        }
+    } catch (const exception& e) {
+        result.error = e.what();
+        return result;
+    }
+
+    result.peak_rss_mb = peak_rss_mb();
+    result.median_ms = percentile(times, 0.5);
+    result.p95_ms = percentile(times, 0.95);
+    result.mp_per_s = image.total() / 1e6 / (result.median_ms / 1000.0);
+    return result;
+}
+
+static string json_escape(const string& text) {
+    string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+// One benchmark per line so baselines can be read back without a JSON library
+static void write_json(ostream& out, const vector<BenchmarkResult>& results) {
+    out << "{\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult& r = results[i];
+        out << "    {\"function\": \"" << r.function << "\", \"input\": \"" << json_escape(r.input)
+            << "\", \"width\": " << r.width << ", \"height\": " << r.height
+            << ", \"megapixels\": " << format("%.3f", r.width * (double)r.height / 1e6)
+            << ", \"repeats\": " << r.repeats
+            << ", \"median_ms\": " << format("%.3f", r.median_ms)
+            << ", \"p95_ms\": " << format("%.3f", r.p95_ms)
+            << ", \"mp_per_s\": " << format("%.3f", r.mp_per_s)
+            << ", \"peak_rss_mb\": " << format("%.1f", r.peak_rss_mb);
+        if (!r.error.empty()) {
+            out << ", \"error\": \"" << json_escape(r.error) << "\"";
+        }
+        out << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+static string json_string_field(const string& line, const string& key) {
+    size_t pos = line.find("\"" + key + "\": \"");
+    if (pos == string::npos) {
+        return "";
+    }
+    pos += key.size() + 5;
+    return line.substr(pos, line.find('"', pos) - pos);
+}
+
+static double json_number_field(const string& line, const string& key) {
+    size_t pos = line.find("\"" + key + "\": ");
+    if (pos == string::npos) {
+        return 0;
+    }
+    return atof(line.c_str() + pos + key.size() + 4);
+}
+
+// Read the results of an earlier run written by write_json
+static vector<BenchmarkResult> read_baseline(const string& path) {
+    ifstream file(path);
+    if (!file) {
+        throw cv::Exception(0, "Cannot open baseline " + path, "read_baseline", __FILE__, __LINE__);
+    }
+    vector<BenchmarkResult> results;
+    string line;
+    while (getline(file, line)) {
+        if (line.find("\"function\"") == string::npos) {
+            continue;
+        }
+        BenchmarkResult r;
+        r.function = json_string_field(line, "function");
+        r.input = json_string_field(line, "input");
+        r.error = json_string_field(line, "error");
+        r.width = (int)json_number_field(line, "width");
+        r.height = (int)json_number_field(line, "height");
+        r.median_ms = json_number_field(line, "median_ms");
+        r.p95_ms = json_number_field(line, "p95_ms");
+        results.push_back(r);
+    }
+    return results;
+}
+
+// Print the change in median latency against the baseline; returns the
+// number of regressions beyond tolerance
+static int compare_with_baseline(const vector<BenchmarkResult>& results, const vector<BenchmarkResult>& baseline,
+                                 double tolerance) {
+    int regressions = 0;
+    fprintf(stderr, "\n%-42s %-24s %12s %12s %9s\n", "Function", "Input", "Baseline ms", "Current ms", "Change");
+    for (const BenchmarkResult& current : results) {
+        const BenchmarkResult *previous = NULL;
+        for (const BenchmarkResult& candidate : baseline) {
+            if (candidate.function == current.function && candidate.input == current.input &&
+                candidate.width == current.width && candidate.height == current.height) {
+                previous = &candidate;
+                break;
+            }
+        }
+        string input = format("%s %dx%d", current.input.c_str(), current.width, current.height);
+        if (previous == NULL || !previous->error.empty() || !current.error.empty() || previous->median_ms <= 0) {
+            fprintf(stderr, "%-42s %-24s %12s %12s %9s\n", current.function.c_str(), input.c_str(), "-",
+                    current.error.empty() ? format("%.2f", current.median_ms).c_str() : "error", "n/a");
+            continue;
+        }
+        double change = current.median_ms / previous->median_ms - 1.0;
+        bool regressed = change > tolerance;
+        regressions += regressed;
+        fprintf(stderr, "%-42s %-24s %12.2f %12.2f %+8.1f%%%s\n", current.function.c_str(), input.c_str(),
+                previous->median_ms, current.median_ms, change * 100, regressed ? "  REGRESSION" : "");
+    }
+    return regressions;
+}
+
+// Random gray image of smooth blobs quantized to the given number of levels,
+// so range and tolerance tests give large, irregular connected regions
+static Mat random_blobs(RNG& rng, Size size, int levels) {
+    Mat image(size, CV_8UC1);
+    rng.fill(image, RNG::UNIFORM, 0, 256);
+    GaussianBlur(image, image, Size(0, 0), rng.uniform(1.0, 4.0));
+    normalize(image, image, 0, 255, NORM_MINMAX);
+    Mat lut(1, 256, CV_8UC1);
+    const int step = max(1, 256 / levels);
+    for (int v = 0; v < 256; v++) {
+        lut.at<uchar>(v) = (uchar)(v / step * step);
+    }
+    LUT(image, lut, image);
+    return image;
+}
+
+static bool same_flood_mask(const FloodMask& a, const FloodMask& b) {
+    for (int y = 0; y < a.rows; y++) {
+        if (memcmp(a.row(y), b.row(y), a.words * sizeof(uint64_t)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Fills from seed once on a single thread and once with the parallel finish
+// forced after a few hundred pixels; both must mark the same pixels
+template <int Connectivity>
+static bool parallel_flood_fill_matches(const FloodMask& inside, const FloodMask& marked, Point seed, int threads) {
+    FloodMask serial = marked, parallel = marked;
+    vector<Point> pending;
+    setNumThreads(1);
+    size_t serialArea = scanlineFloodFill<Connectivity>(serial, inside, pending, seed);
+    setNumThreads(threads);
+    size_t parallelArea = scanlineFloodFill<Connectivity>(parallel, inside, pending, seed, 256);
+    return serialArea == parallelArea && same_flood_mask(serial, parallel);
+}
+
+// Compares the parallel flood fill finish (finishFloodFillParallel) with the
+// serial packed fill on random masks, seeds and partly pre-marked masks;
+// returns the number of mismatching cases
+static int check_parallel_flood_fill(int cases) {
+    RNG rng(12345);
+    const int previousThreads = getNumThreads();
+    const int threads = max(4, previousThreads);
+    int mismatches = 0;
+    for (int c = 0; c < cases; c++) {
+        Size size(rng.uniform(1, 700), rng.uniform(1, 500));
+        const int low = rng.uniform(0, 128);
+        FloodMask inside, marked;
+        packIntensityRange(random_blobs(rng, size, 8), low, min(255, low + rng.uniform(64, 256)), inside);
+        if (c % 3 == 0) {
+            packIntensityRange(random_blobs(rng, size, 8), 0, rng.uniform(0, 48), marked);
+        } else {
+            marked.reset(size);
+        }
+        Point seed(rng.uniform(0, size.width), rng.uniform(0, size.height));
+        if (marked.test(seed.x, seed.y)) {
+            continue;
+        }
+        inside.fillSpan(seed.y, seed.x, seed.x);
+
+        bool matches = c % 2 ? parallel_flood_fill_matches<FLOOD_4>(inside, marked, seed, threads)
+                             : parallel_flood_fill_matches<FLOOD_8>(inside, marked, seed, threads);
+        if (!matches) {
+            fprintf(stderr, "  parallel flood fill mismatch: case %d, %dx%d, seed (%d, %d), %d-connected\n", c,
+                    size.width, size.height, seed.x, seed.y, c % 2 ? 4 : 8);
+            mismatches++;
+        }
+    }
+    setNumThreads(previousThreads);
+    return mismatches;
+}
+
+// Fills a solid region across the top eighth of a large image whose other
+// rows are 4-connected noise specks, on one thread and with the parallel
+// finish, and reports the time and the peak memory above the starting point
+// of each. The parallel finish only labels the rows the region reaches, not
+// the specks of the whole image. Returns 1 if the two masks differ.
+static int report_noisy_flood_fill(Size size) {
+    RNG rng(13579);
+    Mat noise(size, CV_8UC1);
+    rng.fill(noise, RNG::UNIFORM, 0, 100);
+    noise.rowRange(0, size.height / 8).setTo(Scalar(0));
+    FloodMask inside;
+    packIntensityRange(noise, 0, 44, inside); // Below the 4-connected percolation threshold
+    noise.release();
+
+    const int previousThreads = getNumThreads();
+    FloodMask masks[2];
+    vector<Point> pending;
+    for (int pass = 0; pass < 2; pass++) {
+        const int threads = pass == 0 ? 1 : max(4, previousThreads);
+        setNumThreads(threads);
+        masks[pass].reset(size);
+        reset_peak_rss();
+        const double baseline = peak_rss_mb();
+        auto start_time = chrono::high_resolution_clock::now();
+        size_t area = scanlineFloodFill<FLOOD_4>(masks[pass], inside, pending, Point(size.width / 2, 0));
+        auto end_time = chrono::high_resolution_clock::now();
+        fprintf(stderr, "  noisy %dx%d fill, %d thread(s): %.1f ms, %zu pixels, %.1f MB peak above start\n",
+                size.width, size.height, threads, chrono::duration<double, milli>(end_time - start_time).count(),
+                area, peak_rss_mb() - baseline);
+    }
+    setNumThreads(previousThreads);
+    return same_flood_mask(masks[0], masks[1]) ? 0 : 1;
+}
+
+// The seeded growth from scratch: one fill per seed over a shared mask,
+// skipping seeds inside an earlier region
+template <int Connectivity>
+static void rebuilt_region_growth(const Mat& gray, const Mat& gate, const vector<Point>& seeds, int tolerance,
+                                  Mat& regions) {
+    FloodMask mask;
+    mask.reset(gray.size());
+    vector<Point> pending;
+    for (const Point& seed : seeds) {
+        if (mask.test(seed.x, seed.y)) {
+            continue;
+        }
+        const int reference = gray.at<uchar>(seed);
+        scanlineFloodFill<Connectivity>(mask, pending, seed, [&](int x, int y) {
+            return (x == seed.x && y == seed.y) ||
+                   (gate.at<uchar>(y, x) && abs(gray.at<uchar>(y, x) - reference) < tolerance);
+        });
+    }
+    mask.toMat(regions);
+}
+
+// Steps one RegionGrowth through a random tolerance sequence, mostly rising
+// as on a slider drag with occasional drops; every step must match the rebuild
+template <int Connectivity>
+static bool region_growth_matches(RNG& rng, const Mat& gray, const Mat& gate, const vector<Point>& seeds) {
+    RegionGrowth growth(gray.size());
+    vector<Point> pending;
+    Mat grown, rebuilt;
+    int tolerance = rng.uniform(0, 20);
+    for (int step = 0; step < 25; step++) {
+        tolerance += rng.uniform(0, 8) == 0 ? -rng.uniform(0, 30) : rng.uniform(0, 12);
+        tolerance = min(255, max(0, tolerance));
+        growth.grow<Connectivity>(seeds, tolerance, [&](int k, int x, int y) {
+            return gate.at<uchar>(y, x) && abs(gray.at<uchar>(y, x) - gray.at<uchar>(seeds[k])) < tolerance;
+        }, pending, grown);
+        rebuilt_region_growth<Connectivity>(gray, gate, seeds, tolerance, rebuilt);
+        for (int y = 0; y < gray.rows; y++) {
+            if (memcmp(grown.ptr(y), rebuilt.ptr(y), gray.cols) != 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Compares the incremental RegionGrowth with a rebuild from scratch at every
+// tolerance; returns the number of mismatching cases
+static int check_region_growth(int cases) {
+    RNG rng(54321);
+    int mismatches = 0;
+    for (int c = 0; c < cases; c++) {
+        Size size(rng.uniform(1, 200), rng.uniform(1, 200));
+        Mat gray = random_blobs(rng, size, c % 3 ? 12 : 256);
+        Mat gate(size, CV_8UC1);
+        const int density = rng.uniform(70, 101);
+        for (int y = 0; y < size.height; y++) {
+            for (int x = 0; x < size.width; x++) {
+                gate.at<uchar>(y, x) = rng.uniform(0, 100) < density ? 255 : 0;
+            }
+        }
+        vector<Point> seeds(rng.uniform(1, 10));
+        for (Point& seed : seeds) {
+            seed = Point(rng.uniform(0, size.width), rng.uniform(0, size.height));
+        }
+
+        bool matches = c % 2 ? region_growth_matches<FLOOD_4>(rng, gray, gate, seeds)
+                             : region_growth_matches<FLOOD_8>(rng, gray, gate, seeds);
+        if (!matches) {
+            fprintf(stderr, "  region growth mismatch: case %d, %dx%d, %d seeds, %d-connected\n", c, size.width,
+                    size.height, (int)seeds.size(), c % 2 ? 4 : 8);
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+// Serial reference for growSeedRegions: a breadth-first fill per seed in
+// order, each pixel labelled by the first seed whose region holds it
+static Mat serial_seed_regions(const Mat& gray, const vector<Point>& seeds, int tolerance, bool floating) {
+    Mat labels = Mat::zeros(gray.size(), CV_32S), visited;
+    const Point steps[4] = {Point(1, 0), Point(-1, 0), Point(0, 1), Point(0, -1)};
+    for (size_t k = 0; k < seeds.size(); k++) {
+        const int reference = gray.at<uchar>(seeds[k]);
+        visited = Mat::zeros(gray.size(), CV_8UC1);
+        queue<Point> pending;
+        pending.push(seeds[k]);
+        visited.at<uchar>(seeds[k]) = 1;
+        while (!pending.empty()) {
+            Point p = pending.front();
+            pending.pop();
+            if (labels.at<int>(p) == 0) {
+                labels.at<int>(p) = (int)k + 1;
+            }
+            for (const Point& step : steps) {
+                Point q = p + step;
+                if (q.x < 0 || q.y < 0 || q.x >= gray.cols || q.y >= gray.rows || visited.at<uchar>(q)) {
+                    continue;
+                }
+                const int from = floating ? gray.at<uchar>(p) : reference;
+                if (abs(gray.at<uchar>(q) - from) < tolerance) {
+                    visited.at<uchar>(q) = 1;
+                    pending.push(q);
+                }
+            }
+        }
+    }
+    return labels;
+}
+
+// Compares the parallel multi-seed growth (growSeedRegions) in both range
+// modes with the serial fill, at the default tolerance and random ones;
+// returns the number of mismatching cases
+static int check_seed_regions(int cases) {
+    RNG rng(24680);
+    const int previousThreads = getNumThreads();
+    setNumThreads(max(4, previousThreads));
+    int mismatches = 0;
+    for (int c = 0; c < cases; c++) {
+        Size size(rng.uniform(1, 300), rng.uniform(1, 300));
+        Mat gray = random_blobs(rng, size, c % 3 ? 12 : 256);
+        vector<Point> seeds(rng.uniform(1, 20));
+        for (Point& seed : seeds) {
+            seed = Point(rng.uniform(0, size.width), rng.uniform(0, size.height));
+        }
+        const int tolerance = c % 4 == 0 ? REGION_GROWING_THRESHOLD : rng.uniform(0, 80);
+        const bool floating = c % 2 == 1;
+        Mat grown = growSeedRegions(gray, seeds, tolerance, floating);
+        Mat expected = serial_seed_regions(gray, seeds, tolerance, floating);
+        bool matches = true;
+        for (int y = 0; y < size.height && matches; y++) {
+            matches = memcmp(grown.ptr(y), expected.ptr(y), size.width * sizeof(int)) == 0;
+        }
+        if (!matches) {
+            fprintf(stderr, "  seed region mismatch: case %d, %dx%d, %d seeds, tolerance %d, %s range\n", c,
+                    size.width, size.height, (int)seeds.size(), tolerance, floating ? "floating" : "fixed");
+            mismatches++;
+        }
+    }
+    setNumThreads(previousThreads);
+    return mismatches;
+}
+
+// Foreground pixels of two GrabCut masks that differ, as a fraction of the
+// image, and the intersection over union of their foregrounds
+static void compare_grabcut_masks(const Mat& a, const Mat& b, double& differing, double& iou) {
+    Mat foregroundA, foregroundB, both, either, different;
+    bitwise_and(a, Scalar(1), foregroundA);
+    bitwise_and(b, Scalar(1), foregroundB);
+    bitwise_and(foregroundA, foregroundB, both);
+    bitwise_or(foregroundA, foregroundB, either);
+    bitwise_xor(foregroundA, foregroundB, different);
+    differing = (double)countNonZero(different) / a.total();
+    int unionArea = countNonZero(either);
+    iou = unionArea > 0 ? (double)countNonZero(both) / unionArea : 1.0;
+}
+
+// Coarse to fine GrabCut (the default tiled band refinement) against one cut
+// over the whole band, which shows the seams from per-tile contrast
+// normalisation, and against GrabCut at full resolution. The default needs at
+// most GRABCUT_SEAM_TOLERANCE of the pixels to change with the tiling and a
+// foreground overlap of GRABCUT_MIN_IOU with full resolution; returns the
+// number of failing cases
+static int check_grabcut_band(int cases) {
+    const double GRABCUT_SEAM_TOLERANCE = 0.005;
+    const double GRABCUT_MIN_IOU = 0.95;
+    RNG rng(2024);
+    int failures = 0;
+    for (int c = 0; c < cases; c++) {
+        Size size(rng.uniform(1000, 1600), rng.uniform(750, 1200));
+        Mat image = synthetic_image(size);
+        if (c % 2) {
+            Mat noise(size, CV_16SC3);
+            rng.fill(noise, RNG::NORMAL, 0, 12);
+            add(image, noise, image, noArray(), CV_8U);
+        }
+
+        // The colour model fit starts from random k-means centers, so every
+        // run starts from the same generator state
+        auto run = [&](int maxSide, int tile) {
+            SegmentationParams params;
+            params.graph_cut_max_side = maxSide;
+            params.graph_cut_tile = tile;
+            StageTimer stages("check_grabcut_band");
+            Mat mask, bgModel, fgModel;
+            theRNG().state = 0x12345678;
+            initialGrabCut(image, params, mask, bgModel, fgModel, stages);
+            return mask;
+        };
+        Mat tiled = run(GRAPH_CUT_MAX_SIDE, GRAPH_CUT_TILE);
+        Mat oneCut = run(GRAPH_CUT_MAX_SIDE, 0);
+        Mat full = run(0, GRAPH_CUT_TILE);
+
+        double seamDiffering, seamIou, fullDiffering, fullIou;
+        compare_grabcut_masks(tiled, oneCut, seamDiffering, seamIou);
+        compare_grabcut_masks(tiled, full, fullDiffering, fullIou);
+        bool ok = seamDiffering <= GRABCUT_SEAM_TOLERANCE && fullIou >= GRABCUT_MIN_IOU;
+        fprintf(stderr, "  GrabCut band %dx%d%s: %.3f%% differ from one cut, %.3f%% (IoU %.4f) from full resolution%s\n",
+                size.width, size.height, c % 2 ? " noisy" : "", seamDiffering * 100, fullDiffering * 100, fullIou,
+                ok ? "" : "  FAILED");
+        failures += !ok;
+    }
+    return failures;
+}
+
+static void print_usage() {
+    cerr << "Usage: benchmark [options]\n"
+         << "  --sizes LIST          megapixel sizes, comma separated (default 0.25,1,4; up to 50)\n"
+         << "  --image FILE          also benchmark FILE resized to each size (repeatable)\n"
+         << "  --functions LIST      only run these functions, comma separated\n"
+         << "  --repeats N           timed runs per function and input (default 5)\n"
+         << "  --warmup N            untimed runs before timing (default 1)\n"
+         << "  --output FILE         write JSON results to FILE (default stdout)\n"
+         << "  --baseline FILE       compare against an earlier JSON result\n"
+         << "  --tolerance F         allowed median slowdown before a regression (default 0.10)\n"
+         << "  --check               compare optimized paths with their reference versions instead of timing\n"
+         << "Functions:\n";
+    for (const BenchmarkFunction& function : benchmark_functions()) {
+        cerr << "  " << function.name << "\n";
+    }
+}
+
+static vector<string> split_list(const string& text) {
+    vector<string> items;
+    stringstream stream(text);
+    string item;
+    while (getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+int main(int argc, char **argv) {
+    vector<double> sizes = {0.25, 1, 4};
+    vector<string> images;
+    vector<string> only;
+    string output_path;
+    string baseline_path;
+    int repeats = 5;
+    int warmup = 1;
+    double tolerance = 0.10;
+    bool check = false;
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            string arg = argv[i];
+            bool has_value = i + 1 < argc;
+            if (arg == "--help" || arg == "-h") {
+                print_usage();
+                return 0;
+            } else if (arg == "--sizes" && has_value) {
+                sizes.clear();
+                for (const string& size : split_list(argv[++i])) {
+                    sizes.push_back(stod(size));
+                }
+            } else if (arg == "--image" && has_value) {
+                images.push_back(argv[++i]);
+            } else if (arg == "--functions" && has_value) {
+                only = split_list(argv[++i]);
+            } else if (arg == "--repeats" && has_value) {
+                repeats = max(1, stoi(argv[++i]));
+            } else if (arg == "--warmup" && has_value) {
+                warmup = max(0, stoi(argv[++i]));
+            } else if (arg == "--output" && has_value) {
+                output_path = argv[++i];
+            } else if (arg == "--baseline" && has_value) {
+                baseline_path = argv[++i];
+            } else if (arg == "--tolerance" && has_value) {
+                tolerance = stod(argv[++i]);
+            } else if (arg == "--check") {
+                check = true;
+            } else {
+                cerr << "Unknown or incomplete option: " << arg << endl;
+                print_usage();
+                return 1;
+            }
+        }
+    } catch (const exception& e) {
+        cerr << "Invalid option value: " << e.what() << endl;
+        return 1;
+    }
+
+    if (check) {
+        int floodMismatches = check_parallel_flood_fill(300);
+        fprintf(stderr, "Parallel flood fill: %s\n",
+                floodMismatches ? format("%d mismatches", floodMismatches).c_str() : "ok");
+        int noisyMismatches = report_noisy_flood_fill(Size(6000, 4000));
+        fprintf(stderr, "Parallel flood fill on a large noisy image: %s\n", noisyMismatches ? "masks differ" : "ok");
+        int growthMismatches = check_region_growth(200);
+        fprintf(stderr, "Incremental region growth: %s\n",
+                growthMismatches ? format("%d mismatches", growthMismatches).c_str() : "ok");
+        int seedMismatches = check_seed_regions(200);
+        fprintf(stderr, "Multi-seed region growing: %s\n",
+                seedMismatches ? format("%d mismatches", seedMismatches).c_str() : "ok");
+        int grabCutFailures = check_grabcut_band(4);
+        fprintf(stderr, "GrabCut band refinement: %s\n",
+                grabCutFailures ? format("%d failures", grabCutFailures).c_str() : "ok");
+        return floodMismatches + noisyMismatches + growthMismatches + seedMismatches + grabCutFailures ? 1 : 0;
+    }
+
+    vector<BenchmarkFunction> functions;
+    for (const BenchmarkFunction& function : benchmark_functions()) {
+        if (only.empty() || find(only.begin(), only.end(), function.name) != only.end()) {
+            functions.push_back(function);
+        }
+    }
+    if (functions.empty()) {
+        cerr << "No matching functions" << endl;
+        return 1;
+    }
+
+    vector<Mat> originals;
+    for (const string& path : images) {
+        Mat image = imread(path, IMREAD_COLOR);
+        if (image.empty()) {
+            cerr << "Failed to load " << path << endl;
+            return 1;
+        }
+        originals.push_back(image);
+    }
+
+    vector<BenchmarkResult> results;
+    for (double megapixels : sizes) {
+        // Inputs at this size: the synthetic scene (4:3) and every real image
+        vector<pair<string, Mat>> inputs;
+        int width = max(1, (int)round(sqrt(megapixels * 1e6 * 4 / 3)));
+        int height = max(1, (int)round(megapixels * 1e6 / width));
+        inputs.push_back({"synthetic", synthetic_image(Size(width, height))});
+        for (size_t i = 0; i < originals.size(); i++) {
+            double scale = sqrt(megapixels * 1e6 / originals[i].total());
+            Mat resized;
+            resize(originals[i], resized, Size(), scale, scale, scale < 1.0 ? INTER_AREA : INTER_LINEAR);
+            inputs.push_back({filesystem::path(images[i]).filename().string(), resized});
+        }
+
+        for (const auto& input : inputs) {
+            for (const BenchmarkFunction& function : functions) {
+                BenchmarkResult result = run_benchmark(function, input.first, input.second, warmup, repeats);
+                if (result.error.empty()) {
+                    fprintf(stderr, "%-42s %-20s %6.2f MP  median %10.2f ms  p95 %10.2f ms  %8.2f MP/s  %8.1f MB\n",
+                            result.function.c_str(), input.first.c_str(), input.second.total() / 1e6,
+                            result.median_ms, result.p95_ms, result.mp_per_s, result.peak_rss_mb);
+                } else {
+                    fprintf(stderr, "%-42s %-20s %6.2f MP  FAILED: %s\n", result.function.c_str(),
+                            input.first.c_str(), input.second.total() / 1e6, result.error.c_str());
+                }
+                results.push_back(result);
+            }
+        }
+    }
+
+    if (output_path.empty()) {
+        write_json(cout, results);
+    } else {
+        ofstream out(output_path);
+        write_json(out, results);
+        if (!out) {
+            cerr << "Failed to write " << output_path << endl;
+            return 1;
+        }
+    }
+
+    if (!baseline_path.empty()) {
+        try {
+            int regressions = compare_with_baseline(results, read_baseline(baseline_path), tolerance);
+            if (regressions > 0) {
+                fprintf(stderr, "\n%d regression(s) beyond %.0f%%\n", regressions, tolerance * 100);
+                return 3;
+            }
+        } catch (const exception& e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
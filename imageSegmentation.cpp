@@ -6,9 +6,20 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <array>
 #include <queue>
 #include <functional>   
 #include <cmath>
+#include <cfloat>
+#include <thread>
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
 
 using namespace cv;
 using namespace std;
@@ -19,1007 +30,5487 @@ GtkWidget *original_image_view;
 GtkWidget *processed_image_view;
 GtkWidget *algorithm_combo;
 GtkWidget *apply_button;
+GtkWidget *export_button;
 GtkWidget *status_label;
 GtkWidget *info_label;
 GtkWidget *threshold_label;
 GtkWidget *threshold_slider_box;
 GtkWidget *threshold_slider;
+GtkWidget *smoothing_toggle;
 GtkWidget *kmeans_slider_box;
 GtkWidget *kmeans_slider;
+GtkWidget *kmeans_refine_toggle;
+GtkWidget *otsu_slider_box;
+GtkWidget *otsu_slider;
+GtkWidget *otsu_refine_toggle;
+GtkWidget *region_slider_box;
+GtkWidget *region_slider;
+GtkWidget *histogram_view;
 char *filename = NULL;
 Mat input_image;
+Mat processed_result; // Last displayed result, written to disk only on export
+Size processed_display_size; // Size the result is drawn at in processed_image_view
+vector<Point> current_stroke; // GrabCut stroke being dragged, in image coordinates
+bool current_stroke_foreground = true;
+vector<Point> region_seeds; // Seeds clicked for Region Growing (Multi-Seed)
 
-// Algorithm parameters and thresholds
+// Algorithm parameters and thresholds (defaults for SegmentationParams)
 const int REGION_GROWING_THRESHOLD = 30;
+const int REGION_SEED_GRID = 4;          // Multi-seed region growing: seeds per side when none are given
+const int REGION_STRIPE_ROWS = 64;       // Rows labelled per task by the parallel region labelling
+const int FLOOD_PARALLEL_PIXELS = 1 << 20; // Flood fills larger than this finish on all threads
 const int ACTIVE_CONTOURS_ITERATIONS = 100;
 const float ACTIVE_CONTOURS_ALPHA = 0.1;
 const float ACTIVE_CONTOURS_BETA = 0.2;
 const float ACTIVE_CONTOURS_GAMMA = 0.4;
+const float ACTIVE_CONTOURS_TIME_STEP = 1.0;
+const float ACTIVE_CONTOURS_TOLERANCE = 0.05; // Stop once no snake point moves further (pixels)
+const double ACTIVE_CONTOURS_SPACING = 2.0;   // Snake point spacing along the contour (pixels)
+const float GVF_MU = 0.2;                     // Gradient Vector Flow smoothness (stable up to 0.25)
+const int GVF_ITERATIONS = 200;
+const int GVF_MAX_SIDE = 512;                 // Default longest side the GVF is computed at
+const int GVF_BLOCK_ROWS = 32;                // Rows per cache-blocked diffusion task
+const int GVF_BLOCK_STEPS = 8;                // Diffusion sweeps done per block while in cache
+const int LEVEL_SET_ITERATIONS = 300;
+const float LEVEL_SET_MU = 0.1;               // Curvature (smoothness) weight
+const float LEVEL_SET_LAMBDA = 1.0;           // Region (intensity fit) weight
+const int LEVEL_SET_STALL_ITERATIONS = 5;     // Stop after this many iterations without change
 const int KMEANS_MAX_ITER = 10;
 const double KMEANS_EPSILON = 1.0;
 const int WATERSHED_MORPH_SIZE = 3;
 const int GRAPH_CUT_ITERATIONS = 5;
-int BACKTRACKING_THRESHOLD = 128;
-int KMEANS_CLUSTERS = 2;
+const int GRAPH_CUT_MAX_SIDE = 512;  // Larger images run GrabCut on a level this size, then refine (0 = off)
+const int GRAPH_CUT_TILE = 128;      // Boundary refinement tile side (pixels)
+const int GRAPH_CUT_TILE_HALO = 16;  // Context read around each refinement tile
+const int GRAB_CUT_STROKE_MARGIN = 48;     // Pixels re-solved around a stroke
+const int GRAB_CUT_STROKE_RADIUS = 3;      // Stroke radius in display pixels
+const float GRID_CUT_SMOOTHNESS = 10.0;    // Weight of the contrast-sensitive boundary term
+const int GRID_CUT_CONNECTIVITY = 8;
+const int GRID_CUT_COLOR_BINS = 16;        // Colour histogram bins per channel (power of two)
+const int GRID_CUT_PARALLEL_PIXELS = 1 << 19; // Larger grids are cut in parallel stripes
+const int GRID_CUT_STRIPE_ROWS = 256;       // Rows per parallel stripe, fixed so results match on any machine
+const int GRID_CUT_DUAL_ROUNDS = 30;       // Multiplier updates before stripes are forced to agree
+const int BACKTRACKING_THRESHOLD = 128;
+const int KMEANS_CLUSTERS = 2;
+const int KMEANS_MAX_CLUSTERS = 32;
+const int KMEANS_SAMPLE_LIMIT = 100000; // Colour K-Means fits centers on at most this many pixels
+
+// Feature space used by colour K-Means
+enum KMeansColorSpace {
+    KMEANS_BGR,
+    KMEANS_LAB,
+};
+const KMeansColorSpace KMEANS_COLOR_SPACE = KMEANS_LAB;
+const double KMEANS_SPATIAL_WEIGHT = 0.0; // Weight of pixel position against colour
+
+// Edge-preserving smoothing used by the backtracking pipelines
+enum SmoothingFilter {
+    SMOOTHING_BILATERAL,      // Exact bilateralFilter; cost grows with the kernel area
+    SMOOTHING_BILATERAL_GRID, // Bilateral grid approximation; constant cost per pixel
+};
+const SmoothingFilter SMOOTHING_FILTER = SMOOTHING_BILATERAL;
+const int BILATERAL_DIAMETER = 9;
+const double BILATERAL_SIGMA = 75.0; // Both the colour and the space sigma
+const int BILATERAL_GRID_CELL = 2;   // Bilateral grid cell side (pixels)
+const int BILATERAL_GRID_BAND = 16;  // Grid rows built per task
+const int ADAPTIVE_BLOCK_SIZE = 21;   // Gaussian adaptive threshold neighbourhood (pixels)
+const int ADAPTIVE_C = 5;             // Offset subtracted from the local mean
+const int EDGE_STRIPE_ROWS = 64;     // Rows per stripe of the fused gradient/threshold passes
+const int MASK_STRIPE_ROWS = 16;     // Rows converted to gray per task when packing masks
+const int HISTOGRAM_STRIPE_ROWS = 64; // Rows counted per task into private histogram bins
+const int OTSU_LEVELS = 1;           // Otsu thresholds; more split the image into more classes
+const int OTSU_MAX_LEVELS = 5;
+
+// Parameters of one segmentation run. Algorithms read their parameters from
+// here and never from globals, so runs with different parameters can proceed
+// on different threads at the same time.
+struct SegmentationParams {
+    int backtracking_threshold = BACKTRACKING_THRESHOLD;
+    int region_growing_threshold = REGION_GROWING_THRESHOLD;
+    vector<Point> region_seeds; // Multi-seed region growing (empty: a REGION_SEED_GRID grid)
+    bool region_floating_range = false; // Multi-seed: compare neighbours instead of each pixel with its seed
+    int active_contours_iterations = ACTIVE_CONTOURS_ITERATIONS;
+    float active_contours_alpha = ACTIVE_CONTOURS_ALPHA;
+    float active_contours_beta = ACTIVE_CONTOURS_BETA;
+    float active_contours_gamma = ACTIVE_CONTOURS_GAMMA;
+    float active_contours_time_step = ACTIVE_CONTOURS_TIME_STEP;
+    float active_contours_tolerance = ACTIVE_CONTOURS_TOLERANCE;
+    int gvf_max_side = GVF_MAX_SIDE; // Longest side of the snake force field (0 = full resolution)
+    int level_set_iterations = LEVEL_SET_ITERATIONS;
+    float level_set_mu = LEVEL_SET_MU;
+    float level_set_lambda = LEVEL_SET_LAMBDA;
+    int otsu_levels = OTSU_LEVELS;
+    int kmeans_clusters = KMEANS_CLUSTERS;
+    int kmeans_max_iter = KMEANS_MAX_ITER;
+    double kmeans_epsilon = KMEANS_EPSILON;
+    KMeansColorSpace kmeans_color_space = KMEANS_COLOR_SPACE;
+    double kmeans_spatial_weight = KMEANS_SPATIAL_WEIGHT;
+    SmoothingFilter smoothing_filter = SMOOTHING_FILTER;
+    int graph_cut_iterations = GRAPH_CUT_ITERATIONS;
+    int graph_cut_max_side = GRAPH_CUT_MAX_SIDE;
+    int graph_cut_tile = GRAPH_CUT_TILE; // Band refinement tile side (0 = the whole band in one cut)
+    float grid_cut_smoothness = GRID_CUT_SMOOTHNESS;
+    int grid_cut_connectivity = GRID_CUT_CONNECTIVITY;
+    bool grid_cut_refine = false; // Clean up two-class Otsu and K-Means results with refineMaskWithGridCut
+
+    TermCriteria kmeansCriteria() const {
+        return TermCriteria(TermCriteria::EPS + TermCriteria::MAX_ITER, kmeans_max_iter, kmeans_epsilon);
+    }
+};
+
+// Algorithm names shown in the GUI and their command line equivalents
+struct AlgorithmName {
+    const char *cli_name;
+    const char *display_name;
+};
+
+const AlgorithmName ALGORITHM_NAMES[] = {
+    {"active-contours", "Active Contours"},
+    {"level-set", "Level Set (Chan-Vese)"},
+    {"kmeans", "K-Means"},
+    {"kmeans-color", "K-Means (Color)"},
+    {"otsu", "Otsu Thresholding"},
+    {"backtracking", "Backtracking"},
+    {"backtracking-8dir", "Backtracking (8-Dir)"},
+    {"backtracking-improved", "Backtracking Improved"},
+    {"backtracking-edge", "Backtracking Edge Enhanced"},
+    {"watershed", "Watershed"},
+    {"graph-cut", "Graph Cut"},
+    {"grid-cut", "Graph Cut (Grid Max-Flow)"},
+    {"region-growing", "Region Growing"},
+    {"region-growing-multi", "Region Growing (Multi-Seed)"},
+};
+
+// Stages only available in tiled mode: the threshold steps of Backtracking and
+// Backtracking Improved without their region fill, which needs the whole image
+const AlgorithmName TILED_STAGE_NAMES[] = {
+    {"threshold", "Threshold"},
+    {"smoothed-threshold", "Smoothed Threshold"},
+};
+
+// Flood fill connectivity
+enum FloodConnectivity {
+    FLOOD_4 = 4,
+    FLOOD_8 = 8,
+};
+
+// Max-tree (or min-tree) of an 8-bit image. Every node is a connected
+// component of an upper level set {f >= level} (or lower level set for the
+// min-tree), so the region a flood fill from a seed would cover at any
+// threshold is a single node. The tree is built once with union-find over the
+// pixels sorted by level, and pixels are laid out in pre-order so each node's
+// pixels form one contiguous range of `order`.
+class ComponentTree {
+public:
+    void build(const Mat& image, int connectivity, bool minTree) {
+        CV_Assert(image.type() == CV_8UC1);
+        min_tree = minTree;
+        cols = image.cols;
+        const int count = image.rows * image.cols;
+
+        // Levels are inverted for the min-tree so both trees are max-trees of g
+        vector<uchar> g(count);
+        for (int y = 0; y < image.rows; y++) {
+            const uchar *row = image.ptr<uchar>(y);
+            for (int x = 0; x < cols; x++) {
+                g[y * cols + x] = minTree ? 255 - row[x] : row[x];
+            }
+        }
 
-// Forward declarations of segmentation algorithms
-Mat activeContoursSegmentation(const Mat& image);
-Mat kMeansSegmentation(const Mat& image, int clusters);
-Mat otsuSegmentation(const Mat& image, double& otsuThreshold);
-Mat backtrackingSegmentation(const Mat& image);
-Mat backtrackingSegmentation8Dir(const Mat& image);
-Mat backtrackingSegmentationImproved(const Mat& image);
-Mat backtrackingEdgeEnhancementSegmentation(const Mat& image);
-Mat watershedSegmentation(const Mat& image);
-Mat graphCutSegmentation(const Mat& image);
-Mat regionGrowingSegmentation(const Mat& image, Point seed, int threshold);
+        // Counting sort of the pixels by increasing level
+        vector<int> sorted(count);
+        {
+            int offsets[257] = {0};
+            for (int p = 0; p < count; p++) {
+                offsets[g[p] + 1]++;
+            }
+            for (int v = 0; v < 256; v++) {
+                offsets[v + 1] += offsets[v];
+            }
+            for (int p = 0; p < count; p++) {
+                sorted[offsets[g[p]]++] = p;
+            }
+        }
 
-// Forward declarations
-static void update_backtracking_segmentation();
-static void update_backtracking_improved_segmentation();
-static void update_backtracking_edge_enhanced_segmentation();
-static void update_kmeans_segmentation();
-static void on_algorithm_changed(GtkComboBox *widget, gpointer data);
+        // Union-find from the highest level down (union by rank + path halving)
+        vector<int> parent(count);
+        {
+            vector<int> zpar(count, -1);
+            vector<int> repr(count);
+            vector<uchar> rank(count, 0);
+            auto find = [&zpar](int x) {
+                while (zpar[x] != x) {
+                    zpar[x] = zpar[zpar[x]];
+                    x = zpar[x];
+                }
+                return x;
+            };
+
+            const int dx[] = {1, -1, 0, 0, 1, -1, 1, -1};
+            const int dy[] = {0, 0, 1, -1, 1, -1, -1, 1};
+            const int directions = connectivity == FLOOD_8 ? 8 : 4;
+            for (int i = count - 1; i >= 0; i--) {
+                int p = sorted[i];
+                int px = p % cols;
+                int py = p / cols;
+                parent[p] = p;
+                zpar[p] = p;
+                repr[p] = p;
+                int zp = p;
+                for (int d = 0; d < directions; d++) {
+                    int nx = px + dx[d];
+                    int ny = py + dy[d];
+                    if (nx < 0 || ny < 0 || nx >= cols || ny >= image.rows) {
+                        continue;
+                    }
+                    int n = ny * cols + nx;
+                    if (zpar[n] < 0) {
+                        continue; // Not processed yet: lower level
+                    }
+                    int zn = find(n);
+                    if (zn != zp) {
+                        parent[repr[zn]] = p;
+                        if (rank[zp] < rank[zn]) {
+                            swap(zp, zn);
+                        }
+                        zpar[zn] = zp;
+                        repr[zp] = p;
+                        if (rank[zp] == rank[zn]) {
+                            rank[zp]++;
+                        }
+                    }
+                }
+            }
+        }
 
-// Callback for threshold slider change
-static void on_threshold_changed(GtkRange *range, gpointer data) {
-    BACKTRACKING_THRESHOLD = (int)gtk_range_get_value(range);
-    
-    // Only update if backtracking is selected
-    gchar *selected_algorithm = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(algorithm_combo));
-    if (selected_algorithm != NULL) {
-        if (strcmp(selected_algorithm, "Backtracking") == 0) {
-            update_backtracking_segmentation();
-        } else if (strcmp(selected_algorithm, "Backtracking Improved") == 0) {
-            update_backtracking_improved_segmentation();
-        } else if (strcmp(selected_algorithm, "Backtracking Edge Enhanced") == 0) {
-            update_backtracking_edge_enhanced_segmentation();
+        // Point every pixel at the canonical pixel of its node; parents always
+        // come before their children in sorted order
+        const int root = sorted[0];
+        for (int i = 0; i < count; i++) {
+            int p = sorted[i];
+            int q = parent[p];
+            if (g[parent[q]] == g[q]) {
+                parent[p] = parent[q];
+            }
+        }
+
+        // Subtree sizes, children before parents
+        vector<int> area(count, 1);
+        for (int i = count - 1; i > 0; i--) {
+            int p = sorted[i];
+            area[parent[p]] += area[p];
+        }
+
+        // Pre-order layout: each pixel claims a slice of its parent's range
+        order.assign(count, 0);
+        vector<int> start(count);
+        {
+            vector<int> cursor(count);
+            for (int i = 0; i < count; i++) {
+                int p = sorted[i];
+                if (p == root) {
+                    start[p] = 0;
+                } else {
+                    int q = parent[p];
+                    start[p] = cursor[q];
+                    cursor[q] += area[p];
+                }
+                order[start[p]] = p;
+                cursor[p] = start[p] + 1;
+            }
+        }
+
+        // Compact node table; node ids follow sorted order so the root is node 0
+        nodes.clear();
+        pixel_node.assign(count, 0);
+        for (int i = 0; i < count; i++) {
+            int p = sorted[i];
+            bool canonical = p == root || g[parent[p]] != g[p];
+            if (canonical) {
+                Node node;
+                node.parent = p == root ? 0 : pixel_node[parent[p]];
+                node.start = start[p];
+                node.area = area[p];
+                node.level = g[p];
+                pixel_node[p] = (int)nodes.size();
+                nodes.push_back(node);
+            } else {
+                pixel_node[p] = pixel_node[parent[p]];
+            }
         }
     }
-    g_free(selected_algorithm);
-}
 
-// Callback for kmeans slider change
-static void on_kmeans_changed(GtkRange *range, gpointer data) {
-    KMEANS_CLUSTERS = (int)gtk_range_get_value(range);
-    
-    // Only update if kmeans is selected
-    gchar *selected_algorithm = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(algorithm_combo));
-    if (selected_algorithm != NULL && strcmp(selected_algorithm, "K-Means") == 0) {
-        update_kmeans_segmentation();
+    // Write value into dst (continuous, image sized) for every pixel of the
+    // connected component of {f > threshValue} (max-tree) or {f <= threshValue}
+    // (min-tree) that contains seed. Nothing is written if seed is not in the set.
+    void paint(Mat& dst, Point seed, int threshValue, uchar value) const {
+        CV_Assert(dst.isContinuous() && dst.type() == CV_8UC1);
+        int lambda = min_tree ? 255 - threshValue : threshValue + 1;
+        int node = pixel_node[seed.y * cols + seed.x];
+        if (nodes[node].level < lambda) {
+            return;
+        }
+        while (node != 0 && nodes[nodes[node].parent].level >= lambda) {
+            node = nodes[node].parent;
+        }
+
+        uchar *out = dst.data;
+        const int *pixels = order.data() + nodes[node].start;
+        for (int k = 0; k < nodes[node].area; k++) {
+            out[pixels[k]] = value;
+        }
     }
-    g_free(selected_algorithm);
-}
 
-// Update backtracking segmentation with current threshold
-static void update_backtracking_segmentation() {
-    if (filename == NULL || input_image.empty()) {
-        return;
+private:
+    struct Node {
+        int parent;
+        int start;
+        int area;
+        uchar level;
+    };
+
+    bool min_tree = false;
+    int cols = 0;
+    vector<Node> nodes;
+    vector<int> pixel_node;
+    vector<int> order;
+};
+
+// One GVF sweep of a row of interleaved (u, v) values. weight holds |grad f|^2
+// twice per pixel, so the interior loop is one branch-free pass over floats
+// that the compiler vectorizes; the edge pixels replicate their neighbour.
+static inline void diffuseVectorFlowRow(const float *__restrict up, const float *__restrict row,
+                                        const float *__restrict down, const float *__restrict g,
+                                        const float *__restrict weight, float *__restrict out, int cols) {
+    auto update = [&](int i, float left, float right) {
+        float laplacian = up[i] + down[i] + left + right - 4 * row[i];
+        out[i] = row[i] + GVF_MU * laplacian - weight[i] * (row[i] - g[i]);
+    };
+    const int last = 2 * cols - 2;
+    for (int c = 0; c < 2; c++) {
+        update(c, row[c], row[min(c + 2, last + c)]);
+    }
+    for (int i = 2; i < last; i++) {
+        float laplacian = up[i] + down[i] + row[i - 2] + row[i + 2] - 4 * row[i];
+        out[i] = row[i] + GVF_MU * laplacian - weight[i] * (row[i] - g[i]);
     }
+    for (int c = 0; c < 2 && cols > 1; c++) {
+        update(last + c, row[last + c - 2], row[last + c]);
+    }
+}
 
-    try {
-        auto start_time = chrono::high_resolution_clock::now();
-        
-        Mat processed_image = backtrackingSegmentation(input_image);
-        
-        auto end_time = chrono::high_resolution_clock::now();
-        double elapsed_time = chrono::duration<double, milli>(end_time - start_time).count();
+// Runs iterations Jacobi sweeps of the GVF diffusion on field, in place. The
+// sweeps are blocked into bands of GVF_BLOCK_ROWS rows: each task copies its
+// band plus GVF_BLOCK_STEPS rows of context on either side, runs up to
+// GVF_BLOCK_STEPS sweeps on the copy while it stays in cache (the valid rows
+// shrink by one per sweep from each side that has context) and writes back the
+// band. Every cell sees the same arithmetic as full-frame sweeps, so the
+// result is identical; the context rows are the only extra work.
+static void diffuseVectorFlow(Mat& field, const Mat& data, const Mat& weight, int iterations) {
+    const int rows = field.rows, cols = field.cols;
+    const int bands = (rows + GVF_BLOCK_ROWS - 1) / GVF_BLOCK_ROWS;
+    Mat next(rows, cols, CV_32FC2);
+    for (int done = 0; done < iterations; done += GVF_BLOCK_STEPS) {
+        const int steps = min(GVF_BLOCK_STEPS, iterations - done);
+        parallel_for_(Range(0, bands), [&](const Range& range) {
+            Mat buffers[2];
+            for (int band = range.start; band < range.end; band++) {
+                const int y0 = band * GVF_BLOCK_ROWS, y1 = min(rows, y0 + GVF_BLOCK_ROWS);
+                const int lo = max(0, y0 - steps), hi = min(rows, y1 + steps);
+                field.rowRange(lo, hi).copyTo(buffers[0]);
+                buffers[1].create(hi - lo, cols, CV_32FC2);
+                for (int step = 1; step <= steps; step++) {
+                    const Mat& source = buffers[(step - 1) & 1];
+                    Mat& target = buffers[step & 1];
+                    const int first = lo == 0 ? 0 : lo + step, last = hi == rows ? rows : hi - step;
+                    for (int y = first; y < last; y++) {
+                        diffuseVectorFlowRow(source.ptr<float>(max(y - 1, 0) - lo), source.ptr<float>(y - lo),
+                                             source.ptr<float>(min(y + 1, rows - 1) - lo), data.ptr<float>(y),
+                                             weight.ptr<float>(y), target.ptr<float>(y - lo), cols);
+                    }
+                }
+                buffers[steps & 1].rowRange(y0 - lo, y1 - lo).copyTo(next.rowRange(y0, y1));
+            }
+        });
+        swap(field, next);
+    }
+}
 
-        if (!processed_image.empty()) {
-            string temp_filename = string(filename) + "_processed.jpg";
-            imwrite(temp_filename, processed_image);
+// Gradient Vector Flow (Xu & Prince) of an 8-bit edge map, shaped into a snake
+// force field. The gradient of the smoothed edge map is diffused over the whole
+// image by Jacobi sweeps of V <- V + mu * laplacian(V) - |grad f|^2 (V - grad f).
+// u and v are interleaved in one CV_32FC2 image and the sweeps are blocked
+// into row bands (see diffuseVectorFlow), so several run per trip through
+// memory. The result keeps the GVF direction; its length is min(1, d / 2) for
+// distance d to the nearest edge in source pixels (pixelScale edge map pixels
+// each), so snake points run at full speed from afar and settle on the edge
+// instead of oscillating.
+static Mat computeGradientVectorFlow(const Mat& edges, double pixelScale) {
+    const int rows = edges.rows, cols = edges.cols;
+    Mat f;
+    edges.convertTo(f, CV_32F, 1.0 / 255);
+    GaussianBlur(f, f, Size(5, 5), 1.0);
+
+    // Step 1: Edge map gradient (the GVF data term) and its squared magnitude
+    Mat data(rows, cols, CV_32FC2), weight(rows, cols, CV_32FC2);
+    for (int y = 0; y < rows; y++) {
+        const float *up = f.ptr<float>(max(y - 1, 0)), *row = f.ptr<float>(y);
+        const float *down = f.ptr<float>(min(y + 1, rows - 1));
+        Vec2f *g = data.ptr<Vec2f>(y);
+        Vec2f *b = weight.ptr<Vec2f>(y);
+        for (int x = 0; x < cols; x++) {
+            float gx = 0.5f * (row[min(x + 1, cols - 1)] - row[max(x - 1, 0)]);
+            float gy = 0.5f * (down[x] - up[x]);
+            g[x] = Vec2f(gx, gy);
+            b[x] = Vec2f(gx * gx + gy * gy, gx * gx + gy * gy); // Once per channel for diffuseVectorFlowRow
+        }
+    }
 
-            GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file_at_scale(temp_filename.c_str(), 
-                                                             400, 400, 
-                                                             TRUE, 
-                                                             NULL);
-            if (pixbuf) {
-                gtk_image_set_from_pixbuf(GTK_IMAGE(processed_image_view), pixbuf);
-                g_object_unref(pixbuf);
-                
-                gtk_label_set_text(GTK_LABEL(status_label), 
-                    g_strdup_printf("Processing Time: %.2f ms", elapsed_time));
-                
-                gtk_label_set_text(GTK_LABEL(threshold_label), 
-                    g_strdup_printf("Parameters:\nBacktracking threshold: %d", 
-                    BACKTRACKING_THRESHOLD));
-            }
+    // Step 2: Diffuse
+    Mat field = data.clone();
+    diffuseVectorFlow(field, data, weight, GVF_ITERATIONS);
+
+    // Step 3: Unit direction scaled down within two pixels of an edge
+    Mat notEdges, distance;
+    threshold(edges, notEdges, 0, 255, THRESH_BINARY_INV);
+    distanceTransform(notEdges, distance, DIST_L2, DIST_MASK_PRECISE);
+    for (int y = 0; y < rows; y++) {
+        Vec2f *v = field.ptr<Vec2f>(y);
+        const float *d = distance.ptr<float>(y);
+        for (int x = 0; x < cols; x++) {
+            float length = sqrt(v[x][0] * v[x][0] + v[x][1] * v[x][1]);
+            float speed = min(1.0f, (float)(d[x] * pixelScale) / 2);
+            v[x] = length > 1e-12f ? v[x] * (speed / length) : Vec2f(0, 0);
         }
-    } catch (const cv::Exception& e) {
-        gtk_label_set_text(GTK_LABEL(status_label), g_strdup_printf("Error: %s", e.what()));
     }
+    return field;
 }
 
-// Update improved backtracking segmentation with current threshold
-static void update_backtracking_improved_segmentation() {
-    if (filename == NULL || input_image.empty()) {
-        return;
+// Bilateral grid approximation (Paris and Durand; Chen, Paris and Durand) of
+// bilateralFilter(gray, BILATERAL_DIAMETER, BILATERAL_SIGMA, BILATERAL_SIGMA).
+// Pixels are splatted into a coarse (x, y, intensity) grid with cells of
+// BILATERAL_GRID_CELL pixels by BILATERAL_SIGMA levels, the grid is blurred
+// with a 5-tap binomial kernel along each axis (spanning the 9 pixel
+// diameter), and every pixel reads its result back by trilinear
+// interpolation. The cost per pixel is constant whatever the kernel size.
+// Cells are aligned to image coordinates plus origin, so tiles of one image
+// produce the same values where their halos overlap.
+static Mat bilateralGridFilter(const Mat& gray, Point origin = Point(0, 0)) {
+    const int cell = BILATERAL_GRID_CELL, pad = 2; // Spatial border of the blur radius
+    const int baseX = origin.x / cell, baseY = origin.y / cell;
+    const int width = (origin.x + gray.cols - 1) / cell - baseX + 2 + 2 * pad;
+    const int height = (origin.y + gray.rows - 1) / cell - baseY + 2 + 2 * pad;
+    // Intensity bins up to the highest one splatted, plus one to interpolate
+    // towards; the blur treats bins past either end as the empty cells they are
+    const int depth = cvRound(255 / BILATERAL_SIGMA) + 2;
+    const size_t rowSize = (size_t)width * depth;
+
+    // Nearest cell of every column and intensity for splatting, and the
+    // lower cell and fraction for slicing
+    vector<int> splatX(gray.cols), sliceX(gray.cols);
+    vector<float> fractionX(gray.cols);
+    for (int x = 0; x < gray.cols; x++) {
+        splatX[x] = ((origin.x + x + cell / 2) / cell - baseX + pad) * depth;
+        float gx = (float)(origin.x + x) / cell - baseX + pad;
+        sliceX[x] = (int)gx * depth;
+        fractionX[x] = gx - (int)gx;
+    }
+    int splatZ[256], sliceZ[256];
+    float fractionZ[256];
+    for (int v = 0; v < 256; v++) {
+        splatZ[v] = cvRound(v / BILATERAL_SIGMA);
+        float gz = (float)(v / BILATERAL_SIGMA);
+        sliceZ[v] = (int)gz;
+        fractionZ[v] = gz - (int)gz;
     }
 
-    try {
-        auto start_time = chrono::high_resolution_clock::now();
-        
-        Mat processed_image = backtrackingSegmentationImproved(input_image);
-        
-        auto end_time = chrono::high_resolution_clock::now();
-        double elapsed_time = chrono::duration<double, milli>(end_time - start_time).count();
+    // The blur is linear, so intensity sums and counts are filtered alike as
+    // one float array of interleaved pairs: neighbours along intensity are 2
+    // floats apart, along x 2 * depth and along y one grid row
+    const size_t rowFloats = 2 * rowSize;
+    const float taps[5] = {1 / 16.0f, 4 / 16.0f, 6 / 16.0f, 4 / 16.0f, 1 / 16.0f};
+    auto blurLine = [&taps](const float *src, float *dst, size_t count, size_t step) {
+        for (size_t c = 0; c < count; c++) {
+            dst[c] = taps[0] * src[c - 2 * step] + taps[1] * src[c - step] + taps[2] * src[c] +
+                     taps[3] * src[c + step] + taps[4] * src[c + 2 * step];
+        }
+    };
+
+    // The grid is streamed in bands of BILATERAL_GRID_BAND cell rows, each
+    // task building only the rows its band needs (plus a halo of 3 for the
+    // y blur and interpolation), so the working set stays in cache
+    Mat smooth(gray.size(), CV_8UC1);
+    const int bands = (height + BILATERAL_GRID_BAND - 1) / BILATERAL_GRID_BAND;
+    parallel_for_(Range(0, bands), [&](const Range& range) {
+        const int localRows = BILATERAL_GRID_BAND + 6;
+        vector<float> local(localRows * rowFloats), blurred((BILATERAL_GRID_BAND + 1) * rowFloats), line(rowFloats);
+        vector<float> bins(2 * depth + 8, 0.0f); // One cell's intensity bins with two empty bins on each side
+        for (int b = range.start; b < range.end; b++) {
+            const int first = b * BILATERAL_GRID_BAND, last = min(height, first + BILATERAL_GRID_BAND);
+            const int localFirst = first - 2;
+            fill(local.begin(), local.end(), 0.0f);
+
+            // Step 1: Splat the intensity sums and counts of every pixel into
+            // its nearest cell, then blur [1 4 6 4 1] / 16 along intensity and x
+            for (int j = max(localFirst, 0); j < min(height, last + 4); j++) {
+                float *row = &local[(j - localFirst) * rowFloats];
+                int top = max(0, (j - pad + baseY) * cell - cell / 2 - origin.y);
+                int bottom = min(gray.rows, (j - pad + baseY) * cell - cell / 2 - origin.y + cell);
+                if (top >= bottom) {
+                    continue;
+                }
+                for (int y = top; y < bottom; y++) {
+                    const uchar *src = gray.ptr<uchar>(y);
+                    for (int x = 0; x < gray.cols; x++) {
+                        float *target = &row[2 * (splatX[x] + splatZ[src[x]])];
+                        target[0] += src[x];
+                        target[1] += 1.0f;
+                    }
+                }
+                for (int i = pad; i < width - pad; i++) {
+                    copy(row + 2 * i * depth, row + 2 * (i + 1) * depth, bins.begin() + 4);
+                    blurLine(bins.data() + 4, line.data() + 2 * i * depth, 2 * depth, 2);
+                }
+                size_t start = 2 * pad * depth;
+                blurLine(line.data() + start, row + start, 2 * (width - 2 * pad) * depth, 2 * depth);
+            }
 
-        if (!processed_image.empty()) {
-            string temp_filename = string(filename) + "_processed.jpg";
-            imwrite(temp_filename, processed_image);
+            // Step 2: Blur along y the rows that are sliced (the band and the
+            // row below it)
+            for (int j = first; j <= last && j < height - pad; j++) {
+                blurLine(&local[(j - localFirst) * rowFloats], &blurred[(j - first) * rowFloats], rowFloats, rowFloats);
+            }
 
-            GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file_at_scale(temp_filename.c_str(), 
-                                                             400, 400, 
-                                                             TRUE, 
-                                                             NULL);
-            if (pixbuf) {
-                gtk_image_set_from_pixbuf(GTK_IMAGE(processed_image_view), pixbuf);
-                g_object_unref(pixbuf);
-                
-                gtk_label_set_text(GTK_LABEL(status_label), 
-                    g_strdup_printf("Processing Time: %.2f ms", elapsed_time));
-                
-                gtk_label_set_text(GTK_LABEL(threshold_label), 
-                    g_strdup_printf("Parameters:\nBacktracking threshold: %d\nBilateral filter: sigma=75", 
-                    BACKTRACKING_THRESHOLD));
+            // Step 3: Slice - trilinear interpolation at each pixel's position
+            int top = max(0, (first - pad + baseY) * cell - origin.y);
+            int bottom = min(gray.rows, (last - pad + baseY) * cell - origin.y);
+            for (int y = top; y < bottom; y++) {
+                const uchar *src = gray.ptr<uchar>(y);
+                uchar *dst = smooth.ptr<uchar>(y);
+                float gy = (float)(origin.y + y) / cell - baseY + pad;
+                float fy = gy - (int)gy;
+                const float *upper = &blurred[((int)gy - first) * rowFloats], *lower = upper + rowFloats;
+                for (int x = 0; x < gray.cols; x++) {
+                    size_t index = 2 * (sliceX[x] + sliceZ[src[x]]);
+                    float fx = fractionX[x], fz = fractionZ[src[x]];
+                    float corner[4] = {(1 - fy) * (1 - fx), (1 - fy) * fx, fy * (1 - fx), fy * fx};
+                    const float *cells[4] = {upper + index, upper + index + 2 * depth, lower + index,
+                                             lower + index + 2 * depth};
+                    float sum = 0, count = 0;
+                    for (int n = 0; n < 4; n++) {
+                        sum += corner[n] * ((1 - fz) * cells[n][0] + fz * cells[n][2]);
+                        count += corner[n] * ((1 - fz) * cells[n][1] + fz * cells[n][3]);
+                    }
+                    dst[x] = count > 0 ? saturate_cast<uchar>(sum / count) : src[x];
+                }
             }
         }
-    } catch (const cv::Exception& e) {
-        gtk_label_set_text(GTK_LABEL(status_label), g_strdup_printf("Error: %s", e.what()));
+    });
+    return smooth;
+}
+
+// Edge-preserving smoothing of an 8-bit gray image with the chosen filter;
+// origin is the image's position in a larger one when smoothing tiles
+static Mat edgePreservingSmooth(const Mat& gray, SmoothingFilter filter, Point origin = Point(0, 0)) {
+    if (filter == SMOOTHING_BILATERAL_GRID) {
+        return bilateralGridFilter(gray, origin);
     }
+    Mat smooth;
+    bilateralFilter(gray, smooth, BILATERAL_DIAMETER, BILATERAL_SIGMA, BILATERAL_SIGMA);
+    return smooth;
 }
 
-// Update kmeans segmentation with current number of clusters
-static void update_kmeans_segmentation() {
-    if (filename == NULL || input_image.empty()) {
+// Sobel gradient magnitude normalized to 8 bits, and the adaptive threshold
+// (Gaussian mean of ADAPTIVE_BLOCK_SIZE, offset ADAPTIVE_C) closed with a 3x3
+// kernel, of an 8-bit image. Gives the results of Sobel, magnitude,
+// normalize, convertTo, adaptiveThreshold and morphologyEx over the whole
+// image, but streams stripes of EDGE_STRIPE_ROWS rows through all of them
+// while they are in cache. Filters run on row ranges of the image and read
+// their neighbours across stripe edges, which keeps the stripes seamless. The
+// first pass thresholds each stripe, computes its gradient magnitudes and
+// their range; the normalization needs the range of the whole image, so the
+// magnitudes are kept per stripe and the second pass only quantizes them into
+// the 8-bit output.
+static void edgeFeatures(const Mat& image, Mat& gradient, Mat& binary) {
+    const int rows = image.rows;
+    const int stripes = (rows + EDGE_STRIPE_ROWS - 1) / EDGE_STRIPE_ROWS;
+    gradient.create(image.size(), CV_8UC1);
+    binary.create(image.size(), CV_8UC1);
+    if (image.empty()) {
         return;
     }
 
-    try {
-        auto start_time = chrono::high_resolution_clock::now();
-        
-        Mat processed_image = kMeansSegmentation(input_image, KMEANS_CLUSTERS);
-        
-        auto end_time = chrono::high_resolution_clock::now();
-        double elapsed_time = chrono::duration<double, milli>(end_time - start_time).count();
-
-        if (!processed_image.empty()) {
-            string temp_filename = string(filename) + "_processed.jpg";
-            imwrite(temp_filename, processed_image);
-
-            GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file_at_scale(temp_filename.c_str(), 
-                                                             400, 400, 
-                                                             TRUE, 
-                                                             NULL);
-            if (pixbuf) {
-                gtk_image_set_from_pixbuf(GTK_IMAGE(processed_image_view), pixbuf);
-                g_object_unref(pixbuf);
-                
-                gtk_label_set_text(GTK_LABEL(status_label), 
-                    g_strdup_printf("Processing Time: %.2f ms", elapsed_time));
-                
-                gtk_label_set_text(GTK_LABEL(threshold_label), 
-                    g_strdup_printf("Parameters:\nNumber of clusters: %d\nMax iterations: %d\nEpsilon: %.1f", 
-                    KMEANS_CLUSTERS, KMEANS_MAX_ITER, KMEANS_EPSILON));
+    // Step 1: Per stripe, the Sobel magnitudes (kept for step 2), their range
+    // and the closed adaptive threshold. Sobel runs on row ranges of the
+    // image, so it reads the real neighbours across stripe edges.
+    Mat magnitudes(image.size(), CV_32FC1);
+    vector<double> lowest(stripes), highest(stripes);
+    Mat kernel = getStructuringElement(MORPH_RECT, Size(3, 3));
+    parallel_for_(Range(0, stripes), [&](const Range& range) {
+        Mat gradX, gradY, mean, thresholded, closed;
+        for (int s = range.start; s < range.end; s++) {
+            const int y0 = s * EDGE_STRIPE_ROWS, y1 = min(rows, y0 + EDGE_STRIPE_ROWS);
+            Mat stripe = image.rowRange(y0, y1);
+            Mat stripeMagnitudes = magnitudes.rowRange(y0, y1);
+            Sobel(stripe, gradX, CV_32F, 1, 0, 3);
+            Sobel(stripe, gradY, CV_32F, 0, 1, 3);
+            magnitude(gradX, gradY, stripeMagnitudes);
+            minMaxLoc(stripeMagnitudes, &lowest[s], &highest[s]);
+
+            // Threshold two rows beyond the stripe on each side so the close
+            // sees the same neighbours as on the whole image. The mean
+            // replicates the image border like adaptiveThreshold.
+            const int t0 = max(0, y0 - 2), t1 = min(rows, y1 + 2);
+            Mat source = image.rowRange(t0, t1);
+            GaussianBlur(source, mean, Size(ADAPTIVE_BLOCK_SIZE, ADAPTIVE_BLOCK_SIZE), 0, 0, BORDER_REPLICATE);
+            thresholded.create(source.size(), CV_8UC1);
+            for (int y = 0; y < source.rows; y++) {
+                const uchar *src = source.ptr<uchar>(y), *local = mean.ptr<uchar>(y);
+                uchar *dst = thresholded.ptr<uchar>(y);
+                for (int x = 0; x < source.cols; x++) {
+                    dst[x] = src[x] - local[x] > -ADAPTIVE_C ? 255 : 0;
+                }
             }
+            morphologyEx(thresholded, closed, MORPH_CLOSE, kernel);
+            closed.rowRange(y0 - t0, y1 - t0).copyTo(binary.rowRange(y0, y1));
         }
-    } catch (const cv::Exception& e) {
-        gtk_label_set_text(GTK_LABEL(status_label), g_strdup_printf("Error: %s", e.what()));
-    }
+    });
+
+    // Step 2: Magnitudes scaled to the full 0-255 range like NORM_MINMAX,
+    // written directly as 8-bit
+    const double low = *min_element(lowest.begin(), lowest.end());
+    const double high = *max_element(highest.begin(), highest.end());
+    const double scale = high > low ? 255.0 / (high - low) : 0.0;
+    parallel_for_(Range(0, stripes), [&](const Range& range) {
+        for (int s = range.start; s < range.end; s++) {
+            const int y0 = s * EDGE_STRIPE_ROWS, y1 = min(rows, y0 + EDGE_STRIPE_ROWS);
+            Mat output = gradient.rowRange(y0, y1);
+            magnitudes.rowRange(y0, y1).convertTo(output, CV_8U, scale, -low * scale);
+        }
+    });
 }
 
-// Callback for algorithm selection change
-static void on_algorithm_changed(GtkComboBox *widget, gpointer data) {
-    gchar *selected_algorithm = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(widget));
-    
-    // Show/hide appropriate sliders based on algorithm selection
-    if (selected_algorithm != NULL) {
-        if (strcmp(selected_algorithm, "Backtracking") == 0 || 
-            strcmp(selected_algorithm, "Backtracking (8-Dir)") == 0 ||
-            strcmp(selected_algorithm, "Backtracking Improved") == 0 ||
-            strcmp(selected_algorithm, "Backtracking Edge Enhanced") == 0) {
-            gtk_widget_show_all(threshold_slider_box);
-            gtk_widget_hide(kmeans_slider_box);
-        } else if (strcmp(selected_algorithm, "K-Means") == 0) {
-            gtk_widget_hide(threshold_slider_box);
-            gtk_widget_show_all(kmeans_slider_box);
-        } else {
-            gtk_widget_hide(threshold_slider_box);
-            gtk_widget_hide(kmeans_slider_box);
+// 256-bin histogram of an 8-bit gray image. Stripes of HISTOGRAM_STRIPE_ROWS
+// rows are counted in parallel, each into its own bins, and summed at the end.
+// Within a stripe four interleaved copies of the bins are used so that runs of
+// equal pixels do not all wait on one counter.
+static void computeHistogram(const Mat& gray, double histogram[256]) {
+    const int stripes = (gray.rows + HISTOGRAM_STRIPE_ROWS - 1) / HISTOGRAM_STRIPE_ROWS;
+    vector<array<double, 256>> partial(stripes);
+    parallel_for_(Range(0, stripes), [&](const Range& range) {
+        for (int s = range.start; s < range.end; s++) {
+            const int y0 = s * HISTOGRAM_STRIPE_ROWS, y1 = min(gray.rows, y0 + HISTOGRAM_STRIPE_ROWS);
+            uint32_t counts[4][256] = {{0}};
+            for (int y = y0; y < y1; y++) {
+                const uchar *row = gray.ptr<uchar>(y);
+                int x = 0;
+                for (; x + 4 <= gray.cols; x += 4) {
+                    counts[0][row[x]]++;
+                    counts[1][row[x + 1]]++;
+                    counts[2][row[x + 2]]++;
+                    counts[3][row[x + 3]]++;
+                }
+                for (; x < gray.cols; x++) {
+                    counts[0][row[x]]++;
+                }
+            }
+            for (int v = 0; v < 256; v++) {
+                partial[s][v] = (double)counts[0][v] + counts[1][v] + counts[2][v] + counts[3][v];
+            }
+        }
+    });
+
+    fill(histogram, histogram + 256, 0.0);
+    for (const array<double, 256>& counts : partial) {
+        for (int v = 0; v < 256; v++) {
+            histogram[v] += counts[v];
         }
     }
-    
-    g_free(selected_algorithm);
 }
 
-// Apply the selected algorithm to the image
-static void apply_algorithm(GtkWidget *widget, gpointer data) {
-    if (filename == NULL || input_image.empty()) {
-        gtk_label_set_text(GTK_LABEL(status_label), "Please select an image first");
-        return;
+class RegionGrowth;
+
+// Preprocessing products of one source image, computed lazily on first use and
+// kept until the image changes so repeated runs (e.g. threshold slider drags)
+// only redo the stages that depend on the changed parameter. Getters return
+// Mat headers sharing the cached data; callers must treat them as read-only.
+class PreprocessCache {
+public:
+    // Interactive caches (the image loaded in the GUI) also build component
+    // trees and keep region growing state so repeated threshold changes skip
+    // or shorten the flood fill
+    explicit PreprocessCache(const Mat& image, bool interactive = false)
+        : source(image), interactive_(interactive) {}
+
+    bool interactive() const { return interactive_; }
+
+    bool matches(const Mat& image) const {
+        return image.data == source.data && image.size() == source.size() && image.type() == source.type();
     }
 
-    // Get the selected algorithm
-    gchar *selected_algorithm = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(algorithm_combo));
-    if (selected_algorithm == NULL) {
-        gtk_label_set_text(GTK_LABEL(status_label), "Please select an algorithm");
-        return;
+    // Grayscale version of the source
+    Mat gray() {
+        lock_guard<mutex> guard(lock);
+        return grayLocked();
     }
 
-    // Close any existing histogram window
-    destroyWindow("Otsu Threshold Histogram");
+    // Edge-preserving smoothing of gray (bilateral, d=9, sigma=75, exact or
+    // approximated by the bilateral grid)
+    Mat bilateral(SmoothingFilter filter) {
+        lock_guard<mutex> guard(lock);
+        return bilateralLocked(filter);
+    }
 
-    gtk_label_set_text(GTK_LABEL(status_label), g_strdup_printf("Applying %s...", selected_algorithm));
-    gtk_label_set_text(GTK_LABEL(info_label), ""); // Clear previous info
-    gtk_label_set_text(GTK_LABEL(threshold_label), ""); // Clear previous threshold info
-    
-    Mat processed_image;
-    string algorithm_info = "";
-    string threshold_info = "";
-    
-    try {
-        // Start measuring time
-        auto start_time = chrono::high_resolution_clock::now();
-        
-        if (strcmp(selected_algorithm, "Active Contours") == 0) {
-            processed_image = activeContoursSegmentation(input_image);
-            algorithm_info = "Active Contours: Using edge detection and contour evolution";
-            threshold_info = g_strdup_printf("Parameters:\n"
-                                          "Iterations: %d\n"
-                                          "Alpha (Elasticity): %.2f\n"
-                                          "Beta (Curvature): %.2f\n"
-                                          "Gamma (External Energy): %.2f",
-                                          ACTIVE_CONTOURS_ITERATIONS,
-                                          ACTIVE_CONTOURS_ALPHA,
-                                          ACTIVE_CONTOURS_BETA,
-                                          ACTIVE_CONTOURS_GAMMA);
-        } else if (strcmp(selected_algorithm, "K-Means") == 0) {
-            processed_image = kMeansSegmentation(input_image, KMEANS_CLUSTERS);
-            algorithm_info = "K-Means: Clustering based segmentation";
-            threshold_info = g_strdup_printf("Parameters:\n"
-                                          "Clusters: %d\n"
-                                          "Max Iterations: %d\n"
-                                          "Epsilon: %.1f",
-                                          KMEANS_CLUSTERS,
-                                          KMEANS_MAX_ITER,
-                                          KMEANS_EPSILON);
-        } else if (strcmp(selected_algorithm, "Otsu Thresholding") == 0) {
-            double otsuThreshold;
-            processed_image = otsuSegmentation(input_image, otsuThreshold);
-            algorithm_info = "Otsu: Automatic threshold selection";
-            threshold_info = g_strdup_printf("Parameters:\nComputed threshold: %.1f", otsuThreshold);
-        } else if (strcmp(selected_algorithm, "Backtracking") == 0) {
-            processed_image = backtrackingSegmentation(input_image);
-            algorithm_info = "Backtracking: 4-directional region-based segmentation";
-            threshold_info = g_strdup_printf("Parameters:\nThreshold: %d", BACKTRACKING_THRESHOLD);
-        } else if (strcmp(selected_algorithm, "Backtracking (8-Dir)") == 0) {
-            processed_image = backtrackingSegmentation8Dir(input_image);
-            algorithm_info = "Backtracking: 8-directional region-based segmentation with noise reduction";
-            threshold_info = g_strdup_printf("Parameters:\nThreshold: %d\nGaussian blur: 3x3", BACKTRACKING_THRESHOLD);
-        } else if (strcmp(selected_algorithm, "Backtracking Improved") == 0) {
-            processed_image = backtrackingSegmentationImproved(input_image);
-            algorithm_info = "Backtracking Improved: Region-based segmentation with bilateral filter";
-            threshold_info = g_strdup_printf("Parameters:\nThreshold: %d\nBilateral filter: sigma=75", BACKTRACKING_THRESHOLD);
-        } else if (strcmp(selected_algorithm, "Backtracking Edge Enhanced") == 0) {
-            processed_image = backtrackingEdgeEnhancementSegmentation(input_image);
-            algorithm_info = "Backtracking Edge Enhanced: Region-based segmentation with edge enhancement";
-            threshold_info = g_strdup_printf("Parameters:\nThreshold: %d", BACKTRACKING_THRESHOLD);
-        } else if (strcmp(selected_algorithm, "Watershed") == 0) {
-            processed_image = watershedSegmentation(input_image);
-            algorithm_info = "Watershed: Morphological segmentation";
-            threshold_info = g_strdup_printf("Parameters:\n"
-                                          "Morphological kernel size: %d",
-                                          WATERSHED_MORPH_SIZE);
-        } else if (strcmp(selected_algorithm, "Graph Cut") == 0) {
-            processed_image = graphCutSegmentation(input_image);
-            algorithm_info = "Graph Cut: Using GrabCut algorithm";
-            threshold_info = g_strdup_printf("Parameters:\n"
-                                          "GrabCut iterations: %d",
-                                          GRAPH_CUT_ITERATIONS);
-        } else if (strcmp(selected_algorithm, "Region Growing") == 0) {
-            Point seed(input_image.cols / 2, input_image.rows / 2);
-            processed_image = regionGrowingSegmentation(input_image, seed, REGION_GROWING_THRESHOLD);
-            algorithm_info = "Region Growing: Seed-based segmentation";
-            threshold_info = g_strdup_printf("Parameters:\n"
-                                          "Intensity threshold: %d\n"
-                                          "Seed point: center of image",
-                                          REGION_GROWING_THRESHOLD);
-        } else {
-            gtk_label_set_text(GTK_LABEL(status_label), "Unknown algorithm selected");
-            g_free(selected_algorithm);
-            return;
+    // Source as 3-channel BGR
+    Mat bgr() {
+        lock_guard<mutex> guard(lock);
+        return bgrLocked();
+    }
+
+    // CIE Lab version of the source (8-bit scaling)
+    Mat lab() {
+        lock_guard<mutex> guard(lock);
+        if (lab_.empty()) {
+            cvtColor(bgrLocked(), lab_, COLOR_BGR2Lab);
         }
-        
-        // Stop measuring time
-        auto end_time = chrono::high_resolution_clock::now();
-        double elapsed_time = chrono::duration<double, milli>(end_time - start_time).count();
+        return lab_;
+    }
 
-        g_free(selected_algorithm);
+    // 256-bin histogram of gray (1x256 CV_64F), shared by the histogram
+    // based algorithms
+    Mat histogram() {
+        lock_guard<mutex> guard(lock);
+        if (histogram_.empty()) {
+            histogram_.create(1, 256, CV_64F);
+            computeHistogram(grayLocked(), histogram_.ptr<double>());
+        }
+        return histogram_;
+    }
 
-        if (processed_image.empty()) {
-            gtk_label_set_text(GTK_LABEL(status_label), "Failed to process image");
-            return;
+    // Light 3x3 Gaussian smoothing of gray
+    Mat gaussian() {
+        lock_guard<mutex> guard(lock);
+        if (gaussian_.empty()) {
+            GaussianBlur(grayLocked(), gaussian_, Size(3, 3), 0);
         }
+        return gaussian_;
+    }
 
-        // Create a temporary file to save the processed image
-        string temp_filename = string(filename) + "_processed.jpg";
-        imwrite(temp_filename, processed_image);
+    // CLAHE contrast enhancement of the bilateral image
+    Mat clahe(SmoothingFilter filter) {
+        lock_guard<mutex> guard(lock);
+        return claheLocked(filter);
+    }
 
-        // Display the processed image
-        GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file_at_scale(temp_filename.c_str(), 
-                                                         400, 400, 
-                                                         TRUE, 
-                                                         NULL);
-        if (pixbuf) {
-            gtk_image_set_from_pixbuf(GTK_IMAGE(processed_image_view), pixbuf);
-            g_object_unref(pixbuf);
-            
-            // Update status with larger time display
-            gtk_label_set_text(GTK_LABEL(status_label), 
-                g_strdup_printf("Processing Time: %.2f ms", elapsed_time));
-            
-            // Update info label with algorithm details
-            gtk_label_set_text(GTK_LABEL(info_label), algorithm_info.c_str());
+    // Sobel gradient magnitude of the CLAHE image, normalized to 8-bit
+    Mat gradientMagnitude(SmoothingFilter filter) {
+        lock_guard<mutex> guard(lock);
+        edgeFeaturesLocked(filter);
+        return gradient_[filter];
+    }
 
-            // Update threshold label with parameter details
-            gtk_label_set_text(GTK_LABEL(threshold_label), threshold_info.c_str());
-        } else {
-            gtk_label_set_text(GTK_LABEL(status_label), "Failed to display processed image");
+    // Adaptive threshold of the CLAHE image closed with a 3x3 kernel
+    Mat adaptiveBinary(SmoothingFilter filter) {
+        lock_guard<mutex> guard(lock);
+        edgeFeaturesLocked(filter);
+        return adaptive_[filter];
+    }
+
+    // Canny edges (50/150) of gray
+    Mat cannyEdges() {
+        lock_guard<mutex> guard(lock);
+        return cannyLocked();
+    }
+
+    // Snake force field from the Canny edges (see computeGradientVectorFlow).
+    // Images longer than maxSide (unless 0) get a reduced resolution field;
+    // sample it at source x times field.cols / source.cols and source y times
+    // field.rows / source.rows.
+    Mat gradientVectorFlow(int maxSide) {
+        lock_guard<mutex> guard(lock);
+        if (gvf_.empty() || gvf_side_ != maxSide) {
+            const Mat& edges = cannyLocked();
+            double scale = maxSide > 0 ? min(1.0, (double)maxSide / max(edges.cols, edges.rows)) : 1.0;
+            Mat small = edges;
+            if (scale < 1.0) {
+                resize(edges, small, Size(max(1, cvRound(edges.cols * scale)), max(1, cvRound(edges.rows * scale))),
+                       0, 0, INTER_AREA);
+            }
+            gvf_ = computeGradientVectorFlow(small, (double)edges.cols / small.cols);
+            gvf_side_ = maxSide;
         }
-    } catch (const cv::Exception& e) {
-        gtk_label_set_text(GTK_LABEL(status_label), g_strdup_printf("Error: %s", e.what()));
-        g_free(selected_algorithm);
-        return;
+        return gvf_;
     }
-}
 
-// Open file dialog to select an image
-static void select_image(GtkWidget *widget, gpointer data) {
-    GtkWidget *dialog;
-    GtkFileChooserAction action = GTK_FILE_CHOOSER_ACTION_OPEN;
-    gint res;
+    // Component tree of one of this cache's products (e.g. gray() or bilateral())
+    shared_ptr<ComponentTree> componentTree(const Mat& product, int connectivity, bool minTree) {
+        lock_guard<mutex> guard(lock);
+        for (const TreeEntry& entry : trees_) {
+            if (entry.data == product.data && entry.connectivity == connectivity && entry.min_tree == minTree) {
+                return entry.tree;
+            }
+        }
 
-    dialog = gtk_file_chooser_dialog_new("Open Image",
-                                        GTK_WINDOW(window),
-                                        action,
-                                        "_Cancel",
-                                        GTK_RESPONSE_CANCEL,
-                                        "_Open",
-                                        GTK_RESPONSE_ACCEPT,
-                                        NULL);
+        TreeEntry entry;
+        entry.data = product.data;
+        entry.connectivity = connectivity;
+        entry.min_tree = minTree;
+        entry.tree = make_shared<ComponentTree>();
+        entry.tree->build(product, connectivity, minTree);
+        trees_.push_back(entry);
+        return entry.tree;
+    }
 
-    // Add filters for image files
-    GtkFileFilter *filter = gtk_file_filter_new();
-    gtk_file_filter_set_name(filter, "Image Files");
-    gtk_file_filter_add_mime_type(filter, "image/jpeg");
-    gtk_file_filter_add_mime_type(filter, "image/png");
-    gtk_file_filter_add_mime_type(filter, "image/bmp");
-    gtk_file_chooser_add_filter(GTK_FILE_CHOOSER(dialog), filter);
+    // Region growing state over one of this cache's products (see RegionGrowth)
+    shared_ptr<RegionGrowth> regionGrowth(const Mat& product, int connectivity);
 
-    res = gtk_dialog_run(GTK_DIALOG(dialog));
-    if (res == GTK_RESPONSE_ACCEPT) {
-        GtkFileChooser *chooser = GTK_FILE_CHOOSER(dialog);
-        if (filename != NULL) {
-            g_free(filename);
+private:
+    const Mat& grayLocked() {
+        if (gray_.empty()) {
+            if (source.channels() == 3) {
+                cvtColor(source, gray_, COLOR_BGR2GRAY);
+            } else {
+                gray_ = source;
+            }
         }
-        filename = gtk_file_chooser_get_filename(chooser);
-        
-        // Load the image for processing
-        input_image = imread(filename, IMREAD_COLOR);
-        if (input_image.empty()) {
-            gtk_label_set_text(GTK_LABEL(status_label), "Failed to load image");
-            gtk_widget_destroy(dialog);
-            return;
+        return gray_;
+    }
+
+    const Mat& bgrLocked() {
+        if (bgr_.empty()) {
+            if (source.channels() == 1) {
+                cvtColor(source, bgr_, COLOR_GRAY2BGR);
+            } else if (source.channels() == 4) {
+                cvtColor(source, bgr_, COLOR_BGRA2BGR);
+            } else {
+                bgr_ = source;
+            }
         }
-        
-        // Display the selected image
-        GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file_at_scale(filename, 
-                                                             400, 400, 
-                                                             TRUE, 
-                                                             NULL);
-        if (pixbuf) {
-            gtk_image_set_from_pixbuf(GTK_IMAGE(original_image_view), pixbuf);
-            g_object_unref(pixbuf);
-            gtk_label_set_text(GTK_LABEL(status_label), "Image loaded successfully");
-            gtk_widget_set_sensitive(apply_button, TRUE);
-        } else {
-            gtk_label_set_text(GTK_LABEL(status_label), "Failed to display image");
+        return bgr_;
+    }
+
+    const Mat& cannyLocked() {
+        if (canny_.empty()) {
+            Canny(grayLocked(), canny_, 50, 150);
         }
+        return canny_;
     }
 
-    gtk_widget_destroy(dialog);
-}
+    const Mat& bilateralLocked(SmoothingFilter filter) {
+        if (bilateral_[filter].empty()) {
+            bilateral_[filter] = edgePreservingSmooth(grayLocked(), filter);
+        }
+        return bilateral_[filter];
+    }
 
-// Initialize the GTK application
-static void activate(GtkApplication *app, gpointer user_data) {
-    // Create the main window
-    window = gtk_application_window_new(app);
-    gtk_window_set_title(GTK_WINDOW(window), "Image Segmentation App");
-    gtk_window_set_default_size(GTK_WINDOW(window), 900, 600);
-    gtk_container_set_border_width(GTK_CONTAINER(window), 10);
+    const Mat& claheLocked(SmoothingFilter filter) {
+        if (clahe_[filter].empty()) {
+            Ptr<CLAHE> clahe = createCLAHE(2.0, Size(8, 8));
+            clahe->apply(bilateralLocked(filter), clahe_[filter]);
+        }
+        return clahe_[filter];
+    }
 
-    // Create a vertical box to organize widgets
-    GtkWidget *main_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 10);
-    gtk_container_add(GTK_CONTAINER(window), main_box);
+    // Gradient magnitude and adaptive threshold come from one fused pass
+    void edgeFeaturesLocked(SmoothingFilter filter) {
+        if (gradient_[filter].empty()) {
+            edgeFeatures(claheLocked(filter), gradient_[filter], adaptive_[filter]);
+        }
+    }
 
-    // Create a horizontal box for controls
-    GtkWidget *control_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 10);
-    gtk_box_pack_start(GTK_BOX(main_box), control_box, FALSE, FALSE, 0);
+    struct TreeEntry {
+        const uchar *data;
+        int connectivity;
+        bool min_tree;
+        shared_ptr<ComponentTree> tree;
+    };
+
+    struct GrowthEntry {
+        const uchar *data;
+        int connectivity;
+        shared_ptr<RegionGrowth> growth;
+    };
+
+    mutex lock;
+    Mat source;
+    bool interactive_;
+    Mat gray_, bgr_, lab_, histogram_, gaussian_, canny_, gvf_;
+    int gvf_side_ = 0;
+    Mat bilateral_[2], clahe_[2], gradient_[2], adaptive_[2]; // Indexed by SmoothingFilter
+    vector<TreeEntry> trees_;
+    vector<GrowthEntry> growths_;
+};
+
+mutex image_cache_lock;
+shared_ptr<PreprocessCache> image_cache; // Preprocessing of the image loaded in the GUI
+
+// Interactive GrabCut state for the image loaded in the GUI. The label mask,
+// the colour models and the user's strokes persist between runs. A correction
+// stroke first refits the colour models to the whole corrected mask (on the
+// coarse level for large images), so they learn the stroked colours, then
+// re-solves only the area around the stroke with those models frozen.
+class GrabCutSession {
+public:
+    explicit GrabCutSession(const Mat& image) : source(image) {}
+
+    bool matches(const Mat& image) const {
+        return image.data == source.data && image.size() == source.size() && image.type() == source.type();
+    }
 
-    // Create a button to select an image
-    GtkWidget *select_button = gtk_button_new_with_label("Select Image");
-    g_signal_connect(select_button, "clicked", G_CALLBACK(select_image), NULL);
-    gtk_box_pack_start(GTK_BOX(control_box), select_button, FALSE, FALSE, 0);
+    // Queue a foreground or background stroke (image coordinates) for the
+    // next segment(); safe to call while segment() runs
+    void addStroke(const vector<Point>& points, int radius, bool foreground);
 
-    // Create a combo box for algorithm selection
-    algorithm_combo = gtk_combo_box_text_new();
-    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(algorithm_combo), "Active Contours");
-    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(algorithm_combo), "K-Means");
-    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(algorithm_combo), "Otsu Thresholding");
-    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(algorithm_combo), "Backtracking");
-    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(algorithm_combo), "Backtracking (8-Dir)");
-    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(algorithm_combo), "Backtracking Improved");
-    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(algorithm_combo), "Backtracking Edge Enhanced");
-    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(algorithm_combo), "Watershed");
-    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(algorithm_combo), "Graph Cut");
-    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(algorithm_combo), "Region Growing");
-    gtk_combo_box_set_active(GTK_COMBO_BOX(algorithm_combo), 0);
-    g_signal_connect(algorithm_combo, "changed", G_CALLBACK(on_algorithm_changed), NULL);
-    gtk_box_pack_start(GTK_BOX(control_box), algorithm_combo, FALSE, FALSE, 0);
+    // Segmentation with every stroke so far. The first call runs the full
+    // GrabCut from the centered rectangle.
+    Mat segment(const SegmentationParams& params);
 
-    // Create a button to apply the selected algorithm
-    apply_button = gtk_button_new_with_label("Apply Algorithm");
-    g_signal_connect(apply_button, "clicked", G_CALLBACK(apply_algorithm), NULL);
-    gtk_box_pack_start(GTK_BOX(control_box), apply_button, FALSE, FALSE, 0);
-    gtk_widget_set_sensitive(apply_button, FALSE); // Disable until image is loaded
+private:
+    struct Stroke {
+        vector<Point> points;
+        int radius;
+        bool foreground;
+    };
 
-    // Create backtracking threshold slider box
-    threshold_slider_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
-    gtk_box_pack_start(GTK_BOX(control_box), threshold_slider_box, TRUE, TRUE, 0);
+    mutex stroke_lock;
+    vector<Stroke> pending;
 
-    // Create backtracking threshold slider
-    GtkWidget *threshold_label = gtk_label_new("Threshold:");
-    gtk_box_pack_start(GTK_BOX(threshold_slider_box), threshold_label, FALSE, FALSE, 0);
+    mutex lock;
+    Mat source;
+    Mat colorImage;
+    Mat coarseImage;  // colorImage at the coarse level the models are refitted on
+    Mat mask;         // GrabCut labels
+    Mat strokeLabels; // 0 where unstroked, GC_FGD + 1 or GC_BGD + 1 under strokes
+    Mat bgModel, fgModel;
+};
 
-    threshold_slider = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, 0, 255, 1);
-    gtk_range_set_value(GTK_RANGE(threshold_slider), BACKTRACKING_THRESHOLD);
-    gtk_widget_set_size_request(threshold_slider, 200, -1);
-    g_signal_connect(threshold_slider, "value-changed", G_CALLBACK(on_threshold_changed), NULL);
-    gtk_box_pack_start(GTK_BOX(threshold_slider_box), threshold_slider, TRUE, TRUE, 0);
+shared_ptr<GrabCutSession> grabcut_session; // GrabCut session of the image loaded in the GUI, under image_cache_lock
 
-    // Create kmeans clusters slider box
-    kmeans_slider_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
-    gtk_box_pack_start(GTK_BOX(control_box), kmeans_slider_box, TRUE, TRUE, 0);
+// Bind the shared cache to a newly loaded image, dropping the previous products
+void resetImageCache(const Mat& image) {
+    lock_guard<mutex> guard(image_cache_lock);
+    image_cache = make_shared<PreprocessCache>(image, true);
+    grabcut_session = make_shared<GrabCutSession>(image);
+}
 
-    // Create kmeans clusters slider
-    GtkWidget *kmeans_label = gtk_label_new("Clusters:");
-    gtk_box_pack_start(GTK_BOX(kmeans_slider_box), kmeans_label, FALSE, FALSE, 0);
+// Start GrabCut on the loaded image over, forgetting its strokes
+void resetGrabCutSession(const Mat& image) {
+    lock_guard<mutex> guard(image_cache_lock);
+    grabcut_session = make_shared<GrabCutSession>(image);
+}
 
-    kmeans_slider = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, 2, 8, 1);
-    gtk_range_set_value(GTK_RANGE(kmeans_slider), KMEANS_CLUSTERS);
-    gtk_widget_set_size_request(kmeans_slider, 200, -1);
-    g_signal_connect(kmeans_slider, "value-changed", G_CALLBACK(on_kmeans_changed), NULL);
-    gtk_box_pack_start(GTK_BOX(kmeans_slider_box), kmeans_slider, TRUE, TRUE, 0);
+// Eight 0/1 bytes, in pixel order, for every byte of a packed mask row
+static const uint64_t *maskByteSpread() {
+    static const vector<uint64_t> table = [] {
+        vector<uint64_t> spread(256);
+        for (int bits = 0; bits < 256; bits++) {
+            for (int i = 0; i < 8; i++) {
+                spread[bits] |= (uint64_t)((bits >> i) & 1) << (i * 8);
+            }
+        }
+        return spread;
+    }();
+    return table.data();
+}
 
-    // Hide both slider boxes initially
-    gtk_widget_hide(threshold_slider_box);
-    gtk_widget_hide(kmeans_slider_box);
+// Bit-per-pixel mask, each row padded to whole 64-bit words with zero bits.
+// Pixel x of a row is bit x % 64 of word x / 64.
+class FloodMask {
+public:
+    void reset(Size size) {
+        rows = size.height;
+        cols = size.width;
+        words = (cols + 63) / 64;
+        data.assign((size_t)rows * words, 0);
+    }
 
-    // Create a horizontal box for images
-    GtkWidget *image_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 10);
-    gtk_box_pack_start(GTK_BOX(main_box), image_box, TRUE, TRUE, 0);
+    bool test(int x, int y) const { return (row(y)[x >> 6] >> (x & 63)) & 1; }
 
-    // Create frames for original and processed images
-    GtkWidget *original_frame = gtk_frame_new("Original Image");
-    GtkWidget *processed_frame = gtk_frame_new("Processed Image");
-    
-    gtk_box_pack_start(GTK_BOX(image_box), original_frame, TRUE, TRUE, 0);
-    gtk_box_pack_start(GTK_BOX(image_box), processed_frame, TRUE, TRUE, 0);
+    void clear(int x, int y) { row(y)[x >> 6] &= ~(1ull << (x & 63)); }
 
-    // Create image widgets
-    original_image_view = gtk_image_new();
-    processed_image_view = gtk_image_new();
-    
-    // Add images to frames
-    gtk_container_add(GTK_CONTAINER(original_frame), original_image_view);
-    gtk_container_add(GTK_CONTAINER(processed_frame), processed_image_view);
+    // Marks pixels left to right (inclusive) of row y
+    void fillSpan(int y, int left, int right) {
+        uint64_t *r = row(y);
+        int first = left >> 6, last = right >> 6;
+        uint64_t head = ~0ull << (left & 63), tail = ~0ull >> (63 - (right & 63));
+        if (first == last) {
+            r[first] |= head & tail;
+            return;
+        }
+        r[first] |= head;
+        for (int w = first + 1; w < last; w++) {
+            r[w] = ~0ull;
+        }
+        r[last] |= tail;
+    }
 
-    // Create status label with larger text
-    status_label = gtk_label_new("Ready");
-    PangoAttrList *attr_list = pango_attr_list_new();
-    PangoAttribute *attr = pango_attr_scale_new(1.5); // Make text 1.5 times larger
-    pango_attr_list_insert(attr_list, attr);
-    gtk_label_set_attributes(GTK_LABEL(status_label), attr_list);
-    pango_attr_list_unref(attr_list);
-    gtk_box_pack_start(GTK_BOX(main_box), status_label, FALSE, FALSE, 0);
+    // Binary image with 255 wherever the mask is marked, written into image
+    // (reallocated only when its size differs)
+    void toMat(Mat& image) const {
+        image.create(rows, cols, CV_8UC1);
+        const uint64_t *spread = maskByteSpread();
+        for (int y = 0; y < rows; y++) {
+            const uchar *m = (const uchar *)row(y); // Little-endian: byte k holds pixels 8k to 8k + 7
+            uchar *dst = image.ptr<uchar>(y);
+            for (int x = 0; x < cols; x += 8) {
+                uint64_t eight = spread[m[x >> 3]] * 0xFF;
+                memcpy(dst + x, &eight, min(8, cols - x));
+            }
+        }
+    }
 
-    // Create info label for algorithm details
-    info_label = gtk_label_new("");
-    gtk_box_pack_start(GTK_BOX(main_box), info_label, FALSE, FALSE, 0);
+    uint64_t *row(int y) { return data.data() + (size_t)y * words; }
+    const uint64_t *row(int y) const { return data.data() + (size_t)y * words; }
 
-    // Create threshold label
-    threshold_label = gtk_label_new("");
-    gtk_box_pack_start(GTK_BOX(main_box), threshold_label, FALSE, FALSE, 0);
+    int rows = 0;
+    int cols = 0;
+    int words = 0; // Per row
 
-    // Show all widgets
-    gtk_widget_show_all(window);
-}
+private:
+    vector<uint64_t> data;
+};
 
-// Main function
-int main(int argc, char **argv) {
-    GtkApplication *app;
-    int status;
+// Gray version of rows [y0, y1) of an 8-bit image, converted like
+// PreprocessCache::gray(); gray images are returned without copying
+static void grayRows(const Mat& image, int y0, int y1, Mat& gray) {
+    if (image.channels() == 3) {
+        cvtColor(image.rowRange(y0, y1), gray, COLOR_BGR2GRAY);
+    } else {
+        gray = image.rowRange(y0, y1);
+    }
+}
 
-    app = gtk_application_new("org.gtk.example", G_APPLICATION_DEFAULT_FLAGS);
-    g_signal_connect(app, "activate", G_CALLBACK(activate), NULL);
-    status = g_application_run(G_APPLICATION(app), argc, argv);
-    g_object_unref(app);
+// Gray level of one pixel, converted like PreprocessCache::gray()
+static int grayAt(const Mat& image, Point p) {
+    Mat gray;
+    grayRows(image, p.y, p.y + 1, gray);
+    return gray.at<uchar>(0, p.x);
+}
 
-    return status;
+// Packs the pixels whose gray level lies in [low, high] into inside, straight
+// from a colour or gray image. Stripes of MASK_STRIPE_ROWS rows are converted
+// to gray, range tested and packed 64 pixels per word while in cache, so no
+// full-frame gray or binary image is made.
+static void packIntensityRange(const Mat& image, int low, int high, FloodMask& inside) {
+    inside.reset(image.size());
+    if (low > high || image.empty()) {
+        return;
+    }
+    const int stripes = (image.rows + MASK_STRIPE_ROWS - 1) / MASK_STRIPE_ROWS;
+    const size_t stride = (size_t)inside.words * 64;
+    parallel_for_(Range(0, stripes), [&](const Range& range) {
+        Mat gray;
+        vector<uchar> buffer(stride * MASK_STRIPE_ROWS, 0); // Zero past the last column
+        for (int s = range.start; s < range.end; s++) {
+            const int y0 = s * MASK_STRIPE_ROWS, y1 = min(image.rows, y0 + MASK_STRIPE_ROWS);
+            grayRows(image, y0, y1, gray);
+            Mat flags(y1 - y0, image.cols, CV_8UC1, buffer.data(), stride);
+            inRange(gray, Scalar(low), Scalar(high), flags);
+
+            // Eight flag bytes, masked to 0/1, become eight bits with one
+            // multiply: byte i lands on bit 56 + i and no partial products overlap
+            for (int y = y0; y < y1; y++) {
+                const uchar *f = buffer.data() + (y - y0) * stride;
+                uint64_t *words = inside.row(y);
+                for (int w = 0; w < inside.words; w++) {
+                    uint64_t bits = 0;
+                    for (int b = 0; b < 8; b++) {
+                        uint64_t eight;
+                        memcpy(&eight, f + w * 64 + b * 8, sizeof(eight));
+                        eight &= 0x0101010101010101ull;
+                        bits |= ((eight * 0x0102040810204080ull) >> 56) << (b * 8);
+                    }
+                    words[w] = bits;
+                }
+            }
+        }
+    });
 }
 
-// Active Contours Segmentation Implementation
-Mat activeContoursSegmentation(const Mat& image) {
-    Mat gray;
-    if (image.channels() == 3) {
-        cvtColor(image, gray, COLOR_BGR2GRAY);
-    } else {
-        gray = image.clone();
+// Scanline flood fill from seed over the pixels accepted by inside(x, y),
+// marking every filled pixel in mask. Pixels already marked in the mask are
+// never entered, so several fills can share one mask. With FLOOD_8 the spans
+// searched on the neighbouring rows reach one pixel further diagonally.
+// inside() is only called for pixels within the image. pending is the span
+// stack, passed in so its capacity survives between fills. Returns the filled area.
+template <int Connectivity, typename Predicate>
+size_t scanlineFloodFill(FloodMask& mask, vector<Point>& pending, Point seed, Predicate inside) {
+    static_assert(Connectivity == FLOOD_4 || Connectivity == FLOOD_8, "Connectivity must be 4 or 8");
+    const int reach = Connectivity == FLOOD_8 ? 1 : 0;
+
+    size_t filled = 0;
+    pending.clear();
+    pending.push_back(seed);
+
+    while (!pending.empty()) {
+        Point p = pending.back();
+        pending.pop_back();
+
+        if (mask.test(p.x, p.y) || !inside(p.x, p.y)) {
+            continue;
+        }
+
+        // Extend the span left and right
+        int left = p.x;
+        int right = p.x;
+        while (left > 0 && !mask.test(left - 1, p.y) && inside(left - 1, p.y)) {
+            left--;
+        }
+        while (right < mask.cols - 1 && !mask.test(right + 1, p.y) && inside(right + 1, p.y)) {
+            right++;
+        }
+        mask.fillSpan(p.y, left, right);
+        filled += right - left + 1;
+
+        // Queue one seed per run of fillable pixels on the rows above and below
+        for (int ny = p.y - 1; ny <= p.y + 1; ny += 2) {
+            if (ny < 0 || ny >= mask.rows) {
+                continue;
+            }
+            bool in_run = false;
+            for (int x = max(0, left - reach); x <= min(mask.cols - 1, right + reach); x++) {
+                bool fillable = !mask.test(x, ny) && inside(x, ny);
+                if (fillable && !in_run) {
+                    pending.push_back(Point(x, ny));
+                }
+                in_run = fillable;
+            }
+        }
     }
 
-    // Step 1: Edge Detection
-    Mat edges;
-    Canny(gray, edges, 50, 150);
+    return filled;
+}
 
-    // Step 2: Contour Finding
-    vector<vector<Point>> contours;
-    findContours(edges, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
+// Union-find over indices that threads may join concurrently without locks.
+// Every parent is at most its child, so roots are the smallest index of their
+// set and racing updates can never form a cycle.
+class ConcurrentUnionFind {
+public:
+    explicit ConcurrentUnionFind(size_t size) : parent(size) {}
+
+    void makeSet(int i) { parent[i].store(i, memory_order_relaxed); }
+
+    // Puts i in the set of j < i; only safe while no other thread touches i
+    void attach(int i, int j) { parent[i].store(parent[j].load(memory_order_relaxed), memory_order_relaxed); }
+
+    int find(int i) {
+        int p = parent[i].load(memory_order_relaxed);
+        while (p != i) {
+            int grandparent = parent[p].load(memory_order_relaxed);
+            parent[i].store(grandparent, memory_order_relaxed); // Path halving; any ancestor is valid
+            i = grandparent;
+            p = parent[i].load(memory_order_relaxed);
+        }
+        return i;
+    }
 
-    if (contours.empty()) {
-        throw cv::Exception(0, "No contours found in the image", "activeContoursSegmentation", __FILE__, __LINE__);
+    // Hangs the larger root under the smaller; retries if another thread
+    // re-parented that root in the meantime
+    void unite(int a, int b) {
+        for (;;) {
+            a = find(a);
+            b = find(b);
+            if (a == b) {
+                return;
+            }
+            if (a > b) {
+                swap(a, b);
+            }
+            int expected = b;
+            if (parent[b].compare_exchange_weak(expected, a, memory_order_relaxed)) {
+                return;
+            }
+        }
     }
 
-    // Step 3: Select Largest Contour
-    int largest_contour_idx = 0;
-    double largest_area = 0;
-    for (size_t i = 0; i < contours.size(); i++) {
-        double area = contourArea(contours[i]);
-        if (area > largest_area) {
-            largest_area = area;
-            largest_contour_idx = i;
+    // Raw slot of i, for callers that reuse the storage once the sets are final
+    int value(int i) const { return parent[i].load(memory_order_relaxed); }
+    void setValue(int i, int v) { parent[i].store(v, memory_order_relaxed); }
+
+private:
+    vector<atomic<int>> parent;
+};
+
+// Queues one seed per run of fillable pixels (inside and not yet marked) of
+// row y between columns from and to: run starts are the set bits whose lower
+// neighbour is clear
+static void queueRunStarts(const FloodMask& mask, const FloodMask& inside, int y, int from, int to,
+                           vector<Point>& pending) {
+    const uint64_t *in = inside.row(y), *marked = mask.row(y);
+    uint64_t carry = 0;
+    for (int w = from >> 6; w <= to >> 6; w++) {
+        uint64_t bits = in[w] & ~marked[w];
+        if (w == from >> 6) {
+            bits &= ~0ull << (from & 63);
+        }
+        if (w == to >> 6) {
+            bits &= ~0ull >> (63 - (to & 63));
+        }
+        uint64_t starts = bits & ~((bits << 1) | carry);
+        carry = bits >> 63;
+        while (starts) {
+            pending.push_back(Point(w * 64 + __builtin_ctzll(starts), y));
+            starts &= starts - 1;
         }
     }
+}
 
-    // Step 4: Snake Evolution
-    vector<Point> snake = contours[largest_contour_idx];
-    for (int iter = 0; iter < ACTIVE_CONTOURS_ITERATIONS; iter++) {
-        for (size_t i = 0; i < snake.size(); i++) {
-            int prev = (i == 0) ? snake.size() - 1 : i - 1;
-            int next = (i == snake.size() - 1) ? 0 : i + 1;
-            Point newPoint = (1 - ACTIVE_CONTOURS_ALPHA) * snake[i] + ACTIVE_CONTOURS_ALPHA * (snake[prev] + snake[next]) / 2;
-            if (newPoint.x >= 0 && newPoint.y >= 0 && newPoint.x < edges.cols && newPoint.y < edges.rows) {
-                if (edges.at<uchar>(newPoint) > 0) {
-                    newPoint = snake[i] + ACTIVE_CONTOURS_GAMMA * (newPoint - snake[i]);
+// Fills the components of the fillable pixels of stripes first to last - 1
+// (REGION_STRIPE_ROWS rows each) that hold one of the seeds. Stripes split
+// their rows into runs and join overlapping runs concurrently, the stripes are
+// joined across their borders with lock-free unions, and each stripe fills its
+// runs that share a root with a seed, writing only its own rows of the mask.
+// Where a filled run on the band's top or bottom row touches fillable pixels
+// just outside the band, their run starts go to above or below. Returns the
+// area filled.
+template <int Connectivity>
+static size_t fillStripeBand(FloodMask& mask, const FloodMask& inside, const vector<Point>& seeds, int first,
+                             int last, vector<Point>& above, vector<Point>& below) {
+    const int reach = Connectivity == FLOOD_8 ? 1 : 0;
+    const int rows = mask.rows, words = mask.words;
+    const int stripes = last - first;
+    struct Run {
+        int left, right;
+    };
+    vector<vector<Run>> runs(stripes);
+    vector<vector<int>> rowStart(stripes); // First run of each stripe row, plus the end
+
+    // Step 1: Runs of fillable pixels, row by row
+    parallel_for_(Range(0, stripes), [&](const Range& range) {
+        for (int s = range.start; s < range.end; s++) {
+            const int y0 = (first + s) * REGION_STRIPE_ROWS, y1 = min(rows, y0 + REGION_STRIPE_ROWS);
+            vector<Run>& stripeRuns = runs[s];
+            rowStart[s].assign(1, 0);
+            for (int y = y0; y < y1; y++) {
+                const uint64_t *in = inside.row(y), *m = mask.row(y);
+                int start = -1;
+                for (int w = 0; w < words; w++) {
+                    uint64_t bits = in[w] & ~m[w];
+                    // Alternate between the next set and the next clear bit
+                    for (int bit = 0; bit < 64;) {
+                        uint64_t rest = (start < 0 ? bits : ~bits) >> bit;
+                        if (rest == 0) {
+                            break;
+                        }
+                        bit += __builtin_ctzll(rest);
+                        if (start < 0) {
+                            start = w * 64 + bit;
+                        } else {
+                            stripeRuns.push_back({start, w * 64 + bit - 1});
+                            start = -1;
+                        }
+                    }
                 }
+                if (start >= 0) {
+                    stripeRuns.push_back({start, words * 64 - 1});
+                }
+                rowStart[s].push_back((int)stripeRuns.size());
             }
-            snake[i] = newPoint;
         }
+    });
+    vector<int> offset(stripes + 1, 0);
+    for (int s = 0; s < stripes; s++) {
+        offset[s + 1] = offset[s] + (int)runs[s].size();
     }
+    ConcurrentUnionFind sets(offset[stripes]);
+
+    // Joins the overlapping (or, with FLOOD_8, diagonally touching) runs of two
+    // neighbouring rows; a and b index the runs of the upper and lower row
+    auto joinRows = [&](int a, int aEnd, const vector<Run>& upper, int aBase, int b, int bEnd,
+                        const vector<Run>& lower, int bBase) {
+        while (a < aEnd && b < bEnd) {
+            if (upper[a].left <= lower[b].right + reach && lower[b].left <= upper[a].right + reach) {
+                sets.unite(aBase + a, bBase + b);
+            }
+            if (upper[a].right < lower[b].right) {
+                a++;
+            } else {
+                b++;
+            }
+        }
+    };
+
+    // Step 2: Join runs within each stripe, then across the stripe borders
+    parallel_for_(Range(0, stripes), [&](const Range& range) {
+        for (int s = range.start; s < range.end; s++) {
+            const vector<int>& start = rowStart[s];
+            for (int i = 0; i < (int)runs[s].size(); i++) {
+                sets.makeSet(offset[s] + i);
+            }
+            for (size_t r = 1; r + 1 < start.size(); r++) {
+                joinRows(start[r - 1], start[r], runs[s], offset[s], start[r], start[r + 1], runs[s], offset[s]);
+            }
+        }
+    });
+    parallel_for_(Range(1, max(1, stripes)), [&](const Range& range) {
+        for (int s = range.start; s < range.end; s++) {
+            const vector<int>& upper = rowStart[s - 1];
+            joinRows(upper[upper.size() - 2], upper.back(), runs[s - 1], offset[s - 1], 0, rowStart[s][1], runs[s],
+                     offset[s]);
+        }
+    });
 
-    // Step 5: Visualization
-    Mat result = image.clone();
-    for (size_t i = 0; i < snake.size(); i++) {
-        int next = (i == snake.size() - 1) ? 0 : i + 1;
-        line(result, snake[i], snake[next], Scalar(0, 255, 0), 2);
+    // Step 3: Roots of the runs holding a pending seed, then fill every run
+    // that shares one
+    vector<uchar> seeded(offset[stripes], 0);
+    for (const Point& seed : seeds) {
+        const int s = seed.y / REGION_STRIPE_ROWS - first, r = seed.y - (first + s) * REGION_STRIPE_ROWS;
+        const vector<Run>& stripeRuns = runs[s];
+        auto begin = stripeRuns.begin() + rowStart[s][r], end = stripeRuns.begin() + rowStart[s][r + 1];
+        auto run = upper_bound(begin, end, seed.x, [](int x, const Run& run) { return x < run.left; });
+        if (run != begin && (run - 1)->right >= seed.x) {
+            seeded[sets.find(offset[s] + (int)(run - 1 - stripeRuns.begin()))] = 1;
+        }
     }
-
-    return result;
+    vector<size_t> filled(stripes, 0);
+    parallel_for_(Range(0, stripes), [&](const Range& range) {
+        for (int s = range.start; s < range.end; s++) {
+            const int y0 = (first + s) * REGION_STRIPE_ROWS;
+            for (size_t r = 0; r + 1 < rowStart[s].size(); r++) {
+                const int y = y0 + (int)r;
+                for (int i = rowStart[s][r]; i < rowStart[s][r + 1]; i++) {
+                    if (seeded[sets.find(offset[s] + i)]) {
+                        const Run& run = runs[s][i];
+                        mask.fillSpan(y, run.left, run.right);
+                        filled[s] += run.right - run.left + 1;
+
+                        // Rows outside the band are only read, so the two
+                        // edge stripes can look at them while others fill
+                        const int from = max(0, run.left - reach), to = min(mask.cols - 1, run.right + reach);
+                        if (s == 0 && r == 0 && y > 0) {
+                            queueRunStarts(mask, inside, y - 1, from, to, above);
+                        }
+                        if (s == stripes - 1 && r + 2 == rowStart[s].size() && y + 1 < rows) {
+                            queueRunStarts(mask, inside, y + 1, from, to, below);
+                        }
+                    }
+                }
+            }
+        }
+    });
+    size_t total = 0;
+    for (size_t area : filled) {
+        total += area;
+    }
+    return total;
 }
 
-// K-Means Segmentation Implementation
-Mat kMeansSegmentation(const Mat& image, int clusters) {
-    // Convert to grayscale if not already
-    Mat gray;
-    if (image.channels() == 3) {
-        cvtColor(image, gray, COLOR_BGR2GRAY);
-    } else {
-        gray = image.clone();
+// Finishes a packed scanline fill in parallel once it has filled
+// FLOOD_PARALLEL_PIXELS pixels. Every still fillable pixel of the region is
+// connected to a pending seed, so the rest of the region is the union of the
+// components of the fillable pixels that contain one. Those are labelled in
+// a band of stripes (see fillStripeBand), starting with the stripes that hold
+// the seeds. Where the fill leaves the band, the band doubles in that
+// direction and is labelled again from the pixels the fill reached, until
+// nothing leaves it. Rows the region never reaches are never labelled, so a
+// region in one part of a large noisy image does not pay for the runs of the
+// rest, and the labelling work stays within about twice that of the rows the
+// region spans. Returns the area filled here; pending is left empty.
+template <int Connectivity>
+static size_t finishFloodFillParallel(FloodMask& mask, const FloodMask& inside, vector<Point>& pending) {
+    const int stripes = (mask.rows + REGION_STRIPE_ROWS - 1) / REGION_STRIPE_ROWS;
+    int first = stripes, last = 0;
+    for (const Point& seed : pending) {
+        first = min(first, seed.y / REGION_STRIPE_ROWS);
+        last = max(last, seed.y / REGION_STRIPE_ROWS + 1);
+    }
+    size_t total = 0;
+    vector<Point> above, below;
+    while (!pending.empty()) {
+        above.clear();
+        below.clear();
+        total += fillStripeBand<Connectivity>(mask, inside, pending, first, last, above, below);
+        const int height = last - first;
+        if (!above.empty()) {
+            first = max(0, first - height);
+        }
+        if (!below.empty()) {
+            last = min(stripes, last + height);
+        }
+        pending.swap(above);
+        pending.insert(pending.end(), below.begin(), below.end());
     }
+    return total;
+}
 
-    Mat data;
-    gray.convertTo(data, CV_32F); 
-    data = data.reshape(1, gray.total()); 
+// scanlineFloodFill over the pixels set in a packed inside mask (see
+// packIntensityRange). Spans are extended and the neighbouring rows searched
+// 64 pixels at a time with bit scans; the fill is the same as the predicate
+// version's. Fills that pass parallelPixels (FLOOD_PARALLEL_PIXELS unless a
+// caller such as the benchmark check lowers it) continue in parallel.
+template <int Connectivity>
+size_t scanlineFloodFill(FloodMask& mask, const FloodMask& inside, vector<Point>& pending, Point seed,
+                         size_t parallelPixels = FLOOD_PARALLEL_PIXELS) {
+    static_assert(Connectivity == FLOOD_4 || Connectivity == FLOOD_8, "Connectivity must be 4 or 8");
+    const int reach = Connectivity == FLOOD_8 ? 1 : 0;
+    auto fillable = [&](int y, int w) { return inside.row(y)[w] & ~mask.row(y)[w]; };
+
+    size_t filled = 0;
+    pending.clear();
+    pending.push_back(seed);
+
+    const bool parallel = getNumThreads() > 1;
+    while (!pending.empty()) {
+        // Very large regions are finished on all threads
+        if (parallel && filled >= parallelPixels) {
+            return filled + finishFloodFillParallel<Connectivity>(mask, inside, pending);
+        }
+        Point p = pending.back();
+        pending.pop_back();
 
-    // Apply k-means clustering
-    Mat labels, centers;
-    kmeans(data, clusters, labels, TermCriteria(TermCriteria::EPS + TermCriteria::MAX_ITER, 10, 1.0), 3, KMEANS_RANDOM_CENTERS, centers);
+        if (!((fillable(p.y, p.x >> 6) >> (p.x & 63)) & 1)) {
+            continue;
+        }
 
-    Mat segmented(gray.size(), CV_8U);
-    for (int i = 0; i < data.rows; i++) {
-        segmented.at<uchar>(i / gray.cols, i % gray.cols) = (uchar)centers.at<float>(labels.at<int>(i, 0), 0);
+        // Extend the span to the nearest unfillable pixel on each side. The
+        // shifts bring in zeros, which stop the scan at the word edge; padding
+        // bits past the last column are never inside.
+        int left = p.x, right = p.x;
+        int w = p.x >> 6, bits = (p.x & 63) + 1; // Pixels from the word start to p.x
+        uint64_t run = fillable(p.y, w) << (64 - bits);
+        int count = ~run ? __builtin_clzll(~run) : 64;
+        left -= count - 1;
+        while (count == bits && w > 0) {
+            w--;
+            bits = 64;
+            run = fillable(p.y, w);
+            count = ~run ? __builtin_clzll(~run) : 64;
+            left -= count;
+        }
+        w = p.x >> 6;
+        bits = 64 - (p.x & 63); // Pixels from p.x to the word end
+        run = fillable(p.y, w) >> (64 - bits);
+        count = ~run ? __builtin_ctzll(~run) : 64;
+        right += count - 1;
+        while (count == bits && w < inside.words - 1) {
+            w++;
+            bits = 64;
+            run = fillable(p.y, w);
+            count = ~run ? __builtin_ctzll(~run) : 64;
+            right += count;
+        }
+        mask.fillSpan(p.y, left, right);
+        filled += right - left + 1;
+
+        // Queue one seed per run of fillable pixels on the rows above and below:
+        // run starts are the set bits whose lower neighbour is clear
+        const int from = max(0, left - reach), to = min(mask.cols - 1, right + reach);
+        for (int ny = p.y - 1; ny <= p.y + 1; ny += 2) {
+            if (ny >= 0 && ny < mask.rows) {
+                queueRunStarts(mask, inside, ny, from, to, pending);
+            }
+        }
     }
 
+    return filled;
+}
 
-    Mat colored;
-    applyColorMap(segmented, colored, COLORMAP_JET);
-
-    return colored;
+// Joins 4-neighbours of gray whose gray levels a, b satisfy joins(a, b) into
+// sets and writes every pixel's root to roots. Stripes of REGION_STRIPE_ROWS
+// rows are labelled concurrently and then joined along their borders with
+// lock-free unions.
+template <typename Joins>
+static void uniteNeighbours(const Mat& gray, ConcurrentUnionFind& sets, Joins joins, Mat& roots) {
+    const int rows = gray.rows, cols = gray.cols;
+    const int stripes = (rows + REGION_STRIPE_ROWS - 1) / REGION_STRIPE_ROWS;
+
+    // Step 1: Label each stripe on its own. A pixel joining its left
+    // neighbour takes over that neighbour's parent, so runs need no union.
+    parallel_for_(Range(0, stripes), [&](const Range& range) {
+        for (int s = range.start; s < range.end; s++) {
+            const int y0 = s * REGION_STRIPE_ROWS, y1 = min(rows, y0 + REGION_STRIPE_ROWS);
+            for (int y = y0; y < y1; y++) {
+                const uchar *src = gray.ptr<uchar>(y), *above = y > y0 ? gray.ptr<uchar>(y - 1) : NULL;
+                const int base = y * cols;
+                for (int x = 0; x < cols; x++) {
+                    const int i = base + x;
+                    if (x > 0 && joins(src[x], src[x - 1])) {
+                        sets.attach(i, i - 1);
+                    } else {
+                        sets.makeSet(i);
+                    }
+                    if (above != NULL && joins(src[x], above[x])) {
+                        sets.unite(i, i - cols);
+                    }
+                }
+            }
+        }
+    });
+
+    // Step 2: Join the stripes across their shared borders
+    parallel_for_(Range(1, max(1, stripes)), [&](const Range& range) {
+        for (int s = range.start; s < range.end; s++) {
+            const int y = s * REGION_STRIPE_ROWS;
+            const uchar *src = gray.ptr<uchar>(y), *above = gray.ptr<uchar>(y - 1);
+            for (int x = 0; x < cols; x++) {
+                if (joins(src[x], above[x])) {
+                    sets.unite(y * cols + x, (y - 1) * cols + x);
+                }
+            }
+        }
+    });
+
+    // Step 3: Point every pixel at its root
+    parallel_for_(Range(0, stripes), [&](const Range& range) {
+        for (int y = range.start * REGION_STRIPE_ROWS; y < min(rows, range.end * REGION_STRIPE_ROWS); y++) {
+            int *dst = roots.ptr<int>(y);
+            for (int x = 0; x < cols; x++) {
+                dst[x] = sets.find(y * cols + x);
+            }
+        }
+    });
 }
 
-// Otsu Segmentation Implementation
-Mat otsuSegmentation(const Mat& image, double& otsuThreshold) {
-    Mat gray;
-    if (image.channels() == 3) {
-        cvtColor(image, gray, COLOR_BGR2GRAY);
-    } else {
-        gray = image.clone();
+// Labels the regions grown from seeds in parallel. By default a region holds
+// the 4-connected pixels whose gray level differs from its seed's by less than
+// tolerance, as in regionGrowingSegmentation; regions of seeds with different
+// levels may overlap, and the first seed wins there. One labelling pass runs
+// per distinct seed level. With floating set, neighbouring pixels join when
+// they differ by less than tolerance (the floating range of floodFill), so a
+// region does not depend on its seed and one pass labels all of them. Returns
+// CV_32S labels: the 1-based index of the first seed whose region holds each
+// pixel, 0 for pixels no seed reaches.
+static Mat growSeedRegions(const Mat& gray, const vector<Point>& seeds, int tolerance, bool floating) {
+    const int rows = gray.rows, cols = gray.cols;
+    const int stripes = (rows + REGION_STRIPE_ROWS - 1) / REGION_STRIPE_ROWS;
+    Mat labels = Mat::zeros(gray.size(), CV_32S);
+    if (gray.empty()) {
+        return labels;
     }
 
-    // Apply Otsu's thresholding
-    Mat segmented;
-    otsuThreshold = threshold(gray, segmented, 0, 255, THRESH_BINARY | THRESH_OTSU);
-    
-    // Calculate and display histogram in a separate window
-    int histSize = 256;
-    float range[] = {0, 256};
-    const float* histRange = {range};
-    Mat hist;
-    calcHist(&gray, 1, 0, Mat(), hist, 1, &histSize, &histRange);
-
-    // Create histogram visualization
-    Mat histImage(200, 512, CV_8UC3, Scalar(255, 255, 255));
-    normalize(hist, hist, 0, histImage.rows, NORM_MINMAX);
-    
-    // Draw histogram
-    for(int i = 0; i < histSize; i++) {
-        line(histImage,
-             Point(i*2, histImage.rows),
-             Point(i*2, histImage.rows - cvRound(hist.at<float>(i))),
-             Scalar(100, 100, 100),
-             2);
-    }
-
-    // Draw threshold line
-    line(histImage,
-         Point(cvRound(otsuThreshold)*2, 0),
-         Point(cvRound(otsuThreshold)*2, histImage.rows),
-         Scalar(0, 0, 255),
-         2);
-    
-    // Add text for threshold value
-    putText(histImage,
-            format("Threshold: %.1f", otsuThreshold),
-            Point(10, 30),
-            FONT_HERSHEY_SIMPLEX,
-            0.7,
-            Scalar(0, 0, 0),
-            2);
-
-    // Show histogram in separate window
-    imshow("Otsu Threshold Histogram", histImage);
-    
-    // Convert segmented image to color for main display
-    Mat colored;
-    cvtColor(segmented, colored, COLOR_GRAY2BGR);
-    return colored;
-}
+    ConcurrentUnionFind sets((size_t)rows * cols);
+    Mat roots(gray.size(), CV_32S);
+
+    // Gives the roots of the sets holding the given seeds their seed's label
+    // (first seed wins) and every other root 0, then labels the pixels still
+    // unlabelled or held by a later seed. Root parents are free once all
+    // paths are flat.
+    auto claim = [&](const vector<int>& group) {
+        parallel_for_(Range(0, stripes), [&](const Range& range) {
+            for (int y = range.start * REGION_STRIPE_ROWS; y < min(rows, range.end * REGION_STRIPE_ROWS); y++) {
+                const int *root = roots.ptr<int>(y);
+                for (int x = 0; x < cols; x++) {
+                    if (root[x] == y * cols + x) {
+                        sets.setValue(root[x], 0);
+                    }
+                }
+            }
+        });
+        for (int k : group) {
+            int root = roots.at<int>(seeds[k]);
+            if (sets.value(root) == 0) {
+                sets.setValue(root, k + 1);
+            }
+        }
+        parallel_for_(Range(0, stripes), [&](const Range& range) {
+            for (int y = range.start * REGION_STRIPE_ROWS; y < min(rows, range.end * REGION_STRIPE_ROWS); y++) {
+                const int *root = roots.ptr<int>(y);
+                int *dst = labels.ptr<int>(y);
+                for (int x = 0; x < cols; x++) {
+                    int label = sets.value(root[x]);
+                    if (label != 0 && (dst[x] == 0 || label < dst[x])) {
+                        dst[x] = label;
+                    }
+                }
+            }
+        });
+    };
 
-// Basic Backtracking Segmentation Implementation
-Mat backtrackingSegmentation(const Mat& image) {
-    Mat gray;
-    if (image.channels() == 3) {
-        cvtColor(image, gray, COLOR_BGR2GRAY);
-    } else {
-        gray = image.clone();
+    if (floating) {
+        vector<int> group;
+        for (size_t k = 0; k < seeds.size(); k++) {
+            group.push_back((int)k);
+        }
+        uniteNeighbours(gray, sets, [&](int a, int b) { return abs(a - b) < tolerance; }, roots);
+        claim(group);
+        return labels;
     }
 
-    // Define threshold value
-    int threshValue = BACKTRACKING_THRESHOLD;
+    // One pass per seed level: pixels join when both are within the range of
+    // that level. The seed itself always belongs to its region.
+    vector<vector<int>> levels(256);
+    for (size_t k = 0; k < seeds.size(); k++) {
+        levels[gray.at<uchar>(seeds[k])].push_back((int)k);
+    }
+    for (int level = 0; level < 256; level++) {
+        if (levels[level].empty()) {
+            continue;
+        }
+        bool accepted[256];
+        for (int v = 0; v < 256; v++) {
+            accepted[v] = abs(v - level) < tolerance;
+        }
+        uniteNeighbours(gray, sets, [&](int a, int b) { return accepted[a] && accepted[b]; }, roots);
+        claim(levels[level]);
+    }
+    return labels;
+}
 
-    // Create a matrix for segmentation
-    Mat binary;
-    threshold(gray, binary, threshValue, 255, THRESH_BINARY);
-    
-    // Create a copy for the result
-    Mat segmented = binary.clone();
-    
-    // Choose a starting point for segmentation (center of image)
-    int startX = gray.cols / 2;
-    int startY = gray.rows / 2;
-    int oldColor = binary.at<uchar>(startY, startX);
-    int newColor = 128; // Mid-gray for marking the segmented region
-    
-    // Use a non-recursive approach to avoid stack overflow
-    Mat visited = Mat::zeros(binary.size(), CV_8UC1);
-    queue<Point> q;
-    q.push(Point(startX, startY));
-    visited.at<uchar>(startY, startX) = 1;
-    
-    // Define 4-directional connectivity 
-    const int dx[] = {0, 0, 1, -1};  // East, West, North, South
-    const int dy[] = {1, -1, 0, 0};  // No diagonals
-    const int NUM_DIRECTIONS = 4;
-    
-    while (!q.empty()) {
-        Point p = q.front();
-        q.pop();
-        
-        // If the pixel matches the old color, mark it with the new color
-        if (binary.at<uchar>(p.y, p.x) == oldColor) {
-            segmented.at<uchar>(p.y, p.x) = newColor;
-            
-            // Check only 4-connected neighbors
-            for (int i = 0; i < NUM_DIRECTIONS; i++) {
-                int nx = p.x + dx[i];
-                int ny = p.y + dy[i];
-                
-                if (nx >= 0 && ny >= 0 && nx < binary.cols && ny < binary.rows && 
-                    !visited.at<uchar>(ny, nx)) {
-                    visited.at<uchar>(ny, nx) = 1;
-                    q.push(Point(nx, ny));
+// Seeded region growing kept between runs that differ only in tolerance, for
+// criteria that accept more pixels as the tolerance grows (e.g. an intensity
+// difference below it). Seeds grow one after another, never into a region of
+// an earlier seed, and each seed remembers its region (per-pixel owner) and
+// its frontier: the neighbouring pixels its criterion rejected. A larger
+// tolerance resumes every seed from its frontier, so a slider tick costs about
+// the newly added area; a smaller one, or other seeds, starts over. When a
+// seed's new growth reaches pixels of a later seed, that seed and all after it
+// are regrown, since growing from scratch would have given those pixels to the
+// earlier seed. The result is always the same as growing from scratch.
+class RegionGrowth {
+public:
+    explicit RegionGrowth(Size size) : size(size) {}
+
+    // Grows seeds[k] over the pixels with accepts(k, x, y) (the seed pixel is
+    // always in), skipping seeds inside an earlier region, and writes the
+    // union of the regions to regions as 255 on 0
+    template <int Connectivity, typename Criterion>
+    void grow(const vector<Point>& seeds, int tolerance, Criterion accepts, vector<Point>& pending, Mat& regions) {
+        CV_Assert(seeds.size() < 255);
+        lock_guard<mutex> guard(lock);
+        if (seeds != seeds_ || tolerance < tolerance_) {
+            seeds_ = seeds;
+            owner = Mat::zeros(size, CV_8UC1);
+            mask.reset(size);
+            listed.reset(size);
+            frontier.assign(seeds.size(), vector<Point>());
+            built = 0;
+        }
+        tolerance_ = tolerance;
+
+        for (int k = 0; k < (int)seeds_.size(); k++) {
+            if (k < built) {
+                resumeSeed<Connectivity>(k, accepts, pending);
+            } else {
+                frontier[k].clear();
+                if (!mask.test(seeds_[k].x, seeds_[k].y)) {
+                    fillFrom<Connectivity>(k, seeds_[k], accepts, pending, NULL);
+                }
+                built = k + 1;
+            }
+
+            // A pixel is rejected once per neighbouring span; keep one entry
+            vector<Point>& rejected = frontier[k];
+            size_t kept = 0;
+            for (const Point& p : rejected) {
+                if (!listed.test(p.x, p.y)) {
+                    listed.fillSpan(p.y, p.x, p.x);
+                    rejected[kept++] = p;
                 }
             }
+            rejected.resize(kept);
+            for (const Point& p : rejected) {
+                listed.clear(p.x, p.y);
+            }
         }
+        mask.toMat(regions);
     }
-    
-    // Apply color map for better visualization
-    Mat colored;
-    applyColorMap(segmented, colored, COLORMAP_JET);
-    
-    return colored;
-}
 
-// Improved Backtracking Segmentation Implementation
-Mat backtrackingSegmentationImproved(const Mat& image) {
-    // Convert to grayscale if not already
-    Mat gray;
-    if (image.channels() == 3) {
-        cvtColor(image, gray, COLOR_BGR2GRAY);
-    } else {
-        gray = image.clone();
+private:
+    // Flood fill for seed k from start, recording the pixels it takes (also in
+    // added, if given) and the ones its criterion rejects
+    template <int Connectivity, typename Criterion>
+    void fillFrom(int k, Point start, Criterion& accepts, vector<Point>& pending, vector<Point> *added) {
+        const Point seed = seeds_[k];
+        const uchar label = (uchar)(k + 1);
+        scanlineFloodFill<Connectivity>(mask, pending, start, [&](int x, int y) {
+            if ((x == seed.x && y == seed.y) || accepts(k, x, y)) {
+                owner.at<uchar>(y, x) = label;
+                if (added != NULL) {
+                    added->push_back(Point(x, y));
+                }
+                return true;
+            }
+            frontier[k].push_back(Point(x, y));
+            return false;
+        });
     }
 
-    // Apply bilateral filter to reduce noise but keep edges
-    Mat smooth;
-    bilateralFilter(gray, smooth, 9, 75, 75);
+    // Regrows seed k from its frontier at the new tolerance
+    template <int Connectivity, typename Criterion>
+    void resumeSeed(int k, Criterion& accepts, vector<Point>& pending) {
+        const uchar label = (uchar)(k + 1);
+        vector<Point> candidates, taken, added;
+        candidates.swap(frontier[k]);
+        // New pixels only border later regions if some later seed has grown
+        const bool last = k + 1 == built;
+        while (!candidates.empty()) {
+            // Pixels next to the region: earlier regions stay closed, free
+            // pixels are filled from, and later regions' pixels are taken
+            int firstTaken = INT_MAX;
+            auto visit = [&](Point p) {
+                const uchar o = owner.at<uchar>(p);
+                if (o != 0 && o <= label) {
+                    return;
+                }
+                if (!accepts(k, p.x, p.y)) {
+                    frontier[k].push_back(p);
+                } else if (o == 0) {
+                    fillFrom<Connectivity>(k, p, accepts, pending, last ? NULL : &added);
+                } else {
+                    firstTaken = min(firstTaken, o - 1);
+                    taken.push_back(p);
+                }
+            };
+            for (const Point& p : candidates) {
+                visit(p);
+            }
 
-    // Define threshold value
-    int threshValue = BACKTRACKING_THRESHOLD;
+            // The fills never enter marked pixels, so check the later regions
+            // next to the new pixels here
+            for (const Point& p : added) {
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        Point q(p.x + dx, p.y + dy);
+                        if ((Connectivity == FLOOD_4 && dx != 0 && dy != 0) || q.x < 0 || q.y < 0 ||
+                            q.x >= size.width || q.y >= size.height) {
+                            continue;
+                        }
+                        if (owner.at<uchar>(q) > label) {
+                            visit(q);
+                        }
+                    }
+                }
+            }
+            added.clear();
+            candidates.clear();
+            if (firstTaken == INT_MAX) {
+                break;
+            }
 
-    // Threshold the smoothed image
-    Mat binary;
-    threshold(smooth, binary, threshValue, 255, THRESH_BINARY);
+            // Clear the seeds from firstTaken on; they are grown again after
+            // this one, which continues from the pixels it took
+            for (int j = firstTaken; j < built; j++) {
+                clearSeed<Connectivity>(j, pending);
+            }
+            for (int j = firstTaken; j < (int)frontier.size(); j++) {
+                frontier[j].clear();
+            }
+            built = firstTaken;
+            candidates.swap(taken);
+        }
+    }
+
+    // Removes the region of seed k, visiting only its own pixels: a region
+    // stays connected to its seed until it is cleared, so it is found by
+    // filling its owner label from the seed
+    template <int Connectivity>
+    void clearSeed(int k, vector<Point>& pending) {
+        const uchar label = (uchar)(k + 1);
+        const Point seed = seeds_[k];
+        if (owner.at<uchar>(seed) != label) {
+            return; // The seed was inside an earlier region and never grew
+        }
+        auto release = [&](Point p) {
+            owner.at<uchar>(p) = 0;
+            mask.clear(p.x, p.y);
+            pending.push_back(p);
+        };
+        pending.clear();
+        release(seed);
+        while (!pending.empty()) {
+            Point p = pending.back();
+            pending.pop_back();
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    Point q(p.x + dx, p.y + dy);
+                    if ((Connectivity == FLOOD_4 && dx != 0 && dy != 0) || q.x < 0 || q.y < 0 ||
+                        q.x >= size.width || q.y >= size.height) {
+                        continue;
+                    }
+                    if (owner.at<uchar>(q) == label) {
+                        release(q);
+                    }
+                }
+            }
+        }
+    }
+
+    mutex lock;
+    Size size;
+    vector<Point> seeds_;
+    int tolerance_ = -1;
+    int built = 0;                    // Seeds grown at tolerance_ (all earlier ones too)
+    Mat owner;                        // 0, or 1 + the index of the seed whose region holds the pixel
+    FloodMask mask;                   // Union of the regions
+    FloodMask listed;                 // Scratch marks for deduplicating a frontier
+    vector<vector<Point>> frontier;   // Rejected neighbours of each seed's region
+};
+
+shared_ptr<RegionGrowth> PreprocessCache::regionGrowth(const Mat& product, int connectivity) {
+    lock_guard<mutex> guard(lock);
+    for (const GrowthEntry& entry : growths_) {
+        if (entry.data == product.data && entry.connectivity == connectivity) {
+            return entry.growth;
+        }
+    }
+
+    GrowthEntry entry;
+    entry.data = product.data;
+    entry.connectivity = connectivity;
+    entry.growth = make_shared<RegionGrowth>(product.size());
+    growths_.push_back(entry);
+    return entry.growth;
+}
+
+// Scratch memory reused from one segmentation run to the next, so repeated
+// runs on same-sized images allocate no full-frame buffers. One workspace
+// serves one run at a time; threadWorkspace() gives every thread its own.
+struct SegmentationWorkspace {
+    FloodMask mask;                      // Flood fill visited/region mask
+    FloodMask inside;                    // Pixels a flood fill may enter
+    vector<Point> pending;               // Flood fill span stack
+    Mat segmented;                       // Thresholded or labelled intermediate
+    Mat morph;                           // Morphology output
+    shared_ptr<PreprocessCache> cache;   // Preprocessing of the last image run here
+};
+
+SegmentationWorkspace& threadWorkspace() {
+    thread_local SegmentationWorkspace workspace;
+    return workspace;
+}
+
+// Everything one segmentation run needs besides the image: its parameters
+// and the scratch memory it may use (the calling thread's unless given)
+struct SegmentationContext {
+    SegmentationParams params;
+    SegmentationWorkspace *workspace;
+    GrabCutSession *grabcut_session = NULL; // Interactive GrabCut state (GUI only)
+
+    explicit SegmentationContext(const SegmentationParams& params = SegmentationParams(),
+                                 SegmentationWorkspace *workspace = NULL)
+        : params(params), workspace(workspace != NULL ? workspace : &threadWorkspace()) {}
+};
+
+// Preprocessing cache for an image: the loaded image's shared cache when it is
+// that image, otherwise the workspace's own cache (e.g. batch workers)
+shared_ptr<PreprocessCache> preprocessFor(const Mat& image, SegmentationWorkspace& workspace) {
+    {
+        lock_guard<mutex> guard(image_cache_lock);
+        if (image_cache && image_cache->matches(image)) {
+            return image_cache;
+        }
+    }
+
+    if (!workspace.cache || !workspace.cache->matches(image)) {
+        workspace.cache = make_shared<PreprocessCache>(image);
+    }
+    return workspace.cache;
+}
+
+// Backtracking core: find the region on the same side of threshValue as the
+// image centre and return the thresholded source with that region in mid-gray.
+// The source may be gray or colour; colour is converted to gray on the fly.
+// Interactive caches answer from the source's component tree, so moving the
+// threshold slider costs a tree walk instead of a new flood fill. Otherwise the
+// fill runs on one-bit masks packed straight from the source. The result
+// lives in workspace.segmented.
+template <int Connectivity>
+static Mat fillBacktrackingRegion(const Mat& source, int threshValue, PreprocessCache& cache,
+                                  SegmentationWorkspace& workspace) {
+    // Choose a starting point for segmentation (center of image)
+    Point start(source.cols / 2, source.rows / 2);
+    bool seedAbove = grayAt(source, start) > threshValue;
+
+    Mat& segmented = workspace.segmented;
+    segmented.create(source.size(), CV_8UC1);
+    if (cache.interactive()) {
+        Mat gray = source.channels() == 1 ? source : cache.gray();
+        for (int y = 0; y < gray.rows; y++) {
+            const uchar *src = gray.ptr<uchar>(y);
+            uchar *dst = segmented.ptr<uchar>(y);
+            for (int x = 0; x < gray.cols; x++) {
+                dst[x] = src[x] > threshValue ? 255 : 0;
+            }
+        }
+        shared_ptr<ComponentTree> tree = cache.componentTree(gray, Connectivity, !seedAbove);
+        tree->paint(segmented, start, threshValue, 128); // Mid-gray marks the region
+        return segmented;
+    }
+
+    // Pixels on the seed's side of the threshold, one bit each
+    FloodMask& inside = workspace.inside;
+    packIntensityRange(source, seedAbove ? threshValue + 1 : 0, seedAbove ? 255 : threshValue, inside);
+    FloodMask& mask = workspace.mask;
+    mask.reset(source.size());
+    scanlineFloodFill<Connectivity>(mask, inside, workspace.pending, start);
+
+    // Eight pixels at a time: mid-gray marks the region, the rest is the
+    // threshold (the inside bits, inverted when the seed is below it)
+    const uint64_t *spread = maskByteSpread();
+    const uint64_t invert = seedAbove ? 0 : 0x0101010101010101ull;
+    for (int y = 0; y < source.rows; y++) {
+        const uchar *m = (const uchar *)mask.row(y), *in = (const uchar *)inside.row(y);
+        uchar *dst = segmented.ptr<uchar>(y);
+        for (int x = 0; x < source.cols; x += 8) {
+            uint64_t region = spread[m[x >> 3]], above = spread[in[x >> 3]] ^ invert;
+            uint64_t eight = region * 128 | (above & ~region) * 0xFF;
+            memcpy(dst + x, &eight, min(8, source.cols - x));
+        }
+    }
+    return segmented;
+}
+
+// Stage timing. Segmentation functions mark their stages with a StageTimer;
+// stages are only recorded while a StageRecording is active on the calling
+// thread, so otherwise a stage costs one thread-local pointer test.
+struct StageSample {
+    string name;
+    int depth;          // 0 for a whole function, 1 for its stages, deeper when nested
+    double start_us;    // Since the process-wide stage clock epoch
+    double duration_us;
+};
+
+thread_local vector<StageSample> *stage_log = NULL;
+thread_local int stage_depth = 0;
+
+static double stage_clock_us() {
+    static const chrono::steady_clock::time_point epoch = chrono::steady_clock::now();
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - epoch).count();
+}
+
+// Collects the stages timed on this thread into log while in scope
+class StageRecording {
+public:
+    explicit StageRecording(vector<StageSample>& log) : previous(stage_log) {
+        stage_log = &log;
+    }
+    ~StageRecording() {
+        stage_log = previous;
+    }
+
+private:
+    vector<StageSample> *previous;
+};
+
+// Times a whole function and the stages begun inside it, one after another
+class StageTimer {
+public:
+    explicit StageTimer(const char *name) : function_name(name) {
+        if (stage_log != NULL) {
+            depth = stage_depth++;
+            function_start = stage_clock_us();
+        }
+    }
+
+    ~StageTimer() {
+        if (stage_log != NULL) {
+            end();
+            stage_depth = depth;
+            stage_log->push_back({function_name, depth, function_start, stage_clock_us() - function_start});
+        }
+    }
+
+    // End the running stage (if any) and start the next one
+    void begin(const char *stage) {
+        if (stage_log != NULL) {
+            end();
+            current = stage;
+            stage_start = stage_clock_us();
+        }
+    }
+
+    void end() {
+        if (stage_log != NULL && current != NULL) {
+            stage_log->push_back({current, depth + 1, stage_start, stage_clock_us() - stage_start});
+            current = NULL;
+        }
+    }
+
+private:
+    const char *function_name;
+    const char *current = NULL;
+    int depth = 0;
+    double function_start = 0;
+    double stage_start = 0;
+};
+
+// One line per stage for the info panel
+static string format_stage_breakdown(vector<StageSample> samples) {
+    sort(samples.begin(), samples.end(), [](const StageSample& a, const StageSample& b) {
+        return a.start_us < b.start_us;
+    });
+    string text;
+    for (const StageSample& sample : samples) {
+        if (sample.depth > 0) {
+            text += format("\n%*s%s: %.2f ms", 2 * sample.depth, "", sample.name.c_str(), sample.duration_us / 1000.0);
+        }
+    }
+    return text;
+}
+
+// Tiled (out-of-core) processing settings
+struct TiledOptions {
+    int tile_size = 2048; // Side of the square tiles written to the output
+    int halo = 8;         // Extra border read around each tile for neighbourhood filters
+    int threads = 1;      // Tiles processed concurrently
+};
+
+// Gray-level histogram and the thresholds chosen on it, for the GUI to plot
+struct HistogramPlot {
+    vector<double> bins; // 256 pixel counts
+    vector<int> thresholds;
+};
+
+HistogramPlot displayed_histogram; // Drawn in histogram_view
+
+// Forward declarations of segmentation algorithms
+Mat activeContoursSegmentation(const Mat& image, const SegmentationContext& context);
+Mat levelSetSegmentation(const Mat& image, const SegmentationContext& context);
+Mat kMeansSegmentation(const Mat& image, const SegmentationContext& context);
+Mat colorKMeansSegmentation(const Mat& image, const SegmentationContext& context);
+Mat otsuSegmentation(const Mat& image, const SegmentationContext& context, vector<int>& thresholds,
+                     HistogramPlot* histogramPlot = NULL);
+Mat backtrackingSegmentation(const Mat& image, const SegmentationContext& context);
+Mat backtrackingSegmentation8Dir(const Mat& image, const SegmentationContext& context);
+Mat backtrackingSegmentationImproved(const Mat& image, const SegmentationContext& context);
+Mat backtrackingEdgeEnhancementSegmentation(const Mat& image, const SegmentationContext& context);
+Mat watershedSegmentation(const Mat& image, const SegmentationContext& context);
+Mat graphCutSegmentation(const Mat& image, const SegmentationContext& context);
+Mat gridCutSegmentation(const Mat& image, const SegmentationContext& context);
+Mat regionGrowingSegmentation(const Mat& image, Point seed, const SegmentationContext& context);
+Mat multiSeedRegionGrowingSegmentation(const Mat& image, const SegmentationContext& context);
+Mat runSegmentation(const string& algorithm, const Mat& image, const SegmentationContext& context,
+                    string& algorithm_info, string& threshold_info, HistogramPlot* histogram_plot = NULL);
+void tiledSegmentation(const string& algorithm, const string& inputPath, const string& outputPath,
+                       const TiledOptions& options, const SegmentationParams& params);
+static Mat refineMaskWithGridCut(const Mat& colorImage, const Mat& mask, float smoothness, int connectivity);
+
+// Forward declarations
+static void request_segmentation(const char *algorithm);
+static void on_algorithm_changed(GtkComboBox *widget, gpointer data);
+
+// A segmentation request for the background worker. Parameters are captured
+// when the request is made so the worker never reads GTK widgets.
+struct SegmentationJob {
+    string algorithm;
+    Mat image;
+    SegmentationParams params;
+    shared_ptr<GrabCutSession> grabcut_session; // Kept alive while the job runs
+    unsigned long generation = 0;
+};
+
+// Result posted from the worker back to the GTK main loop
+struct SegmentationOutcome {
+    Mat image;
+    HistogramPlot histogram_plot;
+    string algorithm_info;
+    string threshold_info;
+    string stage_breakdown; // Per-stage timings, one line each
+    string error;
+    double elapsed_ms = 0;
+    unsigned long generation = 0;
+};
+
+// Background thread that owns all segmentation started from the GUI so the
+// main loop stays responsive. Only one request is kept pending: a new request
+// replaces a queued one, so while the worker is busy only the latest slider
+// value gets computed next.
+class SegmentationWorker {
+public:
+    void start(GSourceFunc on_done);
+    void stop();
+    unsigned long submit(SegmentationJob job);
+    unsigned long latest_generation() const { return generation_counter; }
+
+private:
+    void run();
+
+    thread worker_thread;
+    mutex lock;
+    condition_variable wake;
+    SegmentationJob pending;
+    bool has_pending = false;
+    bool stopping = false;
+    atomic<unsigned long> generation_counter{0};
+    GSourceFunc done_callback = NULL;
+};
+
+SegmentationWorker segmentation_worker;
+unsigned long displayed_generation = 0; // Newest result shown, touched on the main loop only
+
+void SegmentationWorker::start(GSourceFunc on_done) {
+    if (worker_thread.joinable()) {
+        return;
+    }
+    done_callback = on_done;
+    stopping = false;
+    worker_thread = thread(&SegmentationWorker::run, this);
+}
+
+void SegmentationWorker::stop() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_one();
+    if (worker_thread.joinable()) {
+        worker_thread.join();
+    }
+}
+
+unsigned long SegmentationWorker::submit(SegmentationJob job) {
+    {
+        lock_guard<mutex> guard(lock);
+        job.generation = ++generation_counter;
+        pending = move(job);
+        has_pending = true;
+    }
+    wake.notify_one();
+    return generation_counter;
+}
+
+void SegmentationWorker::run() {
+    while (true) {
+        SegmentationJob job;
+        {
+            unique_lock<mutex> guard(lock);
+            wake.wait(guard, [this] { return has_pending || stopping; });
+            if (stopping) {
+                return;
+            }
+            job = move(pending);
+            pending = SegmentationJob();
+            has_pending = false;
+        }
+
+        SegmentationContext context(job.params);
+        context.grabcut_session = job.grabcut_session.get();
+        SegmentationOutcome *outcome = new SegmentationOutcome();
+        outcome->generation = job.generation;
+        try {
+            vector<StageSample> stages;
+            StageRecording recording(stages);
+            auto start_time = chrono::high_resolution_clock::now();
+            outcome->image = runSegmentation(job.algorithm, job.image, context, outcome->algorithm_info,
+                                             outcome->threshold_info, &outcome->histogram_plot);
+            auto end_time = chrono::high_resolution_clock::now();
+            outcome->elapsed_ms = chrono::duration<double, milli>(end_time - start_time).count();
+            outcome->stage_breakdown = format_stage_breakdown(stages);
+        } catch (const exception& e) {
+            outcome->error = e.what();
+        }
+
+        g_idle_add(done_callback, outcome);
+    }
+}
+
+// Convert a BGR or grayscale Mat to a GdkPixbuf that fits in max_width x max_height,
+// keeping the aspect ratio (replaces the temporary JPEG round trip through disk)
+static GdkPixbuf *mat_to_pixbuf(const Mat& image, int max_width, int max_height) {
+    Mat bgr;
+    if (image.channels() == 1) {
+        cvtColor(image, bgr, COLOR_GRAY2BGR);
+    } else if (image.channels() == 4) {
+        cvtColor(image, bgr, COLOR_BGRA2BGR);
+    } else {
+        bgr = image;
+    }
+
+    double scale = min((double)max_width / bgr.cols, (double)max_height / bgr.rows);
+    Size target(max(1, cvRound(bgr.cols * scale)), max(1, cvRound(bgr.rows * scale)));
+    Mat resized;
+    if (target != bgr.size()) {
+        resize(bgr, resized, target, 0, 0, scale < 1.0 ? INTER_AREA : INTER_LINEAR);
+    } else {
+        resized = bgr;
+    }
+
+    GdkPixbuf *pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, target.width, target.height);
+    if (pixbuf == NULL) {
+        return NULL;
+    }
+
+    // Write the RGB pixels straight into the pixbuf's buffer
+    Mat rgb(target, CV_8UC3, gdk_pixbuf_get_pixels(pixbuf), gdk_pixbuf_get_rowstride(pixbuf));
+    cvtColor(resized, rgb, COLOR_BGR2RGB);
+    return pixbuf;
+}
+
+// Show a segmentation result in the processed image view and remember it for export
+static bool show_processed_image(const Mat& processed_image) {
+    if (processed_image.empty()) {
+        return false;
+    }
+
+    GdkPixbuf *pixbuf = mat_to_pixbuf(processed_image, 400, 400);
+    if (pixbuf == NULL) {
+        return false;
+    }
+
+    gtk_image_set_from_pixbuf(GTK_IMAGE(processed_image_view), pixbuf);
+    processed_display_size = Size(gdk_pixbuf_get_width(pixbuf), gdk_pixbuf_get_height(pixbuf));
+    g_object_unref(pixbuf);
+
+    processed_result = processed_image;
+    gtk_widget_set_sensitive(export_button, TRUE);
+    return true;
+}
+
+// Draw displayed_histogram: one bar per gray level scaled to the fullest bin,
+// a red line at every threshold and the threshold values
+static gboolean on_histogram_draw(GtkWidget *widget, cairo_t *cr, gpointer data) {
+    const double width = gtk_widget_get_allocated_width(widget);
+    const double height = gtk_widget_get_allocated_height(widget);
+    cairo_set_source_rgb(cr, 1, 1, 1);
+    cairo_paint(cr);
+
+    const vector<double>& bins = displayed_histogram.bins;
+    if (bins.empty()) {
+        return FALSE;
+    }
+    const double fullest = *max_element(bins.begin(), bins.end());
+    const double barWidth = width / bins.size();
+    cairo_set_source_rgb(cr, 0.4, 0.4, 0.4);
+    for (size_t v = 0; v < bins.size(); v++) {
+        double barHeight = fullest > 0 ? bins[v] / fullest * height : 0;
+        cairo_rectangle(cr, v * barWidth, height - barHeight, barWidth, barHeight);
+    }
+    cairo_fill(cr);
+
+    string label = displayed_histogram.thresholds.size() == 1 ? "Threshold:" : "Thresholds:";
+    cairo_set_source_rgb(cr, 1, 0, 0);
+    cairo_set_line_width(cr, 2);
+    for (int t : displayed_histogram.thresholds) {
+        cairo_move_to(cr, (t + 0.5) * barWidth, 0);
+        cairo_line_to(cr, (t + 0.5) * barWidth, height);
+        label += format(" %d", t);
+    }
+    cairo_stroke(cr);
+
+    cairo_set_source_rgb(cr, 0, 0, 0);
+    cairo_set_font_size(cr, 14);
+    cairo_move_to(cr, 10, 20);
+    cairo_show_text(cr, label.c_str());
+    return FALSE;
+}
+
+// Display a finished segmentation; runs on the GTK main loop
+static gboolean on_segmentation_done(gpointer data) {
+    SegmentationOutcome *outcome = (SegmentationOutcome *)data;
+
+    // Drop stale results: a newer request has already been shown, or the image changed
+    if (outcome->generation > displayed_generation) {
+        displayed_generation = outcome->generation;
+
+        if (!outcome->error.empty()) {
+            gtk_label_set_text(GTK_LABEL(status_label), g_strdup_printf("Error: %s", outcome->error.c_str()));
+        } else if (outcome->image.empty()) {
+            gtk_label_set_text(GTK_LABEL(status_label), "Failed to process image");
+        } else if (show_processed_image(outcome->image)) {
+            // Update status with larger time display
+            gtk_label_set_text(GTK_LABEL(status_label), 
+                g_strdup_printf("Processing Time: %.2f ms", outcome->elapsed_ms));
+            
+            // Update info label with algorithm details
+            gtk_label_set_text(GTK_LABEL(info_label), outcome->algorithm_info.c_str());
+
+            // Update threshold label with parameter details and where the time went
+            string details = outcome->threshold_info;
+            if (!outcome->stage_breakdown.empty()) {
+                details += "\n\nStages:" + outcome->stage_breakdown;
+            }
+            gtk_label_set_text(GTK_LABEL(threshold_label), details.c_str());
+
+            // Plot the histogram below the images when the algorithm made one
+            displayed_histogram = outcome->histogram_plot;
+            if (displayed_histogram.bins.empty()) {
+                gtk_widget_hide(histogram_view);
+            } else {
+                gtk_widget_show(histogram_view);
+                gtk_widget_queue_draw(histogram_view);
+            }
+        } else {
+            gtk_label_set_text(GTK_LABEL(status_label), "Failed to display processed image");
+        }
+    }
+
+    delete outcome;
+    return G_SOURCE_REMOVE;
+}
+
+// Queue the algorithm on the background worker with the current slider values
+static void request_segmentation(const char *algorithm) {
+    if (filename == NULL || input_image.empty()) {
+        return;
+    }
+
+    SegmentationJob job;
+    job.algorithm = algorithm;
+    job.image = input_image;
+    job.params.backtracking_threshold = (int)gtk_range_get_value(GTK_RANGE(threshold_slider));
+    job.params.kmeans_clusters = (int)gtk_range_get_value(GTK_RANGE(kmeans_slider));
+    job.params.smoothing_filter = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(smoothing_toggle))
+                                      ? SMOOTHING_BILATERAL_GRID : SMOOTHING_BILATERAL;
+    job.params.otsu_levels = (int)gtk_range_get_value(GTK_RANGE(otsu_slider));
+    job.params.grid_cut_refine = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(
+        strcmp(algorithm, "Otsu Thresholding") == 0 ? otsu_refine_toggle : kmeans_refine_toggle));
+    job.params.region_growing_threshold = (int)gtk_range_get_value(GTK_RANGE(region_slider));
+    job.params.region_seeds = region_seeds;
+    {
+        lock_guard<mutex> guard(image_cache_lock);
+        job.grabcut_session = grabcut_session;
+    }
+    segmentation_worker.submit(job);
+}
+
+// Callback for threshold slider change
+static void on_threshold_changed(GtkRange *range, gpointer data) {
+    // Only update if backtracking is selected
+    gchar *selected_algorithm = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(algorithm_combo));
+    if (selected_algorithm != NULL && strncmp(selected_algorithm, "Backtracking", strlen("Backtracking")) == 0) {
+        request_segmentation(selected_algorithm);
+    }
+    g_free(selected_algorithm);
+}
+
+// Callback for the fast smoothing toggle
+static void on_smoothing_toggled(GtkToggleButton *button, gpointer data) {
+    // Only update if a bilateral-smoothed backtracking algorithm is selected
+    gchar *selected_algorithm = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(algorithm_combo));
+    if (selected_algorithm != NULL && (strcmp(selected_algorithm, "Backtracking Improved") == 0 ||
+                                       strcmp(selected_algorithm, "Backtracking Edge Enhanced") == 0)) {
+        request_segmentation(selected_algorithm);
+    }
+    g_free(selected_algorithm);
+}
+
+// Callback for kmeans slider change
+static void on_kmeans_changed(GtkRange *range, gpointer data) {
+    // Only update if kmeans is selected
+    gchar *selected_algorithm = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(algorithm_combo));
+    if (selected_algorithm != NULL && strncmp(selected_algorithm, "K-Means", strlen("K-Means")) == 0) {
+        request_segmentation(selected_algorithm);
+    }
+    g_free(selected_algorithm);
+}
+
+// Callback for region growing tolerance slider change
+static void on_region_tolerance_changed(GtkRange *range, gpointer data) {
+    // Only update if one of the region growing algorithms is selected; the
+    // single-seed one resumes its previous region when the tolerance grows
+    gchar *selected_algorithm = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(algorithm_combo));
+    if (selected_algorithm != NULL && strncmp(selected_algorithm, "Region Growing", strlen("Region Growing")) == 0) {
+        request_segmentation(selected_algorithm);
+    }
+    g_free(selected_algorithm);
+}
+
+// Callback for Otsu thresholds slider change
+static void on_refine_toggled(GtkToggleButton *button, gpointer data) {
+    // Only update if Otsu or grayscale K-Means is selected
+    gchar *selected_algorithm = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(algorithm_combo));
+    if (selected_algorithm != NULL && (strcmp(selected_algorithm, "Otsu Thresholding") == 0 ||
+                                       strcmp(selected_algorithm, "K-Means") == 0)) {
+        request_segmentation(selected_algorithm);
+    }
+    g_free(selected_algorithm);
+}
+
+static void on_otsu_levels_changed(GtkRange *range, gpointer data) {
+    // Only update if Otsu is selected
+    gchar *selected_algorithm = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(algorithm_combo));
+    if (selected_algorithm != NULL && strcmp(selected_algorithm, "Otsu Thresholding") == 0) {
+        request_segmentation(selected_algorithm);
+    }
+    g_free(selected_algorithm);
+}
+
+// Callback for algorithm selection change
+static void on_algorithm_changed(GtkComboBox *widget, gpointer data) {
+    gchar *selected_algorithm = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(widget));
+    
+    // Show/hide appropriate sliders based on algorithm selection
+    if (selected_algorithm != NULL) {
+        if (strcmp(selected_algorithm, "Backtracking") == 0 || 
+            strcmp(selected_algorithm, "Backtracking (8-Dir)") == 0 ||
+            strcmp(selected_algorithm, "Backtracking Improved") == 0 ||
+            strcmp(selected_algorithm, "Backtracking Edge Enhanced") == 0) {
+            gtk_widget_show_all(threshold_slider_box);
+            gtk_widget_hide(kmeans_slider_box);
+            gtk_widget_hide(otsu_slider_box);
+            gtk_widget_hide(region_slider_box);
+        } else if (strncmp(selected_algorithm, "K-Means", strlen("K-Means")) == 0) {
+            gtk_widget_hide(threshold_slider_box);
+            gtk_widget_show_all(kmeans_slider_box);
+            gtk_widget_hide(otsu_slider_box);
+            gtk_widget_hide(region_slider_box);
+        } else if (strcmp(selected_algorithm, "Otsu Thresholding") == 0) {
+            gtk_widget_hide(threshold_slider_box);
+            gtk_widget_hide(kmeans_slider_box);
+            gtk_widget_show_all(otsu_slider_box);
+            gtk_widget_hide(region_slider_box);
+        } else if (strncmp(selected_algorithm, "Region Growing", strlen("Region Growing")) == 0) {
+            gtk_widget_hide(threshold_slider_box);
+            gtk_widget_hide(kmeans_slider_box);
+            gtk_widget_hide(otsu_slider_box);
+            gtk_widget_show_all(region_slider_box);
+        } else {
+            gtk_widget_hide(threshold_slider_box);
+            gtk_widget_hide(kmeans_slider_box);
+            gtk_widget_hide(otsu_slider_box);
+            gtk_widget_hide(region_slider_box);
+        }
+    }
+    
+    g_free(selected_algorithm);
+}
+
+// Run the named algorithm (GUI or command line name) and describe what was run
+Mat runSegmentation(const string& algorithm, const Mat& image, const SegmentationContext& context,
+                    string& algorithm_info, string& threshold_info, HistogramPlot* histogram_plot) {
+    const SegmentationParams& params = context.params;
+    string name = algorithm;
+    for (const AlgorithmName& entry : ALGORITHM_NAMES) {
+        if (algorithm == entry.cli_name) {
+            name = entry.display_name;
+            break;
+        }
+    }
+
+    Mat processed_image;
+    if (name == "Active Contours") {
+        processed_image = activeContoursSegmentation(image, context);
+        algorithm_info = "Active Contours: Using edge detection and contour evolution";
+        threshold_info = format("Parameters:\n"
+                                "Max Iterations: %d\n"
+                                "Alpha (Elasticity): %.2f\n"
+                                "Beta (Curvature): %.2f\n"
+                                "Gamma (External Energy): %.2f\n"
+                                "Tolerance: %.2f px\n"
+                                "Force field side: %s",
+                                params.active_contours_iterations,
+                                params.active_contours_alpha,
+                                params.active_contours_beta,
+                                params.active_contours_gamma,
+                                params.active_contours_tolerance,
+                                params.gvf_max_side > 0 ? format("at most %d px", params.gvf_max_side).c_str()
+                                                        : "full resolution");
+    } else if (name == "Level Set (Chan-Vese)") {
+        processed_image = levelSetSegmentation(image, context);
+        algorithm_info = "Level Set: Chan-Vese regions evolved on a narrow band";
+        threshold_info = format("Parameters:\n"
+                                "Max Iterations: %d\n"
+                                "Mu (Curvature): %.2f\n"
+                                "Lambda (Region Fit): %.2f",
+                                params.level_set_iterations,
+                                params.level_set_mu,
+                                params.level_set_lambda);
+    } else if (name == "K-Means") {
+        processed_image = kMeansSegmentation(image, context);
+        algorithm_info = "K-Means: Clustering based segmentation";
+        threshold_info = format("Parameters:\n"
+                                "Clusters: %d\n"
+                                "Max Iterations: %d\n"
+                                "Epsilon: %.1f%s",
+                                params.kmeans_clusters,
+                                params.kmeans_max_iter,
+                                params.kmeans_epsilon,
+                                params.grid_cut_refine && params.kmeans_clusters == 2 ? "\nGraph cut clean-up" : "");
+    } else if (name == "K-Means (Color)") {
+        processed_image = colorKMeansSegmentation(image, context);
+        algorithm_info = "K-Means (Color): Colour clustering with Hamerly bounds";
+        threshold_info = format("Parameters:\n"
+                                "Clusters: %d\n"
+                                "Color Space: %s\n"
+                                "Spatial Weight: %.2f\n"
+                                "Max Iterations: %d",
+                                params.kmeans_clusters,
+                                params.kmeans_color_space == KMEANS_LAB ? "Lab" : "BGR",
+                                params.kmeans_spatial_weight,
+                                params.kmeans_max_iter);
+    } else if (name == "Otsu Thresholding") {
+        vector<int> thresholds;
+        processed_image = otsuSegmentation(image, context, thresholds, histogram_plot);
+        algorithm_info = "Otsu: Automatic threshold selection";
+        if (thresholds.size() == 1) {
+            threshold_info = format("Parameters:\nComputed threshold: %d%s", thresholds[0],
+                                    params.grid_cut_refine ? "\nGraph cut clean-up" : "");
+        } else {
+            threshold_info = "Parameters:\nComputed thresholds:";
+            for (int t : thresholds) {
+                threshold_info += format(" %d", t);
+            }
+        }
+    } else if (name == "Backtracking") {
+        processed_image = backtrackingSegmentation(image, context);
+        algorithm_info = "Backtracking: 4-directional region-based segmentation";
+        threshold_info = format("Parameters:\nThreshold: %d", params.backtracking_threshold);
+    } else if (name == "Backtracking (8-Dir)") {
+        processed_image = backtrackingSegmentation8Dir(image, context);
+        algorithm_info = "Backtracking: 8-directional region-based segmentation with noise reduction";
+        threshold_info = format("Parameters:\nThreshold: %d\nGaussian blur: 3x3", params.backtracking_threshold);
+    } else if (name == "Backtracking Improved") {
+        processed_image = backtrackingSegmentationImproved(image, context);
+        algorithm_info = "Backtracking Improved: Region-based segmentation with bilateral filter";
+        threshold_info = format("Parameters:\nThreshold: %d\nBilateral filter: sigma=%.0f%s", params.backtracking_threshold,
+                                BILATERAL_SIGMA, params.smoothing_filter == SMOOTHING_BILATERAL_GRID ? " (grid)" : "");
+    } else if (name == "Backtracking Edge Enhanced") {
+        processed_image = backtrackingEdgeEnhancementSegmentation(image, context);
+        algorithm_info = "Backtracking Edge Enhanced: Region-based segmentation with edge enhancement";
+        threshold_info = format("Parameters:\nThreshold: %d\nBilateral filter: sigma=%.0f%s", params.backtracking_threshold,
+                                BILATERAL_SIGMA, params.smoothing_filter == SMOOTHING_BILATERAL_GRID ? " (grid)" : "");
+    } else if (name == "Watershed") {
+        processed_image = watershedSegmentation(image, context);
+        algorithm_info = "Watershed: Morphological segmentation";
+        threshold_info = format("Parameters:\n"
+                                "Morphological kernel size: %d",
+                                WATERSHED_MORPH_SIZE);
+    } else if (name == "Graph Cut") {
+        processed_image = graphCutSegmentation(image, context);
+        algorithm_info = "Graph Cut: Using GrabCut algorithm";
+        int longest = max(image.cols, image.rows);
+        threshold_info = format("Parameters:\n"
+                                "GrabCut iterations: %d",
+                                params.graph_cut_iterations);
+        if (params.graph_cut_max_side > 0 && longest > params.graph_cut_max_side) {
+            threshold_info += format("\nCoarse level: %d px, boundary band refined", params.graph_cut_max_side);
+        }
+        if (context.grabcut_session != NULL) {
+            threshold_info += "\nDrag on the result to refine: left = foreground, right = background";
+        }
+    } else if (name == "Graph Cut (Grid Max-Flow)") {
+        processed_image = gridCutSegmentation(image, context);
+        algorithm_info = "Graph Cut (Grid Max-Flow): Otsu partition refined by a minimum cut";
+        threshold_info = format("Parameters:\n"
+                                "Smoothness: %.1f\n"
+                                "Connectivity: %d",
+                                params.grid_cut_smoothness,
+                                params.grid_cut_connectivity);
+    } else if (name == "Region Growing") {
+        Point seed(image.cols / 2, image.rows / 2);
+        processed_image = regionGrowingSegmentation(image, seed, context);
+        algorithm_info = "Region Growing: Seed-based segmentation";
+        threshold_info = format("Parameters:\n"
+                                "Intensity threshold: %d\n"
+                                "Seed point: center of image",
+                                params.region_growing_threshold);
+    } else if (name == "Region Growing (Multi-Seed)") {
+        processed_image = multiSeedRegionGrowingSegmentation(image, context);
+        algorithm_info = "Region Growing (Multi-Seed): one region per seed, grown in parallel";
+        string seeds = params.region_seeds.empty() ? format("%dx%d grid", REGION_SEED_GRID, REGION_SEED_GRID)
+                                                   : to_string(params.region_seeds.size());
+        threshold_info = format("Parameters:\n"
+                                "%s threshold: %d\n"
+                                "Seeds: %s",
+                                params.region_floating_range ? "Neighbour" : "Intensity",
+                                params.region_growing_threshold,
+                                seeds.c_str());
+    } else {
+        throw cv::Exception(0, "Unknown algorithm: " + algorithm, "runSegmentation", __FILE__, __LINE__);
+    }
+
+    return processed_image;
+}
+
+// Map a point in the processed image view to input image coordinates; the
+// pixbuf is drawn centered in the view
+static bool processed_view_to_image(GtkWidget *view, double x, double y, Point& point) {
+    if (processed_result.empty() || processed_display_size.area() == 0) {
+        return false;
+    }
+    GtkAllocation allocation;
+    gtk_widget_get_allocation(view, &allocation);
+    double offsetX = (allocation.width - processed_display_size.width) / 2.0;
+    double offsetY = (allocation.height - processed_display_size.height) / 2.0;
+    double scale = (double)input_image.cols / processed_display_size.width;
+    point = Point(cvFloor((x - offsetX) * scale), cvFloor((y - offsetY) * scale));
+    point.x = min(max(point.x, 0), input_image.cols - 1);
+    point.y = min(max(point.y, 0), input_image.rows - 1);
+    return true;
+}
+
+// Strokes and seed clicks only act on a displayed result of the named algorithm
+static bool result_selected(const char *algorithm) {
+    gchar *selected_algorithm = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(algorithm_combo));
+    bool selected = selected_algorithm != NULL && strcmp(selected_algorithm, algorithm) == 0;
+    g_free(selected_algorithm);
+    return selected && !processed_result.empty();
+}
+
+// Start a correction stroke: left button marks foreground, right background.
+// For Region Growing (Multi-Seed) a left click adds a seed and a right click
+// goes back to the seed grid.
+static gboolean on_stroke_press(GtkWidget *widget, GdkEventButton *event, gpointer data) {
+    Point point;
+    if ((event->button != GDK_BUTTON_PRIMARY && event->button != GDK_BUTTON_SECONDARY) ||
+        !processed_view_to_image(widget, event->x, event->y, point)) {
+        return GDK_EVENT_PROPAGATE;
+    }
+    if (result_selected("Region Growing (Multi-Seed)")) {
+        if (event->button == GDK_BUTTON_PRIMARY) {
+            region_seeds.push_back(point);
+        } else {
+            region_seeds.clear();
+        }
+        request_segmentation("Region Growing (Multi-Seed)");
+        return GDK_EVENT_STOP;
+    }
+    if (!result_selected("Graph Cut")) {
+        return GDK_EVENT_PROPAGATE;
+    }
+    current_stroke_foreground = event->button == GDK_BUTTON_PRIMARY;
+    current_stroke.assign(1, point);
+    return GDK_EVENT_STOP;
+}
+
+static gboolean on_stroke_motion(GtkWidget *widget, GdkEventMotion *event, gpointer data) {
+    Point point;
+    if (current_stroke.empty() || !processed_view_to_image(widget, event->x, event->y, point)) {
+        return GDK_EVENT_PROPAGATE;
+    }
+    if (point != current_stroke.back()) {
+        current_stroke.push_back(point);
+    }
+    return GDK_EVENT_STOP;
+}
+
+// Hand the finished stroke to the GrabCut session and re-run Graph Cut
+static gboolean on_stroke_release(GtkWidget *widget, GdkEventButton *event, gpointer data) {
+    if (current_stroke.empty()) {
+        return GDK_EVENT_PROPAGATE;
+    }
+    int radius = max(1, cvRound(GRAB_CUT_STROKE_RADIUS * (double)input_image.cols / processed_display_size.width));
+    {
+        lock_guard<mutex> guard(image_cache_lock);
+        if (grabcut_session) {
+            grabcut_session->addStroke(current_stroke, radius, current_stroke_foreground);
+        }
+    }
+    current_stroke.clear();
+
+    gtk_label_set_text(GTK_LABEL(status_label), "Refining Graph Cut...");
+    request_segmentation("Graph Cut");
+    return GDK_EVENT_STOP;
+}
+
+// Apply the selected algorithm to the image
+static void apply_algorithm(GtkWidget *widget, gpointer data) {
+    if (filename == NULL || input_image.empty()) {
+        gtk_label_set_text(GTK_LABEL(status_label), "Please select an image first");
+        return;
+    }
+
+    // Get the selected algorithm
+    gchar *selected_algorithm = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(algorithm_combo));
+    if (selected_algorithm == NULL) {
+        gtk_label_set_text(GTK_LABEL(status_label), "Please select an algorithm");
+        return;
+    }
+
+    // Hide the previous histogram until the new result arrives
+    gtk_widget_hide(histogram_view);
+
+    // Applying Graph Cut again starts over from the rectangle
+    if (strcmp(selected_algorithm, "Graph Cut") == 0) {
+        resetGrabCutSession(input_image);
+    }
+
+    gtk_label_set_text(GTK_LABEL(status_label), g_strdup_printf("Applying %s...", selected_algorithm));
+    gtk_label_set_text(GTK_LABEL(info_label), ""); // Clear previous info
+    gtk_label_set_text(GTK_LABEL(threshold_label), ""); // Clear previous threshold info
+
+    // The result is displayed by on_segmentation_done once the worker finishes
+    request_segmentation(selected_algorithm);
+    g_free(selected_algorithm);
+}
+
+// Open file dialog to select an image
+static void select_image(GtkWidget *widget, gpointer data) {
+    GtkWidget *dialog;
+    GtkFileChooserAction action = GTK_FILE_CHOOSER_ACTION_OPEN;
+    gint res;
+
+    dialog = gtk_file_chooser_dialog_new("Open Image",
+                                        GTK_WINDOW(window),
+                                        action,
+                                        "_Cancel",
+                                        GTK_RESPONSE_CANCEL,
+                                        "_Open",
+                                        GTK_RESPONSE_ACCEPT,
+                                        NULL);
+
+    // Add filters for image files
+    GtkFileFilter *filter = gtk_file_filter_new();
+    gtk_file_filter_set_name(filter, "Image Files");
+    gtk_file_filter_add_mime_type(filter, "image/jpeg");
+    gtk_file_filter_add_mime_type(filter, "image/png");
+    gtk_file_filter_add_mime_type(filter, "image/bmp");
+    gtk_file_chooser_add_filter(GTK_FILE_CHOOSER(dialog), filter);
+
+    res = gtk_dialog_run(GTK_DIALOG(dialog));
+    if (res == GTK_RESPONSE_ACCEPT) {
+        GtkFileChooser *chooser = GTK_FILE_CHOOSER(dialog);
+        if (filename != NULL) {
+            g_free(filename);
+        }
+        filename = gtk_file_chooser_get_filename(chooser);
+        
+        // Load the image for processing
+        input_image = imread(filename, IMREAD_COLOR);
+        if (input_image.empty()) {
+            gtk_label_set_text(GTK_LABEL(status_label), "Failed to load image");
+            gtk_widget_destroy(dialog);
+            return;
+        }
+        
+        // A new image invalidates the previous result, any still in flight and
+        // all cached preprocessing
+        displayed_generation = segmentation_worker.latest_generation();
+        resetImageCache(input_image);
+        processed_result.release();
+        current_stroke.clear();
+        region_seeds.clear();
+        gtk_image_clear(GTK_IMAGE(processed_image_view));
+        gtk_widget_set_sensitive(export_button, FALSE);
+
+        // Display the selected image
+        GdkPixbuf *pixbuf = mat_to_pixbuf(input_image, 400, 400);
+        if (pixbuf) {
+            gtk_image_set_from_pixbuf(GTK_IMAGE(original_image_view), pixbuf);
+            g_object_unref(pixbuf);
+            gtk_label_set_text(GTK_LABEL(status_label), "Image loaded successfully");
+            gtk_widget_set_sensitive(apply_button, TRUE);
+        } else {
+            gtk_label_set_text(GTK_LABEL(status_label), "Failed to display image");
+        }
+    }
+
+    gtk_widget_destroy(dialog);
+}
+
+// Save dialog to export the last processed image
+static void export_result(GtkWidget *widget, gpointer data) {
+    if (processed_result.empty()) {
+        gtk_label_set_text(GTK_LABEL(status_label), "Nothing to export yet");
+        return;
+    }
+
+    GtkWidget *dialog = gtk_file_chooser_dialog_new("Export Processed Image",
+                                                    GTK_WINDOW(window),
+                                                    GTK_FILE_CHOOSER_ACTION_SAVE,
+                                                    "_Cancel",
+                                                    GTK_RESPONSE_CANCEL,
+                                                    "_Save",
+                                                    GTK_RESPONSE_ACCEPT,
+                                                    NULL);
+    GtkFileChooser *chooser = GTK_FILE_CHOOSER(dialog);
+    gtk_file_chooser_set_do_overwrite_confirmation(chooser, TRUE);
+    string suggested_name = "processed.png";
+    if (filename != NULL) {
+        suggested_name = filesystem::path(filename).stem().string() + "_processed.png";
+    }
+    gtk_file_chooser_set_current_name(chooser, suggested_name.c_str());
+
+    if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
+        char *export_filename = gtk_file_chooser_get_filename(chooser);
+        try {
+            if (imwrite(export_filename, processed_result)) {
+                gtk_label_set_text(GTK_LABEL(status_label), "Processed image exported");
+            } else {
+                gtk_label_set_text(GTK_LABEL(status_label), "Failed to export image");
+            }
+        } catch (const cv::Exception& e) {
+            gtk_label_set_text(GTK_LABEL(status_label), g_strdup_printf("Error: %s", e.what()));
+        }
+        g_free(export_filename);
+    }
+
+    gtk_widget_destroy(dialog);
+}
+
+// Initialize the GTK application
+static void activate(GtkApplication *app, gpointer user_data) {
+    // Create the main window
+    window = gtk_application_window_new(app);
+    gtk_window_set_title(GTK_WINDOW(window), "Image Segmentation App");
+    gtk_window_set_default_size(GTK_WINDOW(window), 900, 600);
+    gtk_container_set_border_width(GTK_CONTAINER(window), 10);
+
+    // Create a vertical box to organize widgets
+    GtkWidget *main_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 10);
+    gtk_container_add(GTK_CONTAINER(window), main_box);
+
+    // Create a horizontal box for controls
+    GtkWidget *control_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 10);
+    gtk_box_pack_start(GTK_BOX(main_box), control_box, FALSE, FALSE, 0);
+
+    // Create a button to select an image
+    GtkWidget *select_button = gtk_button_new_with_label("Select Image");
+    g_signal_connect(select_button, "clicked", G_CALLBACK(select_image), NULL);
+    gtk_box_pack_start(GTK_BOX(control_box), select_button, FALSE, FALSE, 0);
+
+    // Create a combo box for algorithm selection
+    algorithm_combo = gtk_combo_box_text_new();
+    for (const AlgorithmName& entry : ALGORITHM_NAMES) {
+        gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(algorithm_combo), entry.display_name);
+    }
+    gtk_combo_box_set_active(GTK_COMBO_BOX(algorithm_combo), 0);
+    g_signal_connect(algorithm_combo, "changed", G_CALLBACK(on_algorithm_changed), NULL);
+    gtk_box_pack_start(GTK_BOX(control_box), algorithm_combo, FALSE, FALSE, 0);
+
+    // Create a button to apply the selected algorithm
+    apply_button = gtk_button_new_with_label("Apply Algorithm");
+    g_signal_connect(apply_button, "clicked", G_CALLBACK(apply_algorithm), NULL);
+    gtk_box_pack_start(GTK_BOX(control_box), apply_button, FALSE, FALSE, 0);
+    gtk_widget_set_sensitive(apply_button, FALSE); // Disable until image is loaded
+
+    // Create a button to save the processed image
+    export_button = gtk_button_new_with_label("Export Result");
+    g_signal_connect(export_button, "clicked", G_CALLBACK(export_result), NULL);
+    gtk_box_pack_start(GTK_BOX(control_box), export_button, FALSE, FALSE, 0);
+    gtk_widget_set_sensitive(export_button, FALSE); // Disable until a result is shown
+
+    // Create backtracking threshold slider box
+    threshold_slider_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+    gtk_box_pack_start(GTK_BOX(control_box), threshold_slider_box, TRUE, TRUE, 0);
+
+    // Create backtracking threshold slider
+    GtkWidget *threshold_label = gtk_label_new("Threshold:");
+    gtk_box_pack_start(GTK_BOX(threshold_slider_box), threshold_label, FALSE, FALSE, 0);
+
+    threshold_slider = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, 0, 255, 1);
+    gtk_range_set_value(GTK_RANGE(threshold_slider), SegmentationParams().backtracking_threshold);
+    gtk_widget_set_size_request(threshold_slider, 200, -1);
+    g_signal_connect(threshold_slider, "value-changed", G_CALLBACK(on_threshold_changed), NULL);
+    gtk_box_pack_start(GTK_BOX(threshold_slider_box), threshold_slider, TRUE, TRUE, 0);
+
+    // Opt in to the faster, approximate bilateral grid smoothing
+    smoothing_toggle = gtk_check_button_new_with_label("Fast smoothing");
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(smoothing_toggle),
+                                 SegmentationParams().smoothing_filter == SMOOTHING_BILATERAL_GRID);
+    g_signal_connect(smoothing_toggle, "toggled", G_CALLBACK(on_smoothing_toggled), NULL);
+    gtk_box_pack_start(GTK_BOX(threshold_slider_box), smoothing_toggle, FALSE, FALSE, 0);
+
+    // Create kmeans clusters slider box
+    kmeans_slider_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+    gtk_box_pack_start(GTK_BOX(control_box), kmeans_slider_box, TRUE, TRUE, 0);
+
+    // Create kmeans clusters slider
+    GtkWidget *kmeans_label = gtk_label_new("Clusters:");
+    gtk_box_pack_start(GTK_BOX(kmeans_slider_box), kmeans_label, FALSE, FALSE, 0);
+
+    kmeans_slider = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, 2, KMEANS_MAX_CLUSTERS, 1);
+    gtk_range_set_value(GTK_RANGE(kmeans_slider), SegmentationParams().kmeans_clusters);
+    gtk_widget_set_size_request(kmeans_slider, 200, -1);
+    g_signal_connect(kmeans_slider, "value-changed", G_CALLBACK(on_kmeans_changed), NULL);
+    gtk_box_pack_start(GTK_BOX(kmeans_slider_box), kmeans_slider, TRUE, TRUE, 0);
+
+    kmeans_refine_toggle = gtk_check_button_new_with_label("Graph cut clean-up");
+    g_signal_connect(kmeans_refine_toggle, "toggled", G_CALLBACK(on_refine_toggled), NULL);
+    gtk_box_pack_start(GTK_BOX(kmeans_slider_box), kmeans_refine_toggle, FALSE, FALSE, 0);
+
+    // Create Otsu thresholds slider box
+    otsu_slider_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+    gtk_box_pack_start(GTK_BOX(control_box), otsu_slider_box, TRUE, TRUE, 0);
+
+    // Create Otsu thresholds slider
+    GtkWidget *otsu_label = gtk_label_new("Thresholds:");
+    gtk_box_pack_start(GTK_BOX(otsu_slider_box), otsu_label, FALSE, FALSE, 0);
+
+    otsu_slider = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, 1, OTSU_MAX_LEVELS, 1);
+    gtk_range_set_value(GTK_RANGE(otsu_slider), SegmentationParams().otsu_levels);
+    gtk_widget_set_size_request(otsu_slider, 200, -1);
+    g_signal_connect(otsu_slider, "value-changed", G_CALLBACK(on_otsu_levels_changed), NULL);
+    gtk_box_pack_start(GTK_BOX(otsu_slider_box), otsu_slider, TRUE, TRUE, 0);
+
+    otsu_refine_toggle = gtk_check_button_new_with_label("Graph cut clean-up");
+    g_signal_connect(otsu_refine_toggle, "toggled", G_CALLBACK(on_refine_toggled), NULL);
+    gtk_box_pack_start(GTK_BOX(otsu_slider_box), otsu_refine_toggle, FALSE, FALSE, 0);
+
+    // Create region growing tolerance slider box
+    region_slider_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+    gtk_box_pack_start(GTK_BOX(control_box), region_slider_box, TRUE, TRUE, 0);
+
+    // Create region growing tolerance slider
+    GtkWidget *region_label = gtk_label_new("Tolerance:");
+    gtk_box_pack_start(GTK_BOX(region_slider_box), region_label, FALSE, FALSE, 0);
+
+    region_slider = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, 0, 255, 1);
+    gtk_range_set_value(GTK_RANGE(region_slider), SegmentationParams().region_growing_threshold);
+    gtk_widget_set_size_request(region_slider, 200, -1);
+    g_signal_connect(region_slider, "value-changed", G_CALLBACK(on_region_tolerance_changed), NULL);
+    gtk_box_pack_start(GTK_BOX(region_slider_box), region_slider, TRUE, TRUE, 0);
+
+    // Hide the slider boxes initially
+    gtk_widget_hide(threshold_slider_box);
+    gtk_widget_hide(kmeans_slider_box);
+    gtk_widget_hide(otsu_slider_box);
+    gtk_widget_hide(region_slider_box);
+
+    // Create a horizontal box for images
+    GtkWidget *image_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 10);
+    gtk_box_pack_start(GTK_BOX(main_box), image_box, TRUE, TRUE, 0);
+
+    // Create frames for original and processed images
+    GtkWidget *original_frame = gtk_frame_new("Original Image");
+    GtkWidget *processed_frame = gtk_frame_new("Processed Image");
+    
+    gtk_box_pack_start(GTK_BOX(image_box), original_frame, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(image_box), processed_frame, TRUE, TRUE, 0);
+
+    // Create image widgets
+    original_image_view = gtk_image_new();
+    processed_image_view = gtk_image_new();
+
+    // The processed image takes GrabCut correction strokes
+    GtkWidget *processed_event_box = gtk_event_box_new();
+    gtk_widget_add_events(processed_event_box,
+                          GDK_BUTTON_PRESS_MASK | GDK_BUTTON_RELEASE_MASK | GDK_BUTTON1_MOTION_MASK |
+                          GDK_BUTTON3_MOTION_MASK);
+    g_signal_connect(processed_event_box, "button-press-event", G_CALLBACK(on_stroke_press), NULL);
+    g_signal_connect(processed_event_box, "motion-notify-event", G_CALLBACK(on_stroke_motion), NULL);
+    g_signal_connect(processed_event_box, "button-release-event", G_CALLBACK(on_stroke_release), NULL);
+    gtk_container_add(GTK_CONTAINER(processed_event_box), processed_image_view);
+    
+    // Add images to frames
+    gtk_container_add(GTK_CONTAINER(original_frame), original_image_view);
+    gtk_container_add(GTK_CONTAINER(processed_frame), processed_event_box);
+
+    // Histogram plot of results that have one (Otsu), drawn by on_histogram_draw
+    histogram_view = gtk_drawing_area_new();
+    gtk_widget_set_size_request(histogram_view, 512, 200);
+    g_signal_connect(histogram_view, "draw", G_CALLBACK(on_histogram_draw), NULL);
+    gtk_box_pack_start(GTK_BOX(main_box), histogram_view, FALSE, FALSE, 0);
+
+    // Create status label with larger text
+    status_label = gtk_label_new("Ready");
+    PangoAttrList *attr_list = pango_attr_list_new();
+    PangoAttribute *attr = pango_attr_scale_new(1.5); // Make text 1.5 times larger
+    pango_attr_list_insert(attr_list, attr);
+    gtk_label_set_attributes(GTK_LABEL(status_label), attr_list);
+    pango_attr_list_unref(attr_list);
+    gtk_box_pack_start(GTK_BOX(main_box), status_label, FALSE, FALSE, 0);
+
+    // Create info label for algorithm details
+    info_label = gtk_label_new("");
+    gtk_box_pack_start(GTK_BOX(main_box), info_label, FALSE, FALSE, 0);
+
+    // Create threshold label
+    threshold_label = gtk_label_new("");
+    gtk_box_pack_start(GTK_BOX(main_box), threshold_label, FALSE, FALSE, 0);
+
+    // Show all widgets
+    gtk_widget_show_all(window);
+    gtk_widget_hide(histogram_view);
+
+    segmentation_worker.start(on_segmentation_done);
+}
+
+// Result of segmenting one image in batch mode
+struct BatchResult {
+    double segment_ms = 0;
+    double total_ms = 0;
+    bool ok = false;
+    string error;
+};
+
+static void print_batch_usage() {
+    cerr << "Usage: imageSegmentation --batch --algorithm NAME [options] INPUT...\n"
+         << "  INPUT                 image file or directory of images\n"
+         << "  --list FILE           read additional input paths from FILE (one per line)\n"
+         << "  --output DIR          write segmented images to DIR (omit to only time)\n"
+         << "  --threads N           number of worker threads (default: all cores)\n"
+         << "  --threshold T         backtracking threshold (default " << BACKTRACKING_THRESHOLD << ")\n"
+         << "  --clusters K          K-Means clusters (default " << KMEANS_CLUSTERS << ")\n"
+         << "  --otsu-levels N       Otsu thresholds, 1 to " << OTSU_MAX_LEVELS << " (default " << OTSU_LEVELS << ")\n"
+         << "  --trace FILE          write per-stage timings as Chrome trace-event JSON\n"
+         << "  --tiled               stream large images tile by tile (otsu, kmeans, kmeans-color and the\n"
+         << "                        tiled stages below); writes .pnm. Only binary PGM/PPM inputs are\n"
+         << "                        streamed, other formats are decoded into memory in full\n"
+         << "  --tile-size N         tile side in pixels for --tiled (default 2048)\n"
+         << "  --halo N              extra border read around each tile for --tiled (default 8)\n"
+         << "  --color-space S       colour K-Means feature space, lab or bgr (default lab)\n"
+         << "  --spatial-weight W    colour K-Means weight of pixel position (default " << KMEANS_SPATIAL_WEIGHT << ")\n"
+         << "  --smoothing F         backtracking-improved/-edge smoothing, exact (bilateralFilter, default)\n"
+         << "                        or grid (faster bilateral grid approximation)\n"
+         << "  --tolerance T         region growing intensity threshold (default " << REGION_GROWING_THRESHOLD << ")\n"
+         << "  --seeds X,Y[;X,Y...]  region-growing-multi seeds (default a " << REGION_SEED_GRID << "x" << REGION_SEED_GRID
+         << " grid)\n"
+         << "  --floating-range      region-growing-multi joins neighbours closer than --tolerance instead of\n"
+         << "                        comparing each pixel with its seed\n"
+         << "  --graph-cut-side N    run GrabCut on a level with this longest side, then refine the\n"
+         << "                        boundary at full resolution (default " << GRAPH_CUT_MAX_SIDE << ", 0 = off)\n"
+         << "  --graph-cut-cleanup   clean up two-class otsu (one threshold) and kmeans (2 clusters) results\n"
+         << "                        with the grid graph cut\n"
+         << "  --gvf-side N          active contours force field resolution, longest side (default "
+         << GVF_MAX_SIDE << ", 0 = full)\n"
+         << "Algorithms:\n";
+    for (const AlgorithmName& entry : ALGORITHM_NAMES) {
+        cerr << "  " << entry.cli_name << " (\"" << entry.display_name << "\")\n";
+    }
+    cerr << "Tiled stages (--tiled only):\n"
+         << "  threshold             gray level above --threshold\n"
+         << "  smoothed-threshold    the same after edge-preserving smoothing (--smoothing, --halo)\n";
+}
+
+// Write recorded stages as Chrome trace-event JSON (complete "X" events) with
+// one track per worker thread, for chrome://tracing or Perfetto
+static bool write_trace(const string& path, const vector<vector<StageSample>>& threads) {
+    ofstream out(path);
+    out << "{\"traceEvents\": [\n";
+    bool first = true;
+    for (size_t tid = 0; tid < threads.size(); tid++) {
+        for (const StageSample& sample : threads[tid]) {
+            string name;
+            for (char c : sample.name) {
+                if (c == '"' || c == '\\') {
+                    name += '\\';
+                }
+                name += c;
+            }
+            out << (first ? "" : ",\n")
+                << format("{\"name\": \"%s\", \"cat\": \"segmentation\", \"ph\": \"X\", "
+                          "\"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %d}",
+                          name.c_str(), sample.start_us, sample.duration_us, (int)tid);
+            first = false;
+        }
+    }
+    out << "\n]}\n";
+    return (bool)out;
+}
+
+// Add a file, or every image file inside a directory, to the input list
+static void collect_batch_inputs(const string& path, vector<string>& inputs) {
+    if (!filesystem::is_directory(path)) {
+        inputs.push_back(path);
+        return;
+    }
+
+    vector<string> found;
+    for (const auto& entry : filesystem::directory_iterator(path)) {
+        if (!entry.is_regular_file()) {
+            continue;
+        }
+        string ext = entry.path().extension().string();
+        transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        if (ext == ".jpg" || ext == ".jpeg" || ext == ".png" || ext == ".bmp" ||
+            ext == ".tif" || ext == ".tiff" || ext == ".pgm" || ext == ".ppm" || ext == ".pnm") {
+            found.push_back(entry.path().string());
+        }
+    }
+    sort(found.begin(), found.end());
+    inputs.insert(inputs.end(), found.begin(), found.end());
+}
+
+// Headless batch mode: runs one algorithm over many images on a bounded
+// pool of worker threads without initializing GTK
+static int run_batch(int argc, char **argv) {
+    string algorithm;
+    string output_dir;
+    vector<string> inputs;
+    int num_threads = max(1, (int)thread::hardware_concurrency());
+    bool tiled = false;
+    TiledOptions tiled_options;
+    SegmentationParams params;
+    string trace_path;
+
+    try {
+        for (int i = 2; i < argc; i++) {
+            string arg = argv[i];
+            bool has_value = i + 1 < argc;
+            if (arg == "--help" || arg == "-h") {
+                print_batch_usage();
+                return 0;
+            } else if (arg == "--algorithm" && has_value) {
+                algorithm = argv[++i];
+            } else if (arg == "--output" && has_value) {
+                output_dir = argv[++i];
+            } else if (arg == "--threads" && has_value) {
+                num_threads = max(1, stoi(argv[++i]));
+            } else if (arg == "--threshold" && has_value) {
+                params.backtracking_threshold = stoi(argv[++i]);
+            } else if (arg == "--clusters" && has_value) {
+                params.kmeans_clusters = stoi(argv[++i]);
+            } else if (arg == "--otsu-levels" && has_value) {
+                params.otsu_levels = stoi(argv[++i]);
+            } else if (arg == "--trace" && has_value) {
+                trace_path = argv[++i];
+            } else if (arg == "--tiled") {
+                tiled = true;
+            } else if (arg == "--tile-size" && has_value) {
+                tiled_options.tile_size = stoi(argv[++i]);
+            } else if (arg == "--halo" && has_value) {
+                tiled_options.halo = stoi(argv[++i]);
+            } else if (arg == "--color-space" && has_value) {
+                string space = argv[++i];
+                if (space == "lab") {
+                    params.kmeans_color_space = KMEANS_LAB;
+                } else if (space == "bgr") {
+                    params.kmeans_color_space = KMEANS_BGR;
+                } else {
+                    cerr << "Unknown color space: " << space << endl;
+                    return 1;
+                }
+            } else if (arg == "--smoothing" && has_value) {
+                string filter = argv[++i];
+                if (filter == "grid") {
+                    params.smoothing_filter = SMOOTHING_BILATERAL_GRID;
+                } else if (filter == "exact") {
+                    params.smoothing_filter = SMOOTHING_BILATERAL;
+                } else {
+                    cerr << "Unknown smoothing filter: " << filter << endl;
+                    return 1;
+                }
+            } else if (arg == "--spatial-weight" && has_value) {
+                params.kmeans_spatial_weight = stod(argv[++i]);
+            } else if (arg == "--tolerance" && has_value) {
+                params.region_growing_threshold = stoi(argv[++i]);
+            } else if (arg == "--seeds" && has_value) {
+                stringstream list(argv[++i]);
+                string pair;
+                while (getline(list, pair, ';')) {
+                    size_t comma = pair.find(',');
+                    if (comma == string::npos) {
+                        cerr << "Invalid seed (expected x,y): " << pair << endl;
+                        return 1;
+                    }
+                    params.region_seeds.push_back(Point(stoi(pair.substr(0, comma)), stoi(pair.substr(comma + 1))));
+                }
+            } else if (arg == "--floating-range") {
+                params.region_floating_range = true;
+            } else if (arg == "--graph-cut-cleanup") {
+                params.grid_cut_refine = true;
+            } else if (arg == "--graph-cut-side" && has_value) {
+                params.graph_cut_max_side = stoi(argv[++i]);
+            } else if (arg == "--gvf-side" && has_value) {
+                params.gvf_max_side = stoi(argv[++i]);
+            } else if (arg == "--list" && has_value) {
+                ifstream list(argv[++i]);
+                if (!list) {
+                    cerr << "Cannot open input list " << argv[i] << endl;
+                    return 1;
+                }
+                string line;
+                while (getline(list, line)) {
+                    if (!line.empty()) {
+                        collect_batch_inputs(line, inputs);
+                    }
+                }
+            } else if (arg.rfind("--", 0) == 0) {
+                cerr << "Unknown or incomplete option: " << arg << endl;
+                print_batch_usage();
+                return 1;
+            } else {
+                collect_batch_inputs(arg, inputs);
+            }
+        }
+    } catch (const exception& e) {
+        cerr << "Invalid arguments: " << e.what() << endl;
+        return 1;
+    }
+
+    const AlgorithmName *selected = NULL;
+    for (const AlgorithmName& entry : ALGORITHM_NAMES) {
+        if (algorithm == entry.cli_name || algorithm == entry.display_name) {
+            selected = &entry;
+        }
+    }
+    for (const AlgorithmName& entry : TILED_STAGE_NAMES) {
+        if (tiled && (algorithm == entry.cli_name || algorithm == entry.display_name)) {
+            selected = &entry;
+        }
+    }
+    if (selected == NULL) {
+        cerr << (algorithm.empty() ? "No algorithm given" : "Unknown algorithm: " + algorithm) << endl;
+        print_batch_usage();
+        return 1;
+    }
+    if (inputs.empty()) {
+        cerr << "No input images" << endl;
+        return 1;
+    }
+    if (!output_dir.empty()) {
+        filesystem::create_directories(output_dir);
+    }
+
+    // Parallelism comes from the image pool (or the tile pool in tiled mode);
+    // keep OpenCV's own threads from oversubscribing
+    if (tiled) {
+        tiled_options.threads = num_threads;
+    } else {
+        num_threads = min(num_threads, (int)inputs.size());
+    }
+    if (num_threads > 1) {
+        setNumThreads(1);
+    }
+
+    vector<BatchResult> results(inputs.size());
+    atomic<size_t> next_input(0);
+
+    // Stage samples per worker thread, only collected when tracing
+    vector<vector<StageSample>> trace_threads(tiled ? 1 : num_threads);
+
+    // Tiled mode: one image at a time, with the threads spread over its tiles
+    auto tiled_worker = [&]() {
+        unique_ptr<StageRecording> recording;
+        if (!trace_path.empty()) {
+            recording.reset(new StageRecording(trace_threads[0]));
+        }
+        for (size_t i = 0; i < inputs.size(); i++) {
+            BatchResult& result = results[i];
+            auto start_time = chrono::high_resolution_clock::now();
+            try {
+                StageTimer image_span(inputs[i].c_str());
+                string out;
+                if (!output_dir.empty()) {
+                    out = (filesystem::path(output_dir) /
+                           (filesystem::path(inputs[i]).stem().string() + "_" + selected->cli_name + ".pnm")).string();
+                }
+                tiledSegmentation(selected->display_name, inputs[i], out, tiled_options, params);
+                result.ok = true;
+            } catch (const exception& e) {
+                result.error = e.what();
+            }
+            auto end_time = chrono::high_resolution_clock::now();
+            result.total_ms = chrono::duration<double, milli>(end_time - start_time).count();
+            result.segment_ms = result.total_ms; // Reading and writing are interleaved with the tiles
+        }
+    };
+
+    auto worker = [&](int thread_index) {
+        SegmentationContext context(params);
+        unique_ptr<StageRecording> recording;
+        if (!trace_path.empty()) {
+            recording.reset(new StageRecording(trace_threads[thread_index]));
+        }
+        for (size_t i = next_input++; i < inputs.size(); i = next_input++) {
+            BatchResult& result = results[i];
+            auto start_time = chrono::high_resolution_clock::now();
+            try {
+                StageTimer image_span(inputs[i].c_str());
+                Mat image = imread(inputs[i], IMREAD_COLOR);
+                if (image.empty()) {
+                    throw cv::Exception(0, "Failed to load image", "run_batch", __FILE__, __LINE__);
+                }
+
+                string algorithm_info, threshold_info;
+                auto segment_start = chrono::high_resolution_clock::now();
+                Mat processed_image = runSegmentation(selected->display_name, image, context, algorithm_info,
+                                                      threshold_info);
+                auto segment_end = chrono::high_resolution_clock::now();
+                result.segment_ms = chrono::duration<double, milli>(segment_end - segment_start).count();
+
+                if (!output_dir.empty()) {
+                    filesystem::path out = filesystem::path(output_dir) /
+                        (filesystem::path(inputs[i]).stem().string() + "_" + selected->cli_name + ".png");
+                    if (!imwrite(out.string(), processed_image)) {
+                        throw cv::Exception(0, "Failed to write " + out.string(), "run_batch", __FILE__, __LINE__);
+                    }
+                }
+                result.ok = true;
+            } catch (const exception& e) {
+                result.error = e.what();
+            }
+            auto end_time = chrono::high_resolution_clock::now();
+            result.total_ms = chrono::duration<double, milli>(end_time - start_time).count();
+        }
+    };
+
+    auto batch_start = chrono::high_resolution_clock::now();
+    if (tiled) {
+        tiled_worker();
+    } else {
+        vector<thread> pool;
+        for (int t = 0; t < num_threads; t++) {
+            pool.emplace_back(worker, t);
+        }
+        for (thread& t : pool) {
+            t.join();
+        }
+    }
+    auto batch_end = chrono::high_resolution_clock::now();
+    double wall_s = chrono::duration<double>(batch_end - batch_start).count();
+
+    // Per-image timings followed by aggregate throughput
+    int failures = 0;
+    double segment_total_ms = 0;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        const BatchResult& result = results[i];
+        if (result.ok) {
+            segment_total_ms += result.segment_ms;
+            printf("%-60s %10.2f ms  (total %.2f ms)\n", inputs[i].c_str(), result.segment_ms, result.total_ms);
+        } else {
+            failures++;
+            printf("%-60s FAILED: %s\n", inputs[i].c_str(), result.error.c_str());
+        }
+    }
+
+    int processed = (int)inputs.size() - failures;
+    printf("\nAlgorithm: %s, threads: %d\n", selected->display_name, num_threads);
+    printf("Images: %d processed, %d failed\n", processed, failures);
+    printf("Wall time: %.2f s\n", wall_s);
+    if (processed > 0) {
+        printf("Mean segmentation time: %.2f ms\n", segment_total_ms / processed);
+    }
+    printf("Throughput: %.2f images/s\n", wall_s > 0 ? processed / wall_s : 0.0);
+
+    if (!trace_path.empty()) {
+        if (write_trace(trace_path, trace_threads)) {
+            printf("Trace written to %s\n", trace_path.c_str());
+        } else {
+            cerr << "Failed to write trace " << trace_path << endl;
+        }
+    }
+
+    return failures == 0 ? 0 : 2;
+}
+
+// Main function (left out when the file is compiled into the benchmark)
+#ifndef SEGMENTATION_NO_MAIN
+int main(int argc, char **argv) {
+    // Headless batch mode skips GTK entirely
+    if (argc > 1 && strcmp(argv[1], "--batch") == 0) {
+        return run_batch(argc, argv);
+    }
+
+    GtkApplication *app;
+    int status;
+
+    app = gtk_application_new("org.gtk.example", G_APPLICATION_DEFAULT_FLAGS);
+    g_signal_connect(app, "activate", G_CALLBACK(activate), NULL);
+    status = g_application_run(G_APPLICATION(app), argc, argv);
+    segmentation_worker.stop();
+    g_object_unref(app);
+
+    return status;
+}
+#endif
+
+// Resample a closed contour to points evenly spaced along its perimeter, so
+// the snake's internal energy weighs every stretch of the curve alike
+static vector<Point2f> resampleClosedContour(const vector<Point>& contour, double spacing) {
+    vector<double> cumulative(contour.size() + 1, 0.0);
+    for (size_t i = 0; i < contour.size(); i++) {
+        Point d = contour[(i + 1) % contour.size()] - contour[i];
+        cumulative[i + 1] = cumulative[i] + sqrt((double)d.x * d.x + (double)d.y * d.y);
+    }
+    double perimeter = cumulative.back();
+    int count = max(8, cvRound(perimeter / spacing));
+
+    vector<Point2f> points(count);
+    size_t segment = 0;
+    for (int k = 0; k < count; k++) {
+        double position = perimeter * k / count;
+        while (segment + 1 < contour.size() && cumulative[segment + 1] <= position) {
+            segment++;
+        }
+        double length = cumulative[segment + 1] - cumulative[segment];
+        double t = length > 0 ? (position - cumulative[segment]) / length : 0.0;
+        Point2f a = contour[segment], b = contour[(segment + 1) % contour.size()];
+        points[k] = a + (b - a) * (float)t;
+    }
+    return points;
+}
+
+// Eigenvalues of the implicit snake system I + tau * (alpha * D2 + beta * D4),
+// where D2 and D4 are the cyclic second and fourth difference matrices. The
+// system is cyclic pentadiagonal with constant bands, i.e. circulant, so the
+// DFT diagonalizes it exactly and these n values are its whole factorization.
+static vector<float> snakeSystemEigenvalues(int count, float alpha, float beta, float timeStep) {
+    vector<float> eigenvalues(count);
+    for (int k = 0; k < count; k++) {
+        double d2 = 2.0 - 2.0 * cos(2.0 * CV_PI * k / count); // Eigenvalue of D2
+        eigenvalues[k] = (float)(1.0 + timeStep * (alpha * d2 + beta * d2 * d2));
+    }
+    return eigenvalues;
+}
+
+// Solve the factored snake system in place. points is a 1 x n CV_32FC2 row
+// holding the right-hand side, read as complex numbers x + iy; spectrum is
+// scratch space reused between steps.
+static void solveSnakeSystem(Mat& points, const vector<float>& eigenvalues, Mat& spectrum) {
+    dft(points, spectrum);
+    Vec2f *coefficients = spectrum.ptr<Vec2f>(0);
+    for (int k = 0; k < spectrum.cols; k++) {
+        coefficients[k] *= 1.0f / eigenvalues[k];
+    }
+    dft(spectrum, points, DFT_INVERSE | DFT_SCALE);
+}
+
+// Bilinear sample of a CV_32FC2 force field at a sub-pixel position
+static Vec2f sampleForce(const Mat& force, Point2f p) {
+    float x = min(max(p.x, 0.0f), (float)(force.cols - 1));
+    float y = min(max(p.y, 0.0f), (float)(force.rows - 1));
+    int x0 = min((int)x, max(force.cols - 2, 0));
+    int y0 = min((int)y, max(force.rows - 2, 0));
+    int x1 = min(x0 + 1, force.cols - 1), y1 = min(y0 + 1, force.rows - 1);
+    float fx = x - x0, fy = y - y0;
+    const Vec2f *top = force.ptr<Vec2f>(y0), *bottom = force.ptr<Vec2f>(y1);
+    return (top[x0] * (1 - fx) + top[x1] * fx) * (1 - fy) + (bottom[x0] * (1 - fx) + bottom[x1] * fx) * fy;
+}
+
+// Active Contours Segmentation Implementation
+Mat activeContoursSegmentation(const Mat& image, const SegmentationContext& context) {
+    StageTimer stages("activeContoursSegmentation");
+    shared_ptr<PreprocessCache> cache = preprocessFor(image, *context.workspace);
+
+    // Step 1: Edge Detection
+    stages.begin("Canny edges");
+    Mat edges = cache->cannyEdges();
+
+    // Step 2: Contour Finding
+    stages.begin("Find contours");
+    vector<vector<Point>> contours;
+    findContours(edges, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
+
+    if (contours.empty()) {
+        throw cv::Exception(0, "No contours found in the image", "activeContoursSegmentation", __FILE__, __LINE__);
+    }
+
+    // Step 3: Select Largest Contour
+    int largest_contour_idx = 0;
+    double largest_area = 0;
+    for (size_t i = 0; i < contours.size(); i++) {
+        double area = contourArea(contours[i]);
+        if (area > largest_area) {
+            largest_area = area;
+            largest_contour_idx = i;
+        }
+    }
+
+    // Step 4: External force, the Gradient Vector Flow of the edges. Its wide
+    // capture range lets the snake start from the contour's convex hull and
+    // still be drawn into concavities.
+    stages.begin("Gradient vector flow");
+    Mat force = cache->gradientVectorFlow(context.params.gvf_max_side);
+    const Point2f forceScale((float)force.cols / image.cols, (float)force.rows / image.rows);
+    vector<Point> hull;
+    convexHull(contours[largest_contour_idx], hull);
+
+    // Step 5: Snake Evolution. Semi-implicit Kass steps: the internal energy
+    // is solved implicitly, (I + tau A) x' = x + tau gamma F(x), which is
+    // stable for any step size, so the iteration limit is rarely reached.
+    stages.begin("Snake evolution");
+    const SegmentationParams& params = context.params;
+    vector<Point2f> snake = resampleClosedContour(hull, ACTIVE_CONTOURS_SPACING);
+    const int count = (int)snake.size();
+    const float tau = params.active_contours_time_step;
+    vector<float> eigenvalues = snakeSystemEigenvalues(count, params.active_contours_alpha,
+                                                       params.active_contours_beta, tau);
+    Mat points(1, count, CV_32FC2), spectrum;
+    for (int iter = 0; iter < params.active_contours_iterations; iter++) {
+        Vec2f *row = points.ptr<Vec2f>(0);
+        for (int i = 0; i < count; i++) {
+            row[i] = Vec2f(snake[i].x, snake[i].y) + sampleForce(force, Point2f(snake[i].x * forceScale.x, snake[i].y * forceScale.y)) * (tau * params.active_contours_gamma);
+        }
+        solveSnakeSystem(points, eigenvalues, spectrum);
+
+        row = points.ptr<Vec2f>(0);
+        float moved = 0;
+        for (int i = 0; i < count; i++) {
+            Point2f next(min(max(row[i][0], 0.0f), (float)(image.cols - 1)),
+                         min(max(row[i][1], 0.0f), (float)(image.rows - 1)));
+            moved = max(moved, max(fabs(next.x - snake[i].x), fabs(next.y - snake[i].y)));
+            snake[i] = next;
+        }
+        if (moved < params.active_contours_tolerance) {
+            break;
+        }
+    }
+
+    // Step 6: Visualization
+    stages.begin("Draw snake");
+    Mat result = image.clone();
+    for (int i = 0; i < count; i++) {
+        int next = (i == count - 1) ? 0 : i + 1;
+        line(result, Point(cvRound(snake[i].x), cvRound(snake[i].y)),
+             Point(cvRound(snake[next].x), cvRound(snake[next].y)), Scalar(0, 255, 0), 2);
+    }
+
+    return result;
+}
+
+// Chan-Vese level set evolved on a sparse field (after Whitaker). phi > 0 is
+// inside. Only the active layer - pixels with a 4-neighbour on the other side
+// of the zero level set - moves; two layers around it carry approximate
+// distances for the curvature term and every other pixel holds +/-FAR_VALUE. An
+// iteration only touches this band, so its cost grows with the total boundary
+// length rather than the image area, and all objects evolve, split and merge
+// together.
+class SparseFieldLevelSet {
+public:
+    // Start from a mask (non-zero inside) over an 8-bit intensity image
+    void init(const Mat& intensity, const Mat& inside) {
+        rows = intensity.rows;
+        cols = intensity.cols;
+        intensity_.assign(rows * cols, 0.0f);
+        phi_.assign(rows * cols, 0.0f);
+        label_.assign(rows * cols, OUTSIDE);
+        sumInside = sumTotal = 0;
+        countInside = 0;
+        for (int y = 0; y < rows; y++) {
+            const uchar *src = intensity.ptr<uchar>(y), *in = inside.ptr<uchar>(y);
+            for (int x = 0; x < cols; x++) {
+                float value = src[x] / 255.0f;
+                intensity_[y * cols + x] = value;
+                phi_[y * cols + x] = in[x] ? FAR_VALUE : -FAR_VALUE;
+                sumTotal += value;
+                if (in[x]) {
+                    sumInside += value;
+                    countInside++;
+                }
+            }
+        }
+
+        active_.clear();
+        for (int i = 0; i < rows * cols; i++) {
+            if (crossesFront(i)) {
+                active_.push_back(i);
+            }
+        }
+        for (int i : active_) {
+            phi_[i] = phi_[i] > 0 ? 0.5f : -0.5f;
+        }
+        buildLayers();
+    }
+
+    // One Chan-Vese step with curvature weight mu and data weight lambda.
+    // Returns the number of pixels that changed side.
+    int step(float mu, float lambda) {
+        const int total = rows * cols;
+        float c1 = countInside > 0 ? (float)(sumInside / countInside) : 0.0f;
+        float c2 = countInside < total ? (float)((sumTotal - sumInside) / (total - countInside)) : 0.0f;
+
+        // Step 1: Speed of every active pixel, in parallel over row blocks
+        // (the active list is sorted, so contiguous chunks are row blocks)
+        forces_.resize(active_.size());
+        parallel_for_(Range(0, (int)active_.size()), [&](const Range& range) {
+            for (int k = range.start; k < range.end; k++) {
+                int i = active_[k];
+                float value = intensity_[i];
+                float data = (value - c2) * (value - c2) - (value - c1) * (value - c1);
+                forces_[k] = mu * curvature(i % cols, i / cols) + lambda * data;
+            }
+        });
+
+        // Step 2: Move the front at most half a pixel
+        float maxForce = 0;
+        for (float force : forces_) {
+            maxForce = max(maxForce, fabs(force));
+        }
+        if (maxForce == 0) {
+            return 0;
+        }
+        float dt = 0.5f / maxForce;
+        int flips = 0;
+        for (size_t k = 0; k < active_.size(); k++) {
+            int i = active_[k];
+            float next = min(1.0f, max(-1.0f, phi_[i] + dt * forces_[k]));
+            if ((next > 0) != (phi_[i] > 0)) {
+                double sign = next > 0 ? 1.0 : -1.0;
+                sumInside += sign * intensity_[i];
+                countInside += next > 0 ? 1 : -1;
+                flips++;
+            }
+            phi_[i] = next;
+        }
+
+        // Step 3: New active layer among the old one and its neighbours
+        candidates_.clear();
+        for (int i : active_) {
+            candidates_.push_back(i);
+            int x = i % cols, y = i / cols;
+            if (x > 0) candidates_.push_back(i - 1);
+            if (x < cols - 1) candidates_.push_back(i + 1);
+            if (y > 0) candidates_.push_back(i - cols);
+            if (y < rows - 1) candidates_.push_back(i + cols);
+        }
+        sort(candidates_.begin(), candidates_.end());
+        candidates_.erase(unique(candidates_.begin(), candidates_.end()), candidates_.end());
+        vector<int> nextActive;
+        for (int i : candidates_) {
+            if (crossesFront(i)) {
+                if (label_[i] != ACTIVE) {
+                    phi_[i] = phi_[i] > 0 ? 0.5f : -0.5f;
+                }
+                nextActive.push_back(i);
+            }
+        }
+        active_.swap(nextActive);
+        buildLayers();
+        return flips;
+    }
+
+    // Inside pixels as an 8-bit mask (255 inside)
+    Mat insideMask() const {
+        Mat mask(rows, cols, CV_8UC1);
+        for (int y = 0; y < rows; y++) {
+            uchar *dst = mask.ptr<uchar>(y);
+            for (int x = 0; x < cols; x++) {
+                dst[x] = phi_[y * cols + x] > 0 ? 255 : 0;
+            }
+        }
+        return mask;
+    }
+
+private:
+    enum Label : uchar { OUTSIDE, ACTIVE, LAYER1, LAYER2 };
+    static constexpr float FAR_VALUE = 3.0f;
+
+    bool crossesFront(int i) const {
+        int x = i % cols, y = i / cols;
+        bool inside = phi_[i] > 0;
+        return (x > 0 && (phi_[i - 1] > 0) != inside) || (x < cols - 1 && (phi_[i + 1] > 0) != inside) ||
+               (y > 0 && (phi_[i - cols] > 0) != inside) || (y < rows - 1 && (phi_[i + cols] > 0) != inside);
+    }
+
+    float phiAt(int x, int y) const {
+        return phi_[min(max(y, 0), rows - 1) * cols + min(max(x, 0), cols - 1)];
+    }
+
+    // Mean curvature of the level set through (x, y), clamped to [-1, 1]
+    float curvature(int x, int y) const {
+        float c = phiAt(x, y), l = phiAt(x - 1, y), r = phiAt(x + 1, y), u = phiAt(x, y - 1), d = phiAt(x, y + 1);
+        float dx = 0.5f * (r - l), dy = 0.5f * (d - u);
+        float dxx = r - 2 * c + l, dyy = d - 2 * c + u;
+        float dxy = 0.25f * (phiAt(x + 1, y + 1) - phiAt(x + 1, y - 1) - phiAt(x - 1, y + 1) + phiAt(x - 1, y - 1));
+        float gradient = dx * dx + dy * dy;
+        if (gradient < 1e-6f) {
+            return 0;
+        }
+        float kappa = (dxx * dy * dy - 2 * dx * dy * dxy + dyy * dx * dx) / (gradient * sqrt(gradient));
+        return min(1.0f, max(-1.0f, kappa));
+    }
+
+    // Relabel the band around the active layer and give the two outer layers
+    // their distance values; pixels that left the band go back to +/-FAR_VALUE
+    void buildLayers() {
+        for (int i : band_) {
+            label_[i] = OUTSIDE;
+        }
+        vector<int> previous;
+        previous.swap(band_);
+        for (int i : active_) {
+            label_[i] = ACTIVE;
+            band_.push_back(i);
+        }
+
+        size_t begin = 0;
+        for (uchar layer = LAYER1; layer <= LAYER2; layer++) {
+            size_t end = band_.size();
+            for (size_t k = begin; k < end; k++) {
+                int i = band_[k];
+                int x = i % cols, y = i / cols;
+                int neighbours[4] = {x > 0 ? i - 1 : -1, x < cols - 1 ? i + 1 : -1,
+                                     y > 0 ? i - cols : -1, y < rows - 1 ? i + cols : -1};
+                for (int n : neighbours) {
+                    if (n < 0) {
+                        continue;
+                    }
+                    float distance = fabs(phi_[i]) + 1;
+                    if (label_[n] == OUTSIDE) {
+                        label_[n] = layer;
+                        phi_[n] = phi_[n] > 0 ? distance : -distance;
+                        band_.push_back(n);
+                    } else if (label_[n] == layer && distance < fabs(phi_[n])) {
+                        phi_[n] = phi_[n] > 0 ? distance : -distance;
+                    }
+                }
+            }
+            begin = end;
+        }
+
+        for (int i : previous) {
+            if (label_[i] == OUTSIDE) {
+                phi_[i] = phi_[i] > 0 ? FAR_VALUE : -FAR_VALUE;
+            }
+        }
+    }
+
+    int rows = 0, cols = 0;
+    vector<float> intensity_, phi_, forces_;
+    vector<uchar> label_;
+    vector<int> active_, band_, candidates_;
+    double sumInside = 0, sumTotal = 0;
+    long countInside = 0;
+};
+
+// Level Set Segmentation Implementation (Chan-Vese on a sparse field)
+Mat levelSetSegmentation(const Mat& image, const SegmentationContext& context) {
+    StageTimer stages("levelSetSegmentation");
+    const SegmentationParams& params = context.params;
+    shared_ptr<PreprocessCache> cache = preprocessFor(image, *context.workspace);
+
+    // Step 1: Initial partition from Otsu's threshold of the smoothed image
+    stages.begin("Initial partition");
+    Mat inside;
+    threshold(cache->gaussian(), inside, 0, 255, THRESH_BINARY | THRESH_OTSU);
+    SparseFieldLevelSet levelSet;
+    levelSet.init(cache->gray(), inside);
+
+    // Step 2: Evolve until the front stops moving
+    stages.begin("Level set evolution");
+    int still = 0;
+    for (int iter = 0; iter < params.level_set_iterations && still < LEVEL_SET_STALL_ITERATIONS; iter++) {
+        still = levelSet.step(params.level_set_mu, params.level_set_lambda) == 0 ? still + 1 : 0;
+    }
+
+    // Step 3: Visualization, every object's boundary
+    stages.begin("Draw contours");
+    vector<vector<Point>> contours;
+    findContours(levelSet.insideMask(), contours, RETR_LIST, CHAIN_APPROX_SIMPLE);
+    Mat result = cache->bgr().clone();
+    drawContours(result, contours, -1, Scalar(0, 255, 0), 2);
+
+    return result;
+}
+
+// Exact Lloyd K-Means over a 256-bin intensity histogram. Every pixel of one
+// intensity lands in the same cluster, so iterating over weighted bins gives
+// the clusters cv::kmeans would find over the pixels, at a cost independent of
+// image size. Follows cv::kmeans: random centers inside the data range, the
+// same termination test and the best compactness over all attempts. Returns
+// the value every intensity maps to.
+static vector<uchar> histogramKMeans(const double histogram[256], int clusters, int attempts, TermCriteria criteria) {
+    int minValue = 0, maxValue = 255;
+    while (minValue < 255 && histogram[minValue] == 0) minValue++;
+    while (maxValue > 0 && histogram[maxValue] == 0) maxValue--;
+    if (minValue > maxValue) {
+        return vector<uchar>(256, 0); // Empty image
+    }
+
+    double epsilon = max(criteria.epsilon, 0.0);
+    epsilon *= epsilon;
+    int maxIterations = max(criteria.maxCount, 2);
+    RNG& rng = theRNG();
+
+    vector<double> centers(clusters), oldCenters(clusters), sums(clusters), counts(clusters);
+    int labels[256] = {0};
+    vector<uchar> best(256, 0);
+    double bestCompactness = DBL_MAX;
+
+    for (int attempt = 0; attempt < attempts; attempt++) {
+        double compactness = 0;
+        double maxShift = DBL_MAX;
+        for (int iter = 0;;) {
+            swap(centers, oldCenters);
+
+            if (iter == 0) {
+                // Random centers in the data range, widened like cv::kmeans does
+                double range = maxValue - minValue;
+                for (int k = 0; k < clusters; k++) {
+                    centers[k] = (rng.uniform(0.f, 1.f) * 3.0f - 1.0f) * range + minValue;
+                }
+            } else {
+                // Step 1: Weighted means of the bins in each cluster
+                fill(sums.begin(), sums.end(), 0.0);
+                fill(counts.begin(), counts.end(), 0.0);
+                for (int v = minValue; v <= maxValue; v++) {
+                    sums[labels[v]] += histogram[v] * v;
+                    counts[labels[v]] += histogram[v];
+                }
+
+                // Step 2: Reseed empty clusters with the farthest bin of the largest one
+                for (int k = 0; k < clusters; k++) {
+                    if (counts[k] != 0) {
+                        continue;
+                    }
+                    int largest = (int)(max_element(counts.begin(), counts.end()) - counts.begin());
+                    double largestCenter = sums[largest] / counts[largest];
+                    int farthest = -1;
+                    for (int v = minValue; v <= maxValue; v++) {
+                        if (histogram[v] != 0 && labels[v] == largest &&
+                            (farthest < 0 || fabs(v - largestCenter) > fabs(farthest - largestCenter))) {
+                            farthest = v;
+                        }
+                    }
+                    if (farthest < 0 || counts[largest] == histogram[farthest]) {
+                        continue; // A single-bin cluster cannot be split
+                    }
+                    sums[largest] -= histogram[farthest] * farthest;
+                    counts[largest] -= histogram[farthest];
+                    sums[k] = histogram[farthest] * farthest;
+                    counts[k] = histogram[farthest];
+                    labels[farthest] = k;
+                }
+
+                maxShift = 0;
+                for (int k = 0; k < clusters; k++) {
+                    if (counts[k] != 0) {
+                        centers[k] = sums[k] / counts[k];
+                    } else {
+                        centers[k] = oldCenters[k];
+                    }
+                    double shift = centers[k] - oldCenters[k];
+                    maxShift = max(maxShift, shift * shift);
+                }
+            }
+
+            if (++iter == maxIterations || maxShift <= epsilon) {
+                break;
+            }
+
+            // Step 3: Assign every bin to its nearest center
+            compactness = 0;
+            for (int v = minValue; v <= maxValue; v++) {
+                int nearest = 0;
+                double nearestDistance = DBL_MAX;
+                for (int k = 0; k < clusters; k++) {
+                    double d = (v - centers[k]) * (v - centers[k]);
+                    if (d < nearestDistance) {
+                        nearestDistance = d;
+                        nearest = k;
+                    }
+                }
+                labels[v] = nearest;
+                compactness += histogram[v] * nearestDistance;
+            }
+        }
+
+        if (compactness < bestCompactness) {
+            bestCompactness = compactness;
+            for (int v = 0; v < 256; v++) {
+                best[v] = saturate_cast<uchar>((int)(float)centers[labels[v]]);
+            }
+        }
+    }
+
+    return best;
+}
+
+// K-Means Segmentation Implementation
+Mat kMeansSegmentation(const Mat& image, const SegmentationContext& context) {
+    StageTimer stages("kMeansSegmentation");
+
+    // Convert to grayscale if not already
+    stages.begin("Grayscale");
+    shared_ptr<PreprocessCache> cache = preprocessFor(image, *context.workspace);
+    Mat gray = cache->gray();
+
+    // Intensity histogram: the only pass over the pixels besides the final LUT
+    stages.begin("Histogram");
+    Mat histogram = cache->histogram();
+
+    // Apply k-means clustering
+    stages.begin("K-Means iterations");
+    vector<uchar> clusterValues = histogramKMeans(histogram.ptr<double>(), context.params.kmeans_clusters, 3,
+                                                  context.params.kmeansCriteria());
+
+    stages.begin("Apply labels");
+    Mat segmented;
+    LUT(gray, Mat(1, 256, CV_8U, clusterValues.data()), segmented);
+
+    // Two clusters can be cleaned up with a graph cut on the colours
+    if (context.params.grid_cut_refine && context.params.kmeans_clusters == 2) {
+        stages.begin("Graph cut clean-up");
+        uchar low = *min_element(clusterValues.begin(), clusterValues.end());
+        uchar high = *max_element(clusterValues.begin(), clusterValues.end());
+        Mat bright;
+        compare(segmented, Scalar(high), bright, CMP_EQ);
+        Mat refined = refineMaskWithGridCut(cache->bgr(), bright, context.params.grid_cut_smoothness,
+                                            context.params.grid_cut_connectivity);
+        segmented.setTo(Scalar(low));
+        segmented.setTo(Scalar(high), refined);
+    }
+
+    stages.begin("Color map");
+    Mat colored;
+    applyColorMap(segmented, colored, COLORMAP_JET);
+
+    return colored;
+}
+
+// Squared distances from one feature vector to every center. Centers are
+// stored dimension-major (centers[d * clusters + k]) so the inner loop runs
+// over clusters on contiguous floats and vectorizes.
+static inline void centerDistances(const float *point, const float *centers, int dims, int clusters, float *distances) {
+    for (int k = 0; k < clusters; k++) {
+        distances[k] = 0;
+    }
+    for (int d = 0; d < dims; d++) {
+        const float value = point[d];
+        const float *column = centers + d * clusters;
+        for (int k = 0; k < clusters; k++) {
+            float diff = value - column[k];
+            distances[k] += diff * diff;
+        }
+    }
+}
+
+// Nearest center of one feature vector; also returns the two smallest distances
+static inline int nearestCenter(const float *point, const float *centers, int dims, int clusters, float *distances,
+                                float& nearest, float& second) {
+    centerDistances(point, centers, dims, clusters, distances);
+    int best = 0;
+    nearest = FLT_MAX;
+    second = FLT_MAX;
+    for (int k = 0; k < clusters; k++) {
+        if (distances[k] < nearest) {
+            second = nearest;
+            nearest = distances[k];
+            best = k;
+        } else if (distances[k] < second) {
+            second = distances[k];
+        }
+    }
+    return best;
+}
+
+// K-Means over the rows of samples (CV_32F, one point per row) using
+// Hamerly's bounds: every point keeps an upper bound to its own center and a
+// lower bound to all others, and only points whose bounds overlap get their
+// distances recomputed. Centers start from k-means++ seeding. Returns the
+// centers dimension-major, as centerDistances expects.
+static vector<float> hamerlyKMeans(const Mat& samples, int clusters, TermCriteria criteria) {
+    CV_Assert(samples.type() == CV_32FC1 && samples.isContinuous() && samples.rows >= clusters);
+    const int count = samples.rows;
+    const int dims = samples.cols;
+    const float *points = samples.ptr<float>();
+    RNG& rng = theRNG();
+
+    // Step 1: k-means++ seeding
+    vector<float> centers(dims * clusters);
+    vector<double> seedDistance(count, DBL_MAX);
+    int chosen = rng.uniform(0, count);
+    for (int k = 0; k < clusters; k++) {
+        for (int d = 0; d < dims; d++) {
+            centers[d * clusters + k] = points[chosen * dims + d];
+        }
+        if (k + 1 == clusters) {
+            break;
+        }
+        double total = 0;
+        for (int i = 0; i < count; i++) {
+            double dist = 0;
+            for (int d = 0; d < dims; d++) {
+                double diff = points[i * dims + d] - centers[d * clusters + k];
+                dist += diff * diff;
+            }
+            seedDistance[i] = min(seedDistance[i], dist);
+            total += seedDistance[i];
+        }
+        double target = rng.uniform(0.0, 1.0) * total;
+        chosen = count - 1;
+        for (int i = 0; i < count; i++) {
+            target -= seedDistance[i];
+            if (target <= 0) {
+                chosen = i;
+                break;
+            }
+        }
+    }
+
+    // Step 2: Initial assignment with exact bounds
+    vector<int> labels(count);
+    vector<float> upper(count), lower(count), distances(clusters);
+    vector<double> sums(dims * clusters, 0.0);
+    vector<int> sizes(clusters, 0);
+    for (int i = 0; i < count; i++) {
+        float nearest, second;
+        const float *point = points + i * dims;
+        labels[i] = nearestCenter(point, centers.data(), dims, clusters, distances.data(), nearest, second);
+        upper[i] = sqrt(nearest);
+        lower[i] = sqrt(second);
+        sizes[labels[i]]++;
+        for (int d = 0; d < dims; d++) {
+            sums[d * clusters + labels[i]] += point[d];
+        }
+    }
+
+    vector<float> shift(clusters), halfGap(clusters);
+    const double epsilon = max(criteria.epsilon, 0.0);
+    for (int iter = 0; iter < max(criteria.maxCount, 1); iter++) {
+        // Step 3: Move centers to the mean of their points
+        float maxShift = 0, secondShift = 0;
+        int movedMost = 0;
+        for (int k = 0; k < clusters; k++) {
+            double moved = 0;
+            if (sizes[k] > 0) {
+                for (int d = 0; d < dims; d++) {
+                    float updated = (float)(sums[d * clusters + k] / sizes[k]);
+                    double diff = updated - centers[d * clusters + k];
+                    moved += diff * diff;
+                    centers[d * clusters + k] = updated;
+                }
+            }
+            shift[k] = (float)sqrt(moved);
+            if (shift[k] > maxShift) {
+                secondShift = maxShift;
+                maxShift = shift[k];
+                movedMost = k;
+            } else if (shift[k] > secondShift) {
+                secondShift = shift[k];
+            }
+        }
+        if (maxShift <= epsilon) {
+            break;
+        }
+
+        // Step 4: Loosen the bounds by how far the centers moved
+        for (int i = 0; i < count; i++) {
+            upper[i] += shift[labels[i]];
+            lower[i] -= labels[i] == movedMost ? secondShift : maxShift;
+        }
+
+        // Step 5: Half the distance from each center to its closest neighbour
+        for (int k = 0; k < clusters; k++) {
+            float closest = FLT_MAX;
+            for (int j = 0; j < clusters; j++) {
+                if (j == k) {
+                    continue;
+                }
+                float dist = 0;
+                for (int d = 0; d < dims; d++) {
+                    float diff = centers[d * clusters + k] - centers[d * clusters + j];
+                    dist += diff * diff;
+                }
+                closest = min(closest, dist);
+            }
+            halfGap[k] = 0.5f * sqrt(closest);
+        }
+
+        // Step 6: Reassign only the points whose bounds no longer rule out a change
+        for (int i = 0; i < count; i++) {
+            int label = labels[i];
+            float bound = max(halfGap[label], lower[i]);
+            if (upper[i] <= bound) {
+                continue;
+            }
+
+            const float *point = points + i * dims;
+            float own = 0;
+            for (int d = 0; d < dims; d++) {
+                float diff = point[d] - centers[d * clusters + label];
+                own += diff * diff;
+            }
+            upper[i] = sqrt(own);
+            if (upper[i] <= bound) {
+                continue;
+            }
+
+            float nearest, second;
+            int best = nearestCenter(point, centers.data(), dims, clusters, distances.data(), nearest, second);
+            upper[i] = sqrt(nearest);
+            lower[i] = sqrt(second);
+            if (best != label) {
+                sizes[label]--;
+                sizes[best]++;
+                for (int d = 0; d < dims; d++) {
+                    sums[d * clusters + label] -= point[d];
+                    sums[d * clusters + best] += point[d];
+                }
+                labels[i] = best;
+            }
+        }
+    }
+
+    return centers;
+}
+
+// Fitted colour K-Means model. Pixel positions are measured in the full
+// image, so every tile of a tiled run can share one model.
+struct ColorKMeansModel {
+    KMeansColorSpace color_space = KMEANS_LAB;
+    int clusters = 0;
+    int dims = 3;
+    double spatial_scale = 0; // Position weight scaled to the colour range
+    vector<float> centers;    // Dimension-major, see centerDistances
+    Mat palette;              // BGR colour of each cluster
+};
+
+static ColorKMeansModel makeColorKMeansModel(Size imageSize, KMeansColorSpace colorSpace, double spatialWeight) {
+    ColorKMeansModel model;
+    model.color_space = colorSpace;
+    model.dims = spatialWeight > 0 ? 5 : 3;
+    model.spatial_scale = spatialWeight > 0 ? spatialWeight * 255.0 / max(imageSize.width, imageSize.height) : 0.0;
+    return model;
+}
+
+// Side of the sampling grid cell that leaves about KMEANS_SAMPLE_LIMIT samples
+static int colorSampleCell(Size imageSize) {
+    return max(1, (int)ceil(sqrt((double)imageSize.area() / KMEANS_SAMPLE_LIMIT)));
+}
+
+// Write the colour K-Means features of one row of colors, whose top-left
+// pixel sits at origin in the full image
+static void colorFeatureRow(const Mat& colors, int y, Point origin, const ColorKMeansModel& model, float *features) {
+    const uchar *row = colors.ptr<uchar>(y);
+    for (int x = 0; x < colors.cols; x++) {
+        float *feature = features + x * model.dims;
+        feature[0] = row[x * 3];
+        feature[1] = row[x * 3 + 1];
+        feature[2] = row[x * 3 + 2];
+        if (model.dims == 5) {
+            feature[3] = (float)((origin.x + x) * model.spatial_scale);
+            feature[4] = (float)((origin.y + y) * model.spatial_scale);
+        }
+    }
+}
+
+// Stratified sample: one random pixel from every cell of a global grid whose
+// corner lies inside colors (placed at origin in the full image)
+static void sampleColorFeatures(const Mat& colors, Point origin, int cell, const ColorKMeansModel& model, RNG& rng,
+                                vector<float>& sampleData) {
+    int firstY = (origin.y + cell - 1) / cell * cell;
+    int firstX = (origin.x + cell - 1) / cell * cell;
+    for (int cy = firstY; cy < origin.y + colors.rows; cy += cell) {
+        for (int cx = firstX; cx < origin.x + colors.cols; cx += cell) {
+            int spanY = min(cell, origin.y + colors.rows - cy);
+            int spanX = min(cell, origin.x + colors.cols - cx);
+            int y = cy - origin.y + (spanY > 1 ? rng.uniform(0, spanY) : 0);
+            int x = cx - origin.x + (spanX > 1 ? rng.uniform(0, spanX) : 0);
+            const uchar *color = colors.ptr<uchar>(y) + x * 3;
+            float feature[5] = {(float)color[0], (float)color[1], (float)color[2],
+                                (float)((origin.x + x) * model.spatial_scale),
+                                (float)((origin.y + y) * model.spatial_scale)};
+            sampleData.insert(sampleData.end(), feature, feature + model.dims);
+        }
+    }
+}
+
+// Fit the model's centers and palette on the sampled features
+static void fitColorKMeans(ColorKMeansModel& model, vector<float>& sampleData, int clusters,
+                           TermCriteria criteria) {
+    Mat samples((int)(sampleData.size() / model.dims), model.dims, CV_32F, sampleData.data());
+    if (samples.rows == 0) {
+        throw cv::Exception(0, "No pixels to cluster", "fitColorKMeans", __FILE__, __LINE__);
+    }
+    model.clusters = min(clusters, samples.rows);
+    model.centers = hamerlyKMeans(samples, model.clusters, criteria);
+
+    model.palette.create(model.clusters, 1, CV_8UC3);
+    for (int k = 0; k < model.clusters; k++) {
+        model.palette.at<Vec3b>(k, 0) = Vec3b(saturate_cast<uchar>(model.centers[k]),
+                                              saturate_cast<uchar>(model.centers[model.clusters + k]),
+                                              saturate_cast<uchar>(model.centers[2 * model.clusters + k]));
+    }
+    if (model.color_space == KMEANS_LAB) {
+        cvtColor(model.palette, model.palette, COLOR_Lab2BGR);
+    }
+}
+
+// Assign every pixel to its nearest center and paint it with that cluster's
+// colour, in one parallel pass
+static Mat paintColorClusters(const Mat& colors, Point origin, const ColorKMeansModel& model) {
+    Mat segmented(colors.size(), CV_8UC3);
+    parallel_for_(Range(0, colors.rows), [&](const Range& range) {
+        vector<float> features(colors.cols * model.dims), distances(model.clusters);
+        for (int y = range.start; y < range.end; y++) {
+            colorFeatureRow(colors, y, origin, model, features.data());
+            Vec3b *dst = segmented.ptr<Vec3b>(y);
+            for (int x = 0; x < colors.cols; x++) {
+                float nearest, second;
+                int label = nearestCenter(features.data() + x * model.dims, model.centers.data(), model.dims,
+                                          model.clusters, distances.data(), nearest, second);
+                dst[x] = model.palette.at<Vec3b>(label, 0);
+            }
+        }
+    });
+    return segmented;
+}
+
+// Colour K-Means Segmentation Implementation
+Mat colorKMeansSegmentation(const Mat& image, const SegmentationContext& context) {
+    const SegmentationParams& params = context.params;
+    if (params.kmeans_clusters < 2 || params.kmeans_clusters > 255) {
+        throw cv::Exception(0, "K-Means needs between 2 and 255 clusters", "colorKMeansSegmentation", __FILE__, __LINE__);
+    }
+
+    StageTimer stages("colorKMeansSegmentation");
+    stages.begin(params.kmeans_color_space == KMEANS_LAB ? "Lab conversion" : "BGR conversion");
+    shared_ptr<PreprocessCache> cache = preprocessFor(image, *context.workspace);
+    Mat colors = params.kmeans_color_space == KMEANS_LAB ? cache->lab() : cache->bgr();
+    ColorKMeansModel model = makeColorKMeansModel(colors.size(), params.kmeans_color_space,
+                                                  params.kmeans_spatial_weight);
+
+    // Step 1: Stratified sample of roughly KMEANS_SAMPLE_LIMIT pixels
+    stages.begin("Sampling");
+    vector<float> sampleData;
+    sampleColorFeatures(colors, Point(0, 0), colorSampleCell(colors.size()), model, theRNG(), sampleData);
+
+    // Step 2: Fit the centers on the sample
+    stages.begin("Hamerly K-Means fit");
+    fitColorKMeans(model, sampleData, params.kmeans_clusters, params.kmeansCriteria());
+
+    // Step 3: Assign every pixel and paint it with its cluster's colour
+    stages.begin("Assign and paint");
+    return paintColorClusters(colors, Point(0, 0), model);
+}
+
+// Otsu threshold of a 256-bin histogram, computed like THRESH_OTSU: pixels
+// above the returned value are foreground
+static int otsuThresholdFromHistogram(const double histogram[256]) {
+    double total = 0, mu = 0;
+    for (int i = 0; i < 256; i++) {
+        total += histogram[i];
+        mu += i * histogram[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    mu /= total;
+
+    double q1 = 0, mu1 = 0, maxSigma = 0;
+    int maxValue = 0;
+    for (int i = 0; i < 256; i++) {
+        double p = histogram[i] / total;
+        mu1 *= q1;
+        q1 += p;
+        double q2 = 1.0 - q1;
+        if (min(q1, q2) < FLT_EPSILON || max(q1, q2) > 1.0 - FLT_EPSILON) {
+            continue;
+        }
+        mu1 = (mu1 + i * p) / q1;
+        double mu2 = (mu - q1 * mu1) / q2;
+        double sigma = q1 * q2 * (mu1 - mu2) * (mu1 - mu2);
+        if (sigma > maxSigma) {
+            maxSigma = sigma;
+            maxValue = i;
+        }
+    }
+    return maxValue;
+}
+
+// Thresholds t1 < ... < tn of multi-level Otsu over a 256-bin histogram: the
+// classes [0, t1], (t1, t2], ..., (tn, 255] with the largest between-class
+// variance, which is the largest sum of w * mu^2 over the classes (w the
+// class's pixel count, mu its mean). Every interval's term is looked up in a
+// table built once from prefix sums (Liao, Chen and Chung), and a dynamic
+// program over the class ends finds the best split in O(n * 256^2) instead of
+// trying every threshold combination. One threshold is THRESH_OTSU's.
+static vector<int> otsuThresholds(const double histogram[256], int levels) {
+    if (levels < 1 || levels > OTSU_MAX_LEVELS) {
+        throw cv::Exception(0, format("Otsu needs between 1 and %d thresholds", OTSU_MAX_LEVELS), "otsuThresholds",
+                            __FILE__, __LINE__);
+    }
+    if (levels == 1) {
+        return vector<int>{otsuThresholdFromHistogram(histogram)};
+    }
+
+    // Step 1: w * mu^2 of every interval [a, b]
+    double count[257] = {0}, sum[257] = {0};
+    for (int v = 0; v < 256; v++) {
+        count[v + 1] = count[v] + histogram[v];
+        sum[v + 1] = sum[v] + v * histogram[v];
+    }
+    vector<double> term(256 * 256, 0.0);
+    for (int a = 0; a < 256; a++) {
+        for (int b = a; b < 256; b++) {
+            double w = count[b + 1] - count[a], s = sum[b + 1] - sum[a];
+            term[a * 256 + b] = w > 0 ? s * s / w : 0.0;
+        }
+    }
+
+    // Step 2: best[k][b] is the largest sum for classes 0..k covering [0, b];
+    // start[k][b] is where class k begins in it
+    vector<vector<double>> best(levels + 1, vector<double>(256, -1.0));
+    vector<vector<int>> start(levels + 1, vector<int>(256, 0));
+    for (int b = 0; b < 256; b++) {
+        best[0][b] = term[b];
+    }
+    for (int k = 1; k <= levels; k++) {
+        for (int b = k; b < 256; b++) {
+            for (int a = k; a <= b; a++) {
+                double candidate = best[k - 1][a - 1] + term[a * 256 + b];
+                if (candidate > best[k][b]) {
+                    best[k][b] = candidate;
+                    start[k][b] = a;
+                }
+            }
+        }
+    }
+
+    // Step 3: Walk back from the last class
+    vector<int> thresholds(levels);
+    for (int k = levels, b = 255; k >= 1; k--) {
+        b = start[k][b] - 1;
+        thresholds[k - 1] = b;
+    }
+    return thresholds;
+}
+
+// Lookup table giving the pixels of class k (see otsuThresholds) the gray level
+// k * 255 / n, so one threshold gives the usual binary image
+static Mat otsuClassLut(const vector<int>& thresholds) {
+    Mat lut(1, 256, CV_8U);
+    const int levels = (int)thresholds.size();
+    for (int v = 0, k = 0; v < 256; v++) {
+        while (k < levels && v > thresholds[k]) {
+            k++;
+        }
+        lut.at<uchar>(0, v) = (uchar)(k * 255 / levels);
+    }
+    return lut;
+}
+
+// Otsu Segmentation Implementation
+Mat otsuSegmentation(const Mat& image, const SegmentationContext& context, vector<int>& thresholds,
+                     HistogramPlot* histogramPlot) {
+    StageTimer stages("otsuSegmentation");
+    stages.begin("Grayscale");
+    shared_ptr<PreprocessCache> cache = preprocessFor(image, *context.workspace);
+    Mat gray = cache->gray();
+
+    // The image's shared histogram gives the thresholds
+    stages.begin("Histogram");
+    Mat histogram = cache->histogram();
+    stages.begin("Otsu thresholds");
+    thresholds = otsuThresholds(histogram.ptr<double>(), context.params.otsu_levels);
+
+    // Apply Otsu's thresholding
+    stages.begin("Apply thresholds");
+    Mat segmented;
+    LUT(gray, otsuClassLut(thresholds), segmented);
+
+    // A single threshold's partition can be cleaned up with a graph cut
+    if (context.params.grid_cut_refine && thresholds.size() == 1) {
+        stages.begin("Graph cut clean-up");
+        segmented = refineMaskWithGridCut(cache->bgr(), segmented, context.params.grid_cut_smoothness,
+                                          context.params.grid_cut_connectivity);
+    }
+
+    // The histogram and thresholds for the caller to plot
+    if (histogramPlot != NULL) {
+        histogramPlot->bins.assign(histogram.ptr<double>(), histogram.ptr<double>() + 256);
+        histogramPlot->thresholds = thresholds;
+    }
+    
+    // Convert segmented image to color for main display
+    stages.begin("Color conversion");
+    Mat colored;
+    cvtColor(segmented, colored, COLOR_GRAY2BGR);
+    return colored;
+}
+
+// Basic Backtracking Segmentation Implementation
+Mat backtrackingSegmentation(const Mat& image, const SegmentationContext& context) {
+    StageTimer stages("backtrackingSegmentation");
+    shared_ptr<PreprocessCache> cache = preprocessFor(image, *context.workspace);
+
+    // Define threshold value
+    int threshValue = context.params.backtracking_threshold;
+
+    // Fill the 4-connected region around the center of the image, thresholding
+    // the image to gray as it is packed
+    stages.begin("Region fill");
+    Mat segmented = fillBacktrackingRegion<FLOOD_4>(image, threshValue, *cache, *context.workspace);
+    
+    // Apply color map for better visualization
+    stages.begin("Color map");
+    Mat colored;
+    applyColorMap(segmented, colored, COLORMAP_JET);
+    
+    return colored;
+}
+
+// Improved Backtracking Segmentation Implementation
+Mat backtrackingSegmentationImproved(const Mat& image, const SegmentationContext& context) {
+    StageTimer stages("backtrackingSegmentationImproved");
+    shared_ptr<PreprocessCache> cache = preprocessFor(image, *context.workspace);
+
+    // Apply bilateral filter to reduce noise but keep edges
+    SmoothingFilter filter = context.params.smoothing_filter;
+    stages.begin(filter == SMOOTHING_BILATERAL_GRID ? "Bilateral grid" : "Bilateral filter");
+    Mat smooth = cache->bilateral(filter);
+
+    // Define threshold value
+    int threshValue = context.params.backtracking_threshold;
+
+    // Threshold the smoothed image and fill the 4-connected region around the center
+    stages.begin("Region fill");
+    Mat segmented = fillBacktrackingRegion<FLOOD_4>(smooth, threshValue, *cache, *context.workspace);
+
+    // Morphological post-processing to refine regions
+    stages.begin("Morphological close");
+    Mat& morph = context.workspace->morph;
+    Mat kernel = getStructuringElement(MORPH_ELLIPSE, Size(5, 5));
+    morphologyEx(segmented, morph, MORPH_CLOSE, kernel);
+
+    // Apply color map for visualization
+    stages.begin("Color map");
+    Mat colored;
+    applyColorMap(morph, colored, COLORMAP_JET);
+
+    return colored;
+}
+
+// Watershed Segmentation Implementation
+Mat watershedSegmentation(const Mat& image, const SegmentationContext& context) {
+    StageTimer stages("watershedSegmentation");
+
+    // Ensure image is in color
+    stages.begin("Grayscale");
+    Mat colorImage;
+    if (image.channels() == 1) {
+        cvtColor(image, colorImage, COLOR_GRAY2BGR);
+    } else {
+        colorImage = image.clone();
+    }
+
+    // Convert to grayscale for processing
+    shared_ptr<PreprocessCache> cache = preprocessFor(image, *context.workspace);
+    Mat gray = cache->gray();
+
+    // Apply Otsu's thresholding to create a binary image
+    stages.begin("Otsu threshold");
+    Mat binary;
+    threshold(gray, binary, otsuThresholdFromHistogram(cache->histogram().ptr<double>()), 255, THRESH_BINARY_INV);
+
+    // Remove noise using morphological operations
+    stages.begin("Dilate background");
+    Mat kernel = getStructuringElement(MORPH_RECT, Size(3, 3));
+    Mat sureBg;
+    dilate(binary, sureBg, kernel, Point(-1, -1), 3);
+
+    // Find sure foreground area using distance transform
+    stages.begin("Distance transform");
+    Mat distTransform;
+    distanceTransform(binary, distTransform, DIST_L2, 5);
+    normalize(distTransform, distTransform, 0, 1.0, NORM_MINMAX);
+    Mat sureFg;
+    threshold(distTransform, sureFg, 0.5, 1.0, THRESH_BINARY);
+    
+    // Convert sure foreground to 8-bit image
+    sureFg.convertTo(sureFg, CV_8U);
+
+    // Find unknown region
+    Mat unknown;
+    subtract(sureBg, sureFg, unknown);
+
+    // Label markers
+    stages.begin("Marker labelling");
+    Mat markers;
+    connectedComponents(sureFg, markers);
+
+    // Add 1 to all markers so that the unknown region is marked as 0
+    markers = markers + 1;
+
+    // Mark the unknown region with 0
+    markers.setTo(0, unknown == 255);
+
+    // Apply Watershed algorithm
+    stages.begin("Watershed");
+    watershed(colorImage, markers);
+
+    // Create an output image
+    stages.begin("Render boundaries");
+    Mat segmented = Mat::zeros(colorImage.size(), CV_8UC3);
+    for (int i = 0; i < markers.rows; i++) {
+        for (int j = 0; j < markers.cols; j++) {
+            if (markers.at<int>(i, j) == -1) {
+                segmented.at<Vec3b>(i, j) = Vec3b(0, 0, 255); // Mark boundaries in red
+            } else if (markers.at<int>(i, j) > 1) {
+                segmented.at<Vec3b>(i, j) = colorImage.at<Vec3b>(i, j); // Keep original color
+            }
+        }
+    }
+
+    return segmented;
+}
+
+// Boykov-Kolmogorov max-flow specialised for 4- or 8-connected pixel grids,
+// minimising binary energies
+//     E(L) = sum_p D_p(L_p) + sum_pq w_pq [L_p != L_q]
+// with the source side as foreground. Neighbours are found by index
+// arithmetic on a grid padded by one node, and residual capacities are kept
+// per direction (one array per direction) instead of in an edge list. The
+// search trees survive maxflow(), so after adding unary costs the next
+// maxflow(true) only repairs the trees around the changed pixels (Kohli and
+// Torr's dynamic graph cuts).
+class GridMaxFlow {
+public:
+    // Direction d goes to (x + DX[d], y + DY[d]); d ^ 1 is its opposite and
+    // the even directions are the forward ones
+    static constexpr int DX[8] = {1, -1, 0, 0, 1, -1, -1, 1};
+    static constexpr int DY[8] = {0, 0, 1, -1, 1, -1, 1, -1};
+
+    GridMaxFlow(Size size, int connectivity)
+        : cols(size.width), rows(size.height), connectivity_(connectivity == 8 ? 8 : 4), stride(size.width + 2),
+          nodes((size.width + 2) * (size.height + 2)) {
+        for (int d = 0; d < 8; d++) {
+            offset[d] = DY[d] * stride + DX[d];
+        }
+        capacity_.assign((size_t)connectivity_ * nodes, 0.0f);
+        terminal_.assign(nodes, 0.0f);
+        tree_.assign(nodes, FREE);
+        parent_.assign(nodes, ORPHAN);
+        timestamp_.assign(nodes, 0);
+        distance_.assign(nodes, 0);
+        queued_.assign(nodes, 0);
+        marked_.assign(nodes, 0);
+    }
+
+    int connectivity() const { return connectivity_; }
+
+    // Add the costs of labelling (x, y) foreground and background. Allowed
+    // after maxflow(); the changed pixels are then re-solved by maxflow(true).
+    void addUnary(int x, int y, float foregroundCost, float backgroundCost) {
+        int p = node(x, y);
+        // Cutting the source edge labels a pixel background, so it carries that cost
+        float source = backgroundCost, sink = foregroundCost;
+        if (terminal_[p] > 0) {
+            source += terminal_[p];
+        } else {
+            sink -= terminal_[p];
+        }
+        flow_ += min(source, sink);
+        terminal_[p] = source - sink;
+        if (solved && !marked_[p]) {
+            marked_[p] = 1;
+            changed_.push_back(p);
+        }
+    }
+
+    // Add the cost of giving (x, y) and its neighbour in direction d
+    // different labels; edges leaving the grid are ignored
+    void addPairwise(int x, int y, int d, float weight) {
+        int nx = x + DX[d], ny = y + DY[d];
+        if (d >= connectivity_ || nx < 0 || ny < 0 || nx >= cols || ny >= rows) {
+            return;
+        }
+        int p = node(x, y);
+        capacity_[(size_t)d * nodes + p] += weight;
+        capacity_[(size_t)(d ^ 1) * nodes + p + offset[d]] += weight;
+    }
+
+    // Minimum cut; returns the minimum energy. With reuseTrees the search
+    // continues from the previous call's trees and flow.
+    double maxflow(bool reuseTrees = false) {
+        if (reuseTrees && solved) {
+            repairTrees();
+        } else {
+            initTrees();
+        }
+        solved = true;
+
+        while (!active_.empty()) {
+            int p = active_.front();
+            if (tree_[p] == FREE) {
+                active_.pop_front();
+                queued_[p] = 0;
+                continue;
+            }
+
+            // Step 1: Grow p's tree until it touches the other one
+            const bool sourceSide = tree_[p] == SOURCE;
+            int from = -1, to = -1, direction = -1;
+            for (int d = 0; d < connectivity_; d++) {
+                int q = p + offset[d];
+                float residual = sourceSide ? capacity_[(size_t)d * nodes + p]
+                                            : capacity_[(size_t)(d ^ 1) * nodes + q];
+                if (residual <= 0) {
+                    continue;
+                }
+                if (tree_[q] == FREE) {
+                    tree_[q] = tree_[p];
+                    parent_[q] = d ^ 1;
+                    timestamp_[q] = timestamp_[p];
+                    distance_[q] = distance_[p] + 1;
+                    activate(q);
+                } else if (tree_[q] != tree_[p]) {
+                    from = sourceSide ? p : q;
+                    to = sourceSide ? q : p;
+                    direction = sourceSide ? d : d ^ 1;
+                    break;
+                } else if (timestamp_[q] <= timestamp_[p] && distance_[q] > distance_[p]) {
+                    // Shorter path to the terminal through p
+                    parent_[q] = d ^ 1;
+                    timestamp_[q] = timestamp_[p];
+                    distance_[q] = distance_[p] + 1;
+                }
+            }
+            if (from < 0) {
+                active_.pop_front();
+                queued_[p] = 0;
+                continue;
+            }
+
+            // Step 2: Push the bottleneck along the path, then re-attach the
+            // nodes whose tree edge saturated
+            augment(from, to, direction);
+            time_++;
+            adoptOrphans();
+        }
+        return flow_;
+    }
+
+    bool isForeground(int x, int y) const { return tree_[node(x, y)] == SOURCE; }
+
+    // CV_8UC1 mask, 255 on the foreground (source) side of the cut
+    Mat foregroundMask() const {
+        Mat mask(rows, cols, CV_8UC1);
+        for (int y = 0; y < rows; y++) {
+            uchar *dst = mask.ptr<uchar>(y);
+            const uchar *tree = &tree_[node(0, y)];
+            for (int x = 0; x < cols; x++) {
+                dst[x] = tree[x] == SOURCE ? 255 : 0;
+            }
+        }
+        return mask;
+    }
+
+private:
+    enum : uchar { FREE = 0, SOURCE = 1, SINK = 2 };
+    enum : signed char { TERMINAL = 8, ORPHAN = -1 }; // parent_ values besides directions
+
+    int node(int x, int y) const { return (y + 1) * stride + x + 1; }
+
+    void activate(int p) {
+        if (!queued_[p]) {
+            queued_[p] = 1;
+            active_.push_back(p);
+        }
+    }
+
+    void makeOrphan(int p) {
+        parent_[p] = ORPHAN;
+        orphans_.push_back(p);
+    }
+
+    void initTrees() {
+        active_.clear();
+        orphans_.clear();
+        fill(queued_.begin(), queued_.end(), 0);
+        for (int p : changed_) {
+            marked_[p] = 0;
+        }
+        changed_.clear();
+        time_ = 0;
+        for (int y = 0; y < rows; y++) {
+            for (int x = 0; x < cols; x++) {
+                int p = node(x, y);
+                parent_[p] = ORPHAN;
+                tree_[p] = FREE;
+                if (terminal_[p] != 0) {
+                    tree_[p] = terminal_[p] > 0 ? SOURCE : SINK;
+                    parent_[p] = TERMINAL;
+                    timestamp_[p] = 0;
+                    distance_[p] = 1;
+                    activate(p);
+                }
+            }
+        }
+    }
+
+    // Re-root the pixels whose terminal capacity changed since the last cut
+    void repairTrees() {
+        time_++;
+        for (int p : changed_) {
+            marked_[p] = 0;
+            if (terminal_[p] == 0) {
+                if (tree_[p] != FREE && parent_[p] == TERMINAL) {
+                    makeOrphan(p);
+                }
+                continue;
+            }
+            uchar side = terminal_[p] > 0 ? SOURCE : SINK;
+            for (int d = 0; d < connectivity_; d++) {
+                int q = p + offset[d];
+                if (tree_[q] == FREE || tree_[q] == side) {
+                    continue;
+                }
+                // p changes tree, so its children lose their parent, and the
+                // other tree's nodes with residual capacity towards p must be
+                // active in case p is freed before it has reached them
+                if (tree_[q] == tree_[p] && parent_[q] == (d ^ 1)) {
+                    makeOrphan(q);
+                }
+                float residual = side == SINK ? capacity_[(size_t)(d ^ 1) * nodes + q]
+                                              : capacity_[(size_t)d * nodes + p];
+                if (residual > 0) {
+                    activate(q);
+                }
+            }
+            tree_[p] = side;
+            parent_[p] = TERMINAL;
+            timestamp_[p] = time_;
+            distance_[p] = 1;
+            activate(p);
+        }
+        changed_.clear();
+        adoptOrphans();
+    }
+
+    void augment(int from, int to, int direction) {
+        // Bottleneck over the middle edge and both tree paths
+        float bottleneck = capacity_[(size_t)direction * nodes + from];
+        for (int v = from;;) {
+            int d = parent_[v];
+            if (d == TERMINAL) {
+                bottleneck = min(bottleneck, terminal_[v]);
+                break;
+            }
+            int u = v + offset[d];
+            bottleneck = min(bottleneck, capacity_[(size_t)(d ^ 1) * nodes + u]);
+            v = u;
+        }
+        for (int v = to;;) {
+            int d = parent_[v];
+            if (d == TERMINAL) {
+                bottleneck = min(bottleneck, -terminal_[v]);
+                break;
+            }
+            bottleneck = min(bottleneck, capacity_[(size_t)d * nodes + v]);
+            v += offset[d];
+        }
+
+        capacity_[(size_t)direction * nodes + from] -= bottleneck;
+        capacity_[(size_t)(direction ^ 1) * nodes + to] += bottleneck;
+        for (int v = from;;) {
+            int d = parent_[v];
+            if (d == TERMINAL) {
+                terminal_[v] -= bottleneck;
+                if (terminal_[v] <= 0) {
+                    makeOrphan(v);
+                }
+                break;
+            }
+            int u = v + offset[d];
+            float& forward = capacity_[(size_t)(d ^ 1) * nodes + u];
+            forward -= bottleneck;
+            capacity_[(size_t)d * nodes + v] += bottleneck;
+            if (forward <= 0) {
+                makeOrphan(v);
+            }
+            v = u;
+        }
+        for (int v = to;;) {
+            int d = parent_[v];
+            if (d == TERMINAL) {
+                terminal_[v] += bottleneck;
+                if (terminal_[v] >= 0) {
+                    makeOrphan(v);
+                }
+                break;
+            }
+            int u = v + offset[d];
+            float& forward = capacity_[(size_t)d * nodes + v];
+            forward -= bottleneck;
+            capacity_[(size_t)(d ^ 1) * nodes + u] += bottleneck;
+            if (forward <= 0) {
+                makeOrphan(v);
+            }
+            v = u;
+        }
+        flow_ += bottleneck;
+    }
+
+    // Give every orphan the closest valid parent in its tree, or free it
+    void adoptOrphans() {
+        while (!orphans_.empty()) {
+            int p = orphans_.front();
+            orphans_.pop_front();
+            if (parent_[p] != ORPHAN) {
+                continue; // Re-rooted by repairTrees
+            }
+            const bool sourceSide = tree_[p] == SOURCE;
+
+            int bestDirection = -1, bestDistance = INT_MAX;
+            for (int d = 0; d < connectivity_; d++) {
+                int q = p + offset[d];
+                if (tree_[q] != tree_[p]) {
+                    continue;
+                }
+                float residual = sourceSide ? capacity_[(size_t)(d ^ 1) * nodes + q]
+                                            : capacity_[(size_t)d * nodes + p];
+                if (residual <= 0) {
+                    continue;
+                }
+
+                // Distance from q to its terminal, unless q hangs off an orphan
+                int distance = 0;
+                for (int v = q;;) {
+                    if (timestamp_[v] == time_) {
+                        distance += distance_[v];
+                        break;
+                    }
+                    distance++;
+                    if (parent_[v] == TERMINAL) {
+                        timestamp_[v] = time_;
+                        distance_[v] = 1;
+                        break;
+                    }
+                    if (parent_[v] == ORPHAN) {
+                        distance = INT_MAX;
+                        break;
+                    }
+                    v += offset[parent_[v]];
+                }
+                if (distance == INT_MAX) {
+                    continue;
+                }
+                if (distance < bestDistance) {
+                    bestDirection = d;
+                    bestDistance = distance;
+                }
+                for (int v = q; timestamp_[v] != time_; v += offset[parent_[v]]) {
+                    timestamp_[v] = time_;
+                    distance_[v] = distance--;
+                }
+            }
+
+            if (bestDirection >= 0) {
+                parent_[p] = bestDirection;
+                timestamp_[p] = time_;
+                distance_[p] = bestDistance + 1;
+                continue;
+            }
 
-    // Copy binary image for segmentation
-    Mat segmented = binary.clone();
+            // No parent: p leaves the tree, its neighbours that could reach it
+            // become active and its children become orphans
+            for (int d = 0; d < connectivity_; d++) {
+                int q = p + offset[d];
+                if (tree_[q] != tree_[p]) {
+                    continue;
+                }
+                float residual = sourceSide ? capacity_[(size_t)(d ^ 1) * nodes + q]
+                                            : capacity_[(size_t)d * nodes + p];
+                if (residual > 0) {
+                    activate(q);
+                }
+                if (parent_[q] == (d ^ 1)) {
+                    makeOrphan(q);
+                }
+            }
+            tree_[p] = FREE;
+        }
+    }
 
-    // Starting point: center of image
-    int startX = gray.cols / 2;
-    int startY = gray.rows / 2;
-    int oldColor = binary.at<uchar>(startY, startX);
-    int newColor = 128;
+    int cols, rows, connectivity_, stride, nodes;
+    int offset[8];
+    vector<float> capacity_;   // Residual capacity towards each direction, direction-major
+    vector<float> terminal_;   // Residual source (> 0) or sink (< 0) capacity
+    vector<uchar> tree_;
+    vector<signed char> parent_; // Direction of the parent, TERMINAL or ORPHAN
+    vector<int> timestamp_, distance_;
+    vector<uchar> queued_, marked_;
+    deque<int> active_, orphans_;
+    vector<int> changed_;
+    int time_ = 0;
+    double flow_ = 0;
+    bool solved = false;
+};
+
+// Add delta (either sign) to the foreground cost of (x, y)
+static void addForegroundCost(GridMaxFlow& graph, int x, int y, float delta) {
+    if (delta >= 0) {
+        graph.addUnary(x, y, delta, 0);
+    } else {
+        graph.addUnary(x, y, 0, -delta);
+    }
+}
 
-    // Non-recursive flood-fill using BFS
-    Mat visited = Mat::zeros(binary.size(), CV_8UC1);
-    queue<Point> q;
-    q.push(Point(startX, startY));
-    visited.at<uchar>(startY, startX) = 1;
+// Minimum of the energy given by per-pixel unary costs (CV_32F) and pairwise
+// weights - one CV_32F map per forward direction of GridMaxFlow, the weight at
+// p coupling p with p + direction. Returns the foreground mask (255). Large
+// grids are cut in parallel horizontal stripes that share one row with their
+// neighbours (dual decomposition after Strandmark and Kahl): each shared row's
+// costs are split between its two stripes, and Lagrange multipliers on its
+// pixels are moved until both stripes label them alike. Every round re-uses
+// the stripes' search trees, so it only re-solves around the shared rows.
+// Pixels still in disagreement after the last round take the upper stripe's
+// label.
+static Mat solveGridCut(const Mat& foregroundCost, const Mat& backgroundCost, const vector<Mat>& weights,
+                        int connectivity) {
+    const int rows = foregroundCost.rows, cols = foregroundCost.cols;
+    // The stripe layout depends on the grid alone, not on the thread count,
+    // so the same input always gives the same mask
+    int stripeCount = 1;
+    if (foregroundCost.total() >= (size_t)GRID_CUT_PARALLEL_PIXELS) {
+        stripeCount = max(1, (rows - 1) / GRID_CUT_STRIPE_ROWS);
+    }
 
-    while (!q.empty()) {
-        Point p = q.front();
-        q.pop();
+    // Stripe s covers rows [tops[s], tops[s + 1]]; the last row is shared
+    vector<int> tops(stripeCount + 1);
+    for (int s = 0; s <= stripeCount; s++) {
+        tops[s] = (int)((long long)(rows - 1) * s / stripeCount);
+    }
 
-        if (binary.at<uchar>(p.y, p.x) == oldColor) {
-            segmented.at<uchar>(p.y, p.x) = newColor;
+    vector<unique_ptr<GridMaxFlow>> stripes(stripeCount);
+    parallel_for_(Range(0, stripeCount), [&](const Range& range) {
+        for (int s = range.start; s < range.end; s++) {
+            int top = tops[s], bottom = tops[s + 1];
+            stripes[s].reset(new GridMaxFlow(Size(cols, bottom - top + 1), connectivity));
+            GridMaxFlow& graph = *stripes[s];
+            for (int y = top; y <= bottom; y++) {
+                bool shared = (y == top && s > 0) || (y == bottom && s + 1 < stripeCount);
+                float share = shared ? 0.5f : 1.0f;
+                const float *fg = foregroundCost.ptr<float>(y), *bg = backgroundCost.ptr<float>(y);
+                for (int x = 0; x < cols; x++) {
+                    graph.addUnary(x, y - top, share * fg[x], share * bg[x]);
+                }
+                for (size_t k = 0; k < weights.size(); k++) {
+                    int d = 2 * (int)k;
+                    if (GridMaxFlow::DY[d] == 1 && y == bottom) {
+                        continue; // Coupling into the next stripe
+                    }
+                    float edgeShare = GridMaxFlow::DY[d] == 0 ? share : 1.0f;
+                    const float *w = weights[k].ptr<float>(y);
+                    for (int x = 0; x < cols; x++) {
+                        graph.addPairwise(x, y - top, d, edgeShare * w[x]);
+                    }
+                }
+            }
+        }
+    });
+
+    // Multiplier steps start at the mean unary contrast
+    double step = 0;
+    for (int y = 0; y < rows; y++) {
+        const float *fg = foregroundCost.ptr<float>(y), *bg = backgroundCost.ptr<float>(y);
+        for (int x = 0; x < cols; x++) {
+            step += fabs(fg[x] - bg[x]);
+        }
+    }
+    step = max(step / max((size_t)1, foregroundCost.total()), 1e-3);
 
-            int dx[] = {1, -1, 0, 0};
-            int dy[] = {0, 0, 1, -1};
+    int previousDisagreements = INT_MAX;
+    for (int round = 0; round < GRID_CUT_DUAL_ROUNDS; round++) {
+        parallel_for_(Range(0, stripeCount), [&](const Range& range) {
+            for (int s = range.start; s < range.end; s++) {
+                stripes[s]->maxflow(round > 0);
+            }
+        });
+
+        // Move the multipliers where the stripes disagree
+        int disagreements = 0;
+        for (int s = 0; s + 1 < stripeCount; s++) {
+            int row = tops[s + 1];
+            GridMaxFlow& upper = *stripes[s];
+            GridMaxFlow& lower = *stripes[s + 1];
+            for (int x = 0; x < cols; x++) {
+                int difference = (int)upper.isForeground(x, row - tops[s]) - (int)lower.isForeground(x, 0);
+                if (difference != 0) {
+                    disagreements++;
+                    addForegroundCost(upper, x, row - tops[s], (float)(step * difference));
+                    addForegroundCost(lower, x, 0, (float)(-step * difference));
+                }
+            }
+        }
+        if (disagreements == 0) {
+            break;
+        }
+        if (disagreements >= previousDisagreements) {
+            step *= 0.5;
+        }
+        previousDisagreements = disagreements;
+    }
 
-            for (int i = 0; i < 4; i++) {
-                int nx = p.x + dx[i];
-                int ny = p.y + dy[i];
+    // Each stripe writes its rows; shared rows come from the upper stripe
+    Mat mask(rows, cols, CV_8UC1);
+    parallel_for_(Range(0, stripeCount), [&](const Range& range) {
+        for (int s = range.start; s < range.end; s++) {
+            int top = tops[s], bottom = tops[s + 1];
+            Mat stripeMask = stripes[s]->foregroundMask();
+            int first = s > 0 ? 1 : 0;
+            stripeMask.rowRange(first, bottom - top + 1).copyTo(mask.rowRange(top + first, bottom + 1));
+        }
+    });
+    return mask;
+}
 
-                if (nx >= 0 && ny >= 0 && nx < binary.cols && ny < binary.rows &&
-                    !visited.at<uchar>(ny, nx)) {
-                    visited.at<uchar>(ny, nx) = 1;
-                    q.push(Point(nx, ny));
+// Contrast-sensitive Potts weights for solveGridCut, as in GrabCut:
+// smoothness * exp(-beta |I_p - I_q|^2) / |p - q|, with beta from the mean
+// squared colour difference between neighbours
+static vector<Mat> contrastPairwiseWeights(const Mat& colorImage, int connectivity, float smoothness) {
+    const int forward = connectivity == 8 ? 4 : 2;
+    auto colorDistance = [&](int x, int y, int d) {
+        int nx = x + GridMaxFlow::DX[d], ny = y + GridMaxFlow::DY[d];
+        if (nx < 0 || nx >= colorImage.cols || ny >= colorImage.rows) {
+            return -1.0f;
+        }
+        const Vec3b& a = colorImage.at<Vec3b>(y, x);
+        const Vec3b& b = colorImage.at<Vec3b>(ny, nx);
+        float distance = 0;
+        for (int c = 0; c < 3; c++) {
+            distance += (float)(a[c] - b[c]) * (a[c] - b[c]);
+        }
+        return distance;
+    };
+
+    // Step 1: Mean squared difference over all neighbour pairs
+    vector<double> rowSums(colorImage.rows, 0.0), rowCounts(colorImage.rows, 0.0);
+    parallel_for_(Range(0, colorImage.rows), [&](const Range& range) {
+        for (int y = range.start; y < range.end; y++) {
+            for (int x = 0; x < colorImage.cols; x++) {
+                for (int k = 0; k < forward; k++) {
+                    float distance = colorDistance(x, y, 2 * k);
+                    if (distance >= 0) {
+                        rowSums[y] += distance;
+                        rowCounts[y]++;
+                    }
                 }
             }
         }
+    });
+    double sum = 0, count = 0;
+    for (int y = 0; y < colorImage.rows; y++) {
+        sum += rowSums[y];
+        count += rowCounts[y];
     }
+    double beta = sum > 0 ? count / (2.0 * sum) : 0.0;
 
-    // Morphological post-processing to refine regions
-    Mat morph;
-    Mat kernel = getStructuringElement(MORPH_ELLIPSE, Size(5, 5));
-    morphologyEx(segmented, morph, MORPH_CLOSE, kernel);
-
-    // Apply color map for visualization
-    Mat colored;
-    applyColorMap(morph, colored, COLORMAP_JET);
-
-    return colored;
+    // Step 2: Weights per forward direction
+    vector<Mat> weights(forward);
+    for (Mat& w : weights) {
+        w = Mat::zeros(colorImage.size(), CV_32F);
+    }
+    parallel_for_(Range(0, colorImage.rows), [&](const Range& range) {
+        for (int y = range.start; y < range.end; y++) {
+            for (int k = 0; k < forward; k++) {
+                float *w = weights[k].ptr<float>(y);
+                float length = k >= 2 ? sqrtf(2.0f) : 1.0f;
+                for (int x = 0; x < colorImage.cols; x++) {
+                    float distance = colorDistance(x, y, 2 * k);
+                    if (distance >= 0) {
+                        w[x] = smoothness * (float)exp(-beta * distance) / length;
+                    }
+                }
+            }
+        }
+    });
+    return weights;
 }
 
-// Watershed Segmentation Implementation
-Mat watershedSegmentation(const Mat& image) {
-    // Ensure image is in color
-    Mat colorImage;
-    if (image.channels() == 1) {
-        cvtColor(image, colorImage, COLOR_GRAY2BGR);
-    } else {
-        colorImage = image.clone();
+// Refine a binary mask (non-zero = foreground) of a BGR image with a graph
+// cut: colour histograms of the mask's two sides give the unary costs and
+// contrastPairwiseWeights the smoothness term. Any coarse segmentation
+// (Otsu, K-Means, ...) can be cleaned up this way. Returns a 0/255 mask.
+static Mat refineMaskWithGridCut(const Mat& colorImage, const Mat& mask, float smoothness, int connectivity) {
+    // Step 1: Colour histograms of both sides, GRID_CUT_COLOR_BINS per channel
+    const int shift = 8 - (int)round(log2((double)GRID_CUT_COLOR_BINS));
+    const int bins = GRID_CUT_COLOR_BINS * GRID_CUT_COLOR_BINS * GRID_CUT_COLOR_BINS;
+    auto bin = [shift](const Vec3b& color) {
+        return ((color[0] >> shift) * GRID_CUT_COLOR_BINS + (color[1] >> shift)) * GRID_CUT_COLOR_BINS +
+               (color[2] >> shift);
+    };
+    vector<double> foregroundCounts(bins, 1.0), backgroundCounts(bins, 1.0); // Laplace smoothing
+    double foregroundTotal = bins, backgroundTotal = bins;
+    for (int y = 0; y < colorImage.rows; y++) {
+        const Vec3b *color = colorImage.ptr<Vec3b>(y);
+        const uchar *inside = mask.ptr<uchar>(y);
+        for (int x = 0; x < colorImage.cols; x++) {
+            if (inside[x]) {
+                foregroundCounts[bin(color[x])]++;
+                foregroundTotal++;
+            } else {
+                backgroundCounts[bin(color[x])]++;
+                backgroundTotal++;
+            }
+        }
+    }
+    if (foregroundTotal == bins || backgroundTotal == bins) {
+        return mask > 0; // One side is empty, nothing to model
     }
 
-    // Convert to grayscale for processing
-    Mat gray;
-    cvtColor(colorImage, gray, COLOR_BGR2GRAY);
-
-    // Apply Otsu's thresholding to create a binary image
-    Mat binary;
-    threshold(gray, binary, 0, 255, THRESH_BINARY_INV + THRESH_OTSU);
-
-    // Remove noise using morphological operations
-    Mat kernel = getStructuringElement(MORPH_RECT, Size(3, 3));
-    Mat sureBg;
-    dilate(binary, sureBg, kernel, Point(-1, -1), 3);
-
-    // Find sure foreground area using distance transform
-    Mat distTransform;
-    distanceTransform(binary, distTransform, DIST_L2, 5);
-    normalize(distTransform, distTransform, 0, 1.0, NORM_MINMAX);
-    Mat sureFg;
-    threshold(distTransform, sureFg, 0.5, 1.0, THRESH_BINARY);
-    
-    // Convert sure foreground to 8-bit image
-    sureFg.convertTo(sureFg, CV_8U);
-
-    // Find unknown region
-    Mat unknown;
-    subtract(sureBg, sureFg, unknown);
-
-    // Label markers
-    Mat markers;
-    connectedComponents(sureFg, markers);
-
-    // Add 1 to all markers so that the unknown region is marked as 0
-    markers = markers + 1;
-
-    // Mark the unknown region with 0
-    markers.setTo(0, unknown == 255);
+    // Step 2: Unary costs are negative log-likelihoods
+    vector<float> foregroundTable(bins), backgroundTable(bins);
+    for (int b = 0; b < bins; b++) {
+        foregroundTable[b] = (float)-log(foregroundCounts[b] / foregroundTotal);
+        backgroundTable[b] = (float)-log(backgroundCounts[b] / backgroundTotal);
+    }
+    Mat foregroundCost(colorImage.size(), CV_32F), backgroundCost(colorImage.size(), CV_32F);
+    parallel_for_(Range(0, colorImage.rows), [&](const Range& range) {
+        for (int y = range.start; y < range.end; y++) {
+            const Vec3b *color = colorImage.ptr<Vec3b>(y);
+            float *fg = foregroundCost.ptr<float>(y), *bg = backgroundCost.ptr<float>(y);
+            for (int x = 0; x < colorImage.cols; x++) {
+                int b = bin(color[x]);
+                fg[x] = foregroundTable[b];
+                bg[x] = backgroundTable[b];
+            }
+        }
+    });
 
-    // Apply Watershed algorithm
-    watershed(colorImage, markers);
+    // Step 3: Minimum cut
+    vector<Mat> weights = contrastPairwiseWeights(colorImage, connectivity, smoothness);
+    return solveGridCut(foregroundCost, backgroundCost, weights, connectivity);
+}
 
-    // Create an output image
-    Mat segmented = Mat::zeros(colorImage.size(), CV_8UC3);
-    for (int i = 0; i < markers.rows; i++) {
-        for (int j = 0; j < markers.cols; j++) {
-            if (markers.at<int>(i, j) == -1) {
-                segmented.at<Vec3b>(i, j) = Vec3b(0, 0, 255); // Mark boundaries in red
-            } else if (markers.at<int>(i, j) > 1) {
-                segmented.at<Vec3b>(i, j) = colorImage.at<Vec3b>(i, j); // Keep original color
+// Full resolution GrabCut mask from one solved on a coarse pyramid level. The
+// uncertain band - coarse pixels within two of the coarse boundary - is
+// upsampled with the prediction; everything else is fixed as GC_FGD/GC_BGD.
+// The band is re-solved at full resolution with the coarse colour models
+// frozen (GC_EVAL_FREEZE_MODEL), cutting only the tiles the band touches, in
+// parallel, each with a halo of context of which only the interior is kept.
+// Every tile reads its labels from the initial mask, so no tile sees another
+// tile's result and the outcome does not depend on the scheduling. Each tile
+// is its own grabCut call, and OpenCV derives the contrast normalisation (beta)
+// of the pairwise term from the pixels it is given, so the smoothing weight
+// differs a little between neighbouring tiles and the cut can step at a seam;
+// benchmark --check measures this against one cut over the whole band
+// (tileSize 0) and against full resolution GrabCut.
+static Mat refineGrabCutBand(const Mat& colorImage, const Mat& coarseMask, const Rect& rect,
+                             const Mat& bgModel, const Mat& fgModel, int tileSize) {
+    // Step 1: Uncertain band around the predicted boundary
+    Mat coarseForeground, grown, shrunk, coarseBand, foreground, band;
+    bitwise_and(coarseMask, Scalar(1), coarseForeground);
+    Mat kernel = getStructuringElement(MORPH_RECT, Size(5, 5));
+    dilate(coarseForeground, grown, kernel);
+    erode(coarseForeground, shrunk, kernel);
+    compare(grown, shrunk, coarseBand, CMP_NE);
+    resize(coarseForeground, foreground, colorImage.size(), 0, 0, INTER_NEAREST);
+    resize(coarseBand, band, colorImage.size(), 0, 0, INTER_NEAREST);
+
+    Mat mask(colorImage.size(), CV_8UC1);
+    for (int y = 0; y < mask.rows; y++) {
+        uchar *labels = mask.ptr<uchar>(y);
+        const uchar *uncertain = band.ptr<uchar>(y), *fg = foreground.ptr<uchar>(y);
+        for (int x = 0; x < mask.cols; x++) {
+            if (!rect.contains(Point(x, y))) {
+                labels[x] = GC_BGD;
+            } else if (uncertain[x]) {
+                labels[x] = fg[x] ? GC_PR_FGD : GC_PR_BGD;
+            } else {
+                labels[x] = fg[x] ? GC_FGD : GC_BGD;
             }
         }
     }
 
-    return segmented;
-}
-
-// Graph Cut Segmentation Implementation
-Mat graphCutSegmentation(const Mat& image) {
-    // Ensure image is in color
-    Mat colorImage;
-    if (image.channels() == 1) {
-        cvtColor(image, colorImage, COLOR_GRAY2BGR);
-    } else {
-        colorImage = image.clone();
+    // Step 2: Cut the tiles that the band touches
+    vector<Rect> tiles;
+    const Rect bounds(Point(0, 0), mask.size());
+    if (tileSize <= 0) {
+        tileSize = max(mask.cols, mask.rows);
+    }
+    for (int y = 0; y < mask.rows; y += tileSize) {
+        for (int x = 0; x < mask.cols; x += tileSize) {
+            Rect tile = Rect(x, y, tileSize, tileSize) & bounds;
+            if (countNonZero(band(tile)) > 0) {
+                tiles.push_back(tile);
+            }
+        }
     }
+    const Mat initial = mask.clone();
+    parallel_for_(Range(0, (int)tiles.size()), [&](const Range& range) {
+        for (int t = range.start; t < range.end; t++) {
+            const Rect& tile = tiles[t];
+            Rect padded = Rect(tile.x - GRAPH_CUT_TILE_HALO, tile.y - GRAPH_CUT_TILE_HALO,
+                               tile.width + 2 * GRAPH_CUT_TILE_HALO, tile.height + 2 * GRAPH_CUT_TILE_HALO) & bounds;
+            Mat tileMask = initial(padded).clone();
+            Mat tileBg = bgModel.clone(), tileFg = fgModel.clone();
+            grabCut(colorImage(padded), tileMask, Rect(), tileBg, tileFg, 1, GC_EVAL_FREEZE_MODEL);
+            Rect interior(tile.x - padded.x, tile.y - padded.y, tile.width, tile.height);
+            tileMask(interior).copyTo(mask(tile));
+        }
+    });
+    return mask;
+}
 
+// GrabCut from the centered rectangle: fills mask and the colour models
+static void initialGrabCut(const Mat& colorImage, const SegmentationParams& params, Mat& mask, Mat& bgModel,
+                           Mat& fgModel, StageTimer& stages) {
     // Define a rectangle around the object of interest (center of the image)
     int margin = min(colorImage.cols, colorImage.rows) / 4;
     Rect rectangle(margin, margin, colorImage.cols - 2*margin, colorImage.rows - 2*margin);
 
     // Initialize mask
-    Mat mask(colorImage.size(), CV_8UC1, Scalar(cv::GC_BGD)); // Default: Background
-
-    // Initialize background and foreground models
-    Mat bgModel, fgModel;
-
-    // Apply GrabCut (Graph Cut)
-    grabCut(colorImage, mask, rectangle, bgModel, fgModel, 5, cv::GC_INIT_WITH_RECT);
+    mask.create(colorImage.size(), CV_8UC1);
+    mask.setTo(Scalar(cv::GC_BGD)); // Default: Background
+
+    int longest = max(colorImage.cols, colorImage.rows);
+    if (params.graph_cut_max_side <= 0 || longest <= params.graph_cut_max_side) {
+        // Apply GrabCut (Graph Cut)
+        stages.begin("GrabCut");
+        grabCut(colorImage, mask, rectangle, bgModel, fgModel, params.graph_cut_iterations,
+                cv::GC_INIT_WITH_RECT);
+    } else {
+        // Coarse to fine: full GrabCut on a downsampled level fits the colour
+        // models and predicts the mask; full resolution only re-solves the
+        // band where the coarse boundary is uncertain
+        stages.begin("Downsample");
+        double scale = (double)params.graph_cut_max_side / longest;
+        Mat coarseImage;
+        resize(colorImage, coarseImage, Size(max(1, cvRound(colorImage.cols * scale)),
+                                              max(1, cvRound(colorImage.rows * scale))), 0, 0, INTER_AREA);
+        double sx = (double)coarseImage.cols / colorImage.cols, sy = (double)coarseImage.rows / colorImage.rows;
+        Rect coarseRect(cvRound(rectangle.x * sx), cvRound(rectangle.y * sy),
+                        max(1, cvRound(rectangle.width * sx)), max(1, cvRound(rectangle.height * sy)));
+
+        stages.begin("Coarse GrabCut");
+        Mat coarseMask(coarseImage.size(), CV_8UC1, Scalar(cv::GC_BGD));
+        grabCut(coarseImage, coarseMask, coarseRect, bgModel, fgModel, params.graph_cut_iterations,
+                cv::GC_INIT_WITH_RECT);
+
+        stages.begin("Band refinement");
+        mask = refineGrabCutBand(colorImage, coarseMask, rectangle, bgModel, fgModel, params.graph_cut_tile);
+    }
+}
 
+// The pixels GrabCut labelled foreground, on black
+static Mat grabCutForeground(const Mat& colorImage, const Mat& mask) {
     // Convert mask to binary: Foreground pixels are marked
     Mat segmented;
-    compare(mask, cv::GC_PR_FGD, segmented, CMP_EQ);
-    
+    bitwise_and(mask, Scalar(1), segmented); // GC_FGD and GC_PR_FGD
+
     // Convert to 3-channel image for visualization
     Mat output(colorImage.size(), CV_8UC3, Scalar(0, 0, 0));
     colorImage.copyTo(output, segmented);
-
     return output;
 }
 
-// Region Growing Segmentation Implementation
-Mat regionGrowingSegmentation(const Mat& image, Point seed, int threshold) {
-    // Convert to grayscale if not already
-    Mat gray;
-    if (image.channels() == 3) {
-        cvtColor(image, gray, COLOR_BGR2GRAY);
-    } else {
-        gray = image.clone();
+// Graph Cut Segmentation Implementation
+Mat graphCutSegmentation(const Mat& image, const SegmentationContext& context) {
+    if (context.grabcut_session != NULL && context.grabcut_session->matches(image)) {
+        return context.grabcut_session->segment(context.params);
     }
 
-    Mat segmented = Mat::zeros(gray.size(), CV_8UC1); 
-    Mat visited = Mat::zeros(gray.size(), CV_8UC1);   // Track visited pixels
-    queue<Point> pixelQueue; 
+    StageTimer stages("graphCutSegmentation");
+
+    // Ensure image is in color
+    stages.begin("Prepare input");
+    Mat colorImage;
+    if (image.channels() == 1) {
+        cvtColor(image, colorImage, COLOR_GRAY2BGR);
+    } else {
+        colorImage = image.clone();
+    }
 
-    int seedIntensity = gray.at<uchar>(seed.y, seed.x);
-    pixelQueue.push(seed);
-    visited.at<uchar>(seed.y, seed.x) = 1;
+    // Initialize mask and the background and foreground models
+    Mat mask, bgModel, fgModel;
+    initialGrabCut(colorImage, context.params, mask, bgModel, fgModel, stages);
 
+    stages.begin("Extract foreground");
+    return grabCutForeground(colorImage, mask);
+}
 
-    int dx[] = {0, 0, -1, 1};
-    int dy[] = {-1, 1, 0, 0};
+Mat GrabCutSession::segment(const SegmentationParams& params) {
+    StageTimer stages("GrabCutSession::segment");
+    lock_guard<mutex> guard(lock);
+    vector<Stroke> strokes;
+    {
+        lock_guard<mutex> pending_guard(stroke_lock);
+        strokes.swap(pending);
+    }
 
-    while (!pixelQueue.empty()) {
-        Point p = pixelQueue.front();
-        pixelQueue.pop();
-        segmented.at<uchar>(p.y, p.x) = 255; 
+    // Step 1: The first run starts from the rectangle like graphCutSegmentation
+    if (mask.empty()) {
+        stages.begin("Prepare input");
+        if (source.channels() == 1) {
+            cvtColor(source, colorImage, COLOR_GRAY2BGR);
+        } else {
+            colorImage = source.clone();
+        }
+        initialGrabCut(colorImage, params, mask, bgModel, fgModel, stages);
+        strokeLabels = Mat::zeros(colorImage.size(), CV_8UC1);
+
+        int longest = max(colorImage.cols, colorImage.rows);
+        if (params.graph_cut_max_side > 0 && longest > params.graph_cut_max_side) {
+            double scale = (double)params.graph_cut_max_side / longest;
+            resize(colorImage, coarseImage, Size(max(1, cvRound(colorImage.cols * scale)),
+                                                 max(1, cvRound(colorImage.rows * scale))), 0, 0, INTER_AREA);
+        } else {
+            coarseImage = colorImage;
+        }
+    }
 
-        // Check neighbors
-        for (int i = 0; i < 4; i++) {
-            int nx = p.x + dx[i];
-            int ny = p.y + dy[i];
+    if (!strokes.empty()) {
+        // Step 2: Burn the strokes in as hard labels and find the region they affect
+        stages.begin("Apply strokes");
+        const Rect bounds(Point(0, 0), colorImage.size());
+        Rect region;
+        for (const Stroke& stroke : strokes) {
+            polylines(strokeLabels, vector<vector<Point>>{stroke.points}, false,
+                      Scalar((stroke.foreground ? GC_FGD : GC_BGD) + 1), 2 * stroke.radius + 1);
+            Rect box = boundingRect(stroke.points);
+            int pad = stroke.radius + GRAB_CUT_STROKE_MARGIN;
+            box = Rect(box.x - pad, box.y - pad, box.width + 2 * pad, box.height + 2 * pad);
+            region = region.area() > 0 ? (region | box) : box;
+        }
+        region = region & bounds;
+
+        // Step 3: Inside the region only the strokes stay fixed; earlier
+        // automatic hard labels become probable so the cut can move there
+        for (int y = region.y; y < region.y + region.height; y++) {
+            uchar *labels = mask.ptr<uchar>(y);
+            const uchar *strokeRow = strokeLabels.ptr<uchar>(y);
+            for (int x = region.x; x < region.x + region.width; x++) {
+                if (strokeRow[x]) {
+                    labels[x] = strokeRow[x] - 1;
+                } else {
+                    labels[x] = (labels[x] & 1) ? GC_PR_FGD : GC_PR_BGD;
+                }
+            }
+        }
 
-            // Boundary check
-            if (nx >= 0 && ny >= 0 && nx < gray.cols && ny < gray.rows) {
-                int neighborIntensity = gray.at<uchar>(ny, nx);
-                if (!visited.at<uchar>(ny, nx) && abs(neighborIntensity - seedIntensity) < threshold) {
-                    visited.at<uchar>(ny, nx) = 1;
-                    pixelQueue.push(Point(nx, ny));
+        // Step 4: Refit the colour models to the whole corrected mask. One
+        // GC_EVAL iteration learns them from the labels before it cuts; its
+        // cut goes to a scratch mask. Large images refit on the coarse level
+        // of initialGrabCut, with the stroke pixels carried over so thin
+        // strokes are not lost in the downsampling.
+        stages.begin("Refit colour models");
+        Mat labels;
+        if (coarseImage.size() == colorImage.size()) {
+            labels = mask.clone();
+        } else {
+            resize(mask, labels, coarseImage.size(), 0, 0, INTER_NEAREST);
+            const double sx = (double)coarseImage.cols / colorImage.cols;
+            const double sy = (double)coarseImage.rows / colorImage.rows;
+            vector<Point> stroked;
+            findNonZero(strokeLabels, stroked);
+            for (const Point& p : stroked) {
+                labels.at<uchar>(min(labels.rows - 1, (int)(p.y * sy)), min(labels.cols - 1, (int)(p.x * sx))) =
+                    strokeLabels.at<uchar>(p) - 1;
+            }
+        }
+        grabCut(coarseImage, labels, Rect(), bgModel, fgModel, 1, GC_EVAL);
+
+        // Step 5: Cut the region with the refitted models frozen. A one pixel
+        // ring around it is added with its current labels made hard, so the
+        // cut pays for any disagreement with the mask just outside and its
+        // boundary joins the unchanged labels there.
+        stages.begin("GrabCut update");
+        Rect window = Rect(region.x - 1, region.y - 1, region.width + 2, region.height + 2) & bounds;
+        Mat windowMask = mask(window).clone();
+        const Rect inner(region.x - window.x, region.y - window.y, region.width, region.height);
+        for (int y = 0; y < windowMask.rows; y++) {
+            uchar *row = windowMask.ptr<uchar>(y);
+            for (int x = 0; x < windowMask.cols; x++) {
+                if (!inner.contains(Point(x, y))) {
+                    row[x] = (row[x] & 1) ? GC_FGD : GC_BGD;
                 }
             }
         }
+        grabCut(colorImage(window), windowMask, Rect(), bgModel, fgModel, 1, GC_EVAL_FREEZE_MODEL);
+        windowMask(inner).copyTo(mask(region));
+    }
+
+    stages.begin("Extract foreground");
+    return grabCutForeground(colorImage, mask);
+}
+
+void GrabCutSession::addStroke(const vector<Point>& points, int radius, bool foreground) {
+    if (points.empty()) {
+        return;
+    }
+    lock_guard<mutex> guard(stroke_lock);
+    pending.push_back(Stroke{points, radius, foreground});
+}
+
+// Grid Graph Cut Segmentation Implementation: Otsu's partition refined by a
+// minimum cut on GridMaxFlow
+Mat gridCutSegmentation(const Mat& image, const SegmentationContext& context) {
+    StageTimer stages("gridCutSegmentation");
+    const SegmentationParams& params = context.params;
+    shared_ptr<PreprocessCache> cache = preprocessFor(image, *context.workspace);
+
+    // Step 1: Initial partition from Otsu's threshold of the smoothed image
+    stages.begin("Initial partition");
+    Mat initial;
+    threshold(cache->gaussian(), initial, 0, 255, THRESH_BINARY | THRESH_OTSU);
+
+    // Step 2: Colour models from the partition, then the minimum cut
+    stages.begin("Grid max-flow");
+    Mat foreground = refineMaskWithGridCut(cache->bgr(), initial, params.grid_cut_smoothness,
+                                           params.grid_cut_connectivity);
+
+    // Step 3: Foreground pixels on black, like Graph Cut
+    stages.begin("Extract foreground");
+    Mat output(image.size(), CV_8UC3, Scalar(0, 0, 0));
+    cache->bgr().copyTo(output, foreground);
+    return output;
+}
+
+// Region Growing Segmentation Implementation
+Mat regionGrowingSegmentation(const Mat& image, Point seed, const SegmentationContext& context) {
+    StageTimer stages("regionGrowingSegmentation");
+    int seedIntensity = grayAt(image, seed);
+
+    // Grow the 4-connected region of pixels close to the seed intensity; the
+    // seed itself always belongs to the region
+    stages.begin("Region growing");
+    SegmentationWorkspace& workspace = *context.workspace;
+    shared_ptr<PreprocessCache> cache = preprocessFor(image, workspace);
+    const int threshold = context.params.region_growing_threshold;
+    Mat& segmented = workspace.segmented;
+    if (cache->interactive()) {
+        // Threshold changes resume the previous region when it grew
+        Mat gray = cache->gray();
+        shared_ptr<RegionGrowth> growth = cache->regionGrowth(gray, FLOOD_4);
+        growth->grow<FLOOD_4>(vector<Point>{seed}, threshold, [&](int, int x, int y) {
+            return abs(gray.at<uchar>(y, x) - seedIntensity) < threshold;
+        }, workspace.pending, segmented);
+    } else {
+        // Packed to one bit per pixel straight from the image
+        FloodMask& inside = workspace.inside;
+        packIntensityRange(image, max(0, seedIntensity - threshold + 1), min(255, seedIntensity + threshold - 1), inside);
+        inside.fillSpan(seed.y, seed.x, seed.x);
+        FloodMask& mask = workspace.mask;
+        mask.reset(image.size());
+        scanlineFloodFill<FLOOD_4>(mask, inside, workspace.pending, seed);
+        mask.toMat(segmented);
     }
     
+    stages.begin("Color map");
     Mat colored;
     applyColorMap(segmented, colored, COLORMAP_JET);
     
     return colored;
 }
 
-// Advanced Backtracking with Edge Enhancement Implementation
-Mat backtrackingEdgeEnhancementSegmentation(const Mat& image) {
-    Mat gray;
-    if (image.channels() == 3) {
-        cvtColor(image, gray, COLOR_BGR2GRAY);
-    } else {
-        gray = image.clone();
+// Multi-Seed Region Growing Implementation: every seed's region grown in
+// parallel (see growSeedRegions), each region in its own colour
+Mat multiSeedRegionGrowingSegmentation(const Mat& image, const SegmentationContext& context) {
+    StageTimer stages("multiSeedRegionGrowingSegmentation");
+    stages.begin("Grayscale");
+    shared_ptr<PreprocessCache> cache = preprocessFor(image, *context.workspace);
+    Mat gray = cache->gray();
+
+    // Seeds inside the image, or an even grid when none are given
+    vector<Point> seeds;
+    Rect bounds(0, 0, gray.cols, gray.rows);
+    for (const Point& seed : context.params.region_seeds) {
+        if (bounds.contains(seed)) {
+            seeds.push_back(seed);
+        }
+    }
+    if (seeds.empty()) {
+        for (int j = 1; j <= REGION_SEED_GRID; j++) {
+            for (int i = 1; i <= REGION_SEED_GRID; i++) {
+                seeds.push_back(Point((gray.cols * i) / (REGION_SEED_GRID + 1), (gray.rows * j) / (REGION_SEED_GRID + 1)));
+            }
+        }
+    }
+
+    stages.begin("Parallel region growing");
+    Mat labels = growSeedRegions(gray, seeds, context.params.region_growing_threshold,
+                                 context.params.region_floating_range);
+
+    // Label k gets colour k of the JET map spread over all seeds; pixels
+    // outside every region stay black and seeds are marked in white
+    stages.begin("Color regions");
+    Mat ramp(1, (int)seeds.size() + 1, CV_8UC1), palette;
+    for (int k = 0; k <= (int)seeds.size(); k++) {
+        ramp.at<uchar>(0, k) = (uchar)(k * 255 / (int)seeds.size());
+    }
+    applyColorMap(ramp, palette, COLORMAP_JET);
+    palette.at<Vec3b>(0, 0) = Vec3b(0, 0, 0);
+    Mat output(gray.size(), CV_8UC3);
+    for (int y = 0; y < gray.rows; y++) {
+        const int *label = labels.ptr<int>(y);
+        Vec3b *dst = output.ptr<Vec3b>(y);
+        for (int x = 0; x < gray.cols; x++) {
+            dst[x] = palette.at<Vec3b>(0, label[x]);
+        }
     }
+    for (const Point& seed : seeds) {
+        circle(output, seed, 3, Scalar(255, 255, 255), FILLED);
+    }
+    return output;
+}
+
+// Advanced Backtracking with Edge Enhancement Implementation
+Mat backtrackingEdgeEnhancementSegmentation(const Mat& image, const SegmentationContext& context) {
+    StageTimer stages("backtrackingEdgeEnhancementSegmentation");
+    stages.begin("Grayscale");
+    shared_ptr<PreprocessCache> cache = preprocessFor(image, *context.workspace);
+    Mat gray = cache->gray();
 
     // Step 1: Advanced Pre-processing
-    Mat denoised, enhanced;
-    bilateralFilter(gray, denoised, 9, 75, 75);
-    Ptr<CLAHE> clahe = createCLAHE(2.0, Size(8, 8));
-    clahe->apply(denoised, enhanced);
-
-    // Step 2: Multi-scale Edge Detection
-    Mat gradX, gradY, gradMag;
-    Sobel(enhanced, gradX, CV_32F, 1, 0, 3);
-    Sobel(enhanced, gradY, CV_32F, 0, 1, 3);
-    magnitude(gradX, gradY, gradMag);
-    normalize(gradMag, gradMag, 0, 255, NORM_MINMAX);
-    gradMag.convertTo(gradMag, CV_8U);
-
-    // Step 3: Initial Segmentation
-    Mat binary;
-    adaptiveThreshold(enhanced, binary, 255, ADAPTIVE_THRESH_GAUSSIAN_C, THRESH_BINARY, 21, 5);
-    Mat kernel = getStructuringElement(MORPH_RECT, Size(3, 3));
-    morphologyEx(binary, binary, MORPH_CLOSE, kernel);
+    SmoothingFilter filter = context.params.smoothing_filter;
+    stages.begin(filter == SMOOTHING_BILATERAL_GRID ? "Bilateral grid" : "Bilateral filter");
+    cache->bilateral(filter);
+    stages.begin("CLAHE");
+    Mat enhanced = cache->clahe(filter);
+
+    // Step 2: Multi-scale Edge Detection and Step 3: Initial Segmentation,
+    // computed together in one stripe-parallel pass (see edgeFeatures)
+    stages.begin("Sobel gradient and adaptive threshold");
+    Mat gradMag = cache->gradientMagnitude(filter);
+    Mat binary = cache->adaptiveBinary(filter);
 
     // Step 4: Region Growing with Smart Backtracking
-    Mat segmented = Mat::zeros(gray.size(), CV_8UC1);
-    Mat visited = Mat::zeros(gray.size(), CV_8UC1);
+    stages.begin("Seed flood fill");
     vector<Point> seeds;
     int gridSize = 3;
     for (int i = 1; i <= gridSize; i++) {
@@ -1028,62 +5519,75 @@ Mat backtrackingEdgeEnhancementSegmentation(const Mat& image) {
         }
     }
 
-    // Process each seed point with region growing
-    for (const Point& seed : seeds) {
-        if (visited.at<uchar>(seed.y, seed.x)) continue;
-
-        queue<Point> q;
-        q.push(seed);
-        visited.at<uchar>(seed.y, seed.x) = 1;
-
-        // Reference values for region growing
-        int refIntensity = enhanced.at<uchar>(seed.y, seed.x);
-        double refGradient = gradMag.at<uchar>(seed.y, seed.x);
-
-        // 8-connectivity for region growing
-        int dx[] = {1, -1, 0, 0, 1, -1, 1, -1};
-        int dy[] = {0, 0, 1, -1, 1, -1, -1, 1};
-
-        while (!q.empty()) {
-            Point p = q.front();
-            q.pop();
-
-            // Check if this pixel should be included in the segment
-            bool isValidRegion = binary.at<uchar>(p.y, p.x) > 0;
-            if (isValidRegion) {
-                segmented.at<uchar>(p.y, p.x) = 255;
-
-                // Check neighbors
-                for (int i = 0; i < 8; i++) {
-                    int nx = p.x + dx[i];
-                    int ny = p.y + dy[i];
-
-                    if (nx >= 0 && ny >= 0 && nx < gray.cols && ny < gray.rows && 
-                        !visited.at<uchar>(ny, nx)) {
-                        
-                        // Multi-criteria region growing
-                        int intensityDiff = abs(enhanced.at<uchar>(ny, nx) - refIntensity);
-                        double gradientDiff = abs(gradMag.at<uchar>(ny, nx) - refGradient);
-                        
-                        bool isValidPixel = 
-                            // Intensity similarity
-                            intensityDiff < BACKTRACKING_THRESHOLD &&
-                            // Gradient continuity
-                            gradientDiff < BACKTRACKING_THRESHOLD * 0.5 &&
-                            // Edge strength consideration
-                            gradMag.at<uchar>(ny, nx) < BACKTRACKING_THRESHOLD * 1.5;
-
-                        if (isValidPixel) {
-                            visited.at<uchar>(ny, nx) = 1;
-                            q.push(Point(nx, ny));
-                        }
-                    }
-                }
+    // Regions only grow through pixels of the initial segmentation, and a
+    // later seed cannot enter a region grown from an earlier one
+    SegmentationWorkspace& workspace = *context.workspace;
+    const int threshold = context.params.backtracking_threshold;
+    const uchar *enhancedPixels = enhanced.data;
+    const uchar *gradPixels = gradMag.data;
+    const uchar *binaryPixels = binary.data;
+    const size_t enhancedStep = enhanced.step;
+    const size_t gradStep = gradMag.step;
+    const size_t binaryStep = binary.step;
+
+    // Multi-criteria region growing around a seed's reference values
+    auto similar = [&](int x, int y, int refIntensity, double refGradient) {
+        if (!binaryPixels[y * binaryStep + x]) {
+            return false;
+        }
+
+        int gradient = gradPixels[y * gradStep + x];
+        int intensityDiff = abs(enhancedPixels[y * enhancedStep + x] - refIntensity);
+        double gradientDiff = fabs(gradient - refGradient);
+
+        return
+            // Intensity similarity
+            intensityDiff < threshold &&
+            // Gradient continuity
+            gradientDiff < threshold * 0.5 &&
+            // Edge strength consideration
+            gradient < threshold * 1.5;
+    };
+    Mat& segmented = workspace.segmented;
+
+    if (cache->interactive()) {
+        // Slider drags resume the regions of the previous threshold when it grew
+        vector<Point> started;
+        vector<int> refIntensities;
+        vector<double> refGradients;
+        for (const Point& seed : seeds) {
+            if (binary.at<uchar>(seed)) {
+                started.push_back(seed);
+                refIntensities.push_back(enhanced.at<uchar>(seed));
+                refGradients.push_back(gradMag.at<uchar>(seed));
             }
         }
+        shared_ptr<RegionGrowth> growth = cache->regionGrowth(enhanced, FLOOD_8);
+        growth->grow<FLOOD_8>(started, threshold, [&](int k, int x, int y) {
+            return similar(x, y, refIntensities[k], refGradients[k]);
+        }, workspace.pending, segmented);
+    } else {
+        FloodMask& mask = workspace.mask;
+        mask.reset(gray.size());
+
+        // Process each seed point with region growing
+        for (const Point& seed : seeds) {
+            if (mask.test(seed.x, seed.y) || !binary.at<uchar>(seed)) continue;
+
+            // Reference values for region growing
+            int refIntensity = enhanced.at<uchar>(seed.y, seed.x);
+            double refGradient = gradMag.at<uchar>(seed.y, seed.x);
+
+            // 8-connectivity for region growing
+            scanlineFloodFill<FLOOD_8>(mask, workspace.pending, seed, [&](int x, int y) {
+                return (x == seed.x && y == seed.y) || similar(x, y, refIntensity, refGradient);
+            });
+        }
+        mask.toMat(segmented);
     }
 
     // Step 5: Post-processing and Visualization
+    stages.begin("Contour drawing");
     Mat result = image.clone();
     
     // Draw contours with different colors based on confidence
@@ -1151,133 +5655,349 @@ Mat backtrackingEdgeEnhancementSegmentation(const Mat& image) {
 }
 
 // 8-Directional Backtracking Segmentation Implementation
-Mat backtrackingSegmentation8Dir(const Mat& image) {
-    // Convert to grayscale if not already
-    Mat gray;
-    if (image.channels() == 3) {
-        cvtColor(image, gray, COLOR_BGR2GRAY);
-    } else {
-        gray = image.clone();
-    }
+Mat backtrackingSegmentation8Dir(const Mat& image, const SegmentationContext& context) {
+    StageTimer stages("backtrackingSegmentation8Dir");
+    shared_ptr<PreprocessCache> cache = preprocessFor(image, *context.workspace);
 
     // Apply slight Gaussian blur to reduce noise
-    Mat smoothed;
-    GaussianBlur(gray, smoothed, Size(3, 3), 0);
+    stages.begin("Gaussian blur");
+    Mat smoothed = cache->gaussian();
 
     // Define threshold value
-    int threshValue = BACKTRACKING_THRESHOLD;
+    int threshValue = context.params.backtracking_threshold;
 
-    // Create a matrix for segmentation
-    Mat binary;
-    threshold(smoothed, binary, threshValue, 255, THRESH_BINARY);
-    
-    // Create a copy for the result
-    Mat segmented = binary.clone();
-    
-    // Choose a starting point for segmentation (center of image)
-    int startX = gray.cols / 2;
-    int startY = gray.rows / 2;
-    int oldColor = binary.at<uchar>(startY, startX);
-    int newColor = 128; // Mid-gray for marking the segmented region
-    
-    // Use a non-recursive approach to avoid stack overflow
-    Mat visited = Mat::zeros(binary.size(), CV_8UC1);
-    queue<Point> q;
-    q.push(Point(startX, startY));
-    visited.at<uchar>(startY, startX) = 1;
-    
-    // Define 8-directional connectivity (including diagonals)
-    int dx[] = {1, -1, 0, 0, 1, -1, 1, -1};
-    int dy[] = {0, 0, 1, -1, 1, -1, -1, 1};
-    
-    while (!q.empty()) {
-        Point p = q.front();
-        q.pop();
-        
-        // If the pixel matches the old color, mark it with the new color
-        if (binary.at<uchar>(p.y, p.x) == oldColor) {
-            segmented.at<uchar>(p.y, p.x) = newColor;
-            
-            // Check all 8 neighbors
-            for (int i = 0; i < 8; i++) {
-                int nx = p.x + dx[i];
-                int ny = p.y + dy[i];
-                
-                // Boundary check
-                if (nx >= 0 && ny >= 0 && nx < binary.cols && ny < binary.rows && 
-                    !visited.at<uchar>(ny, nx)) {
-                    
-                    // For diagonal neighbors, check if both adjacent pixels are valid
-                    bool isValid = true;
-                    if (i >= 4) { // Diagonal directions
-                        // Check horizontal neighbor
-                        if (!visited.at<uchar>(p.y, nx)) {
-                            isValid = binary.at<uchar>(p.y, nx) == oldColor;
-                        }
-                        // Check vertical neighbor
-                        if (isValid && !visited.at<uchar>(ny, p.x)) {
-                            isValid = binary.at<uchar>(ny, p.x) == oldColor;
-                        }
-                    }
-                    
-                    if (isValid) {
-                        visited.at<uchar>(ny, nx) = 1;
-                        q.push(Point(nx, ny));
-                    }
-                }
-            }
-        }
-    }
+    // Fill the 8-connected region (including diagonals) around the center. A
+    // diagonal step never needs a corner check: both corner pixels are direct
+    // neighbours and are always examined before the diagonal one.
+    stages.begin("Region fill");
+    Mat segmented = fillBacktrackingRegion<FLOOD_8>(smoothed, threshValue, *cache, *context.workspace);
     
     // Apply light morphological operations to clean up the result
+    stages.begin("Morphological close");
     Mat kernel = getStructuringElement(MORPH_RECT, Size(3, 3));
     morphologyEx(segmented, segmented, MORPH_CLOSE, kernel);
     
     // Apply color map for better visualization
+    stages.begin("Color map");
     Mat colored;
     applyColorMap(segmented, colored, COLORMAP_JET);
     
     return colored;
 }
 
-// Add update function for edge enhanced backtracking
-static void update_backtracking_edge_enhanced_segmentation() {
-    if (filename == NULL || input_image.empty()) {
-        return;
+// Reads rectangular regions of an image for tiled processing. Binary PGM/PPM
+// files are read straight from disk one region at a time, so memory stays
+// bounded by the region size. OpenCV cannot decode a region of other formats,
+// so those are decoded once and regions are cut from memory.
+class TiledImageReader {
+public:
+    explicit TiledImageReader(const string& path) : path_(path) {
+        if (!openNetpbm()) {
+            decoded_ = imread(path, IMREAD_COLOR);
+            if (decoded_.empty()) {
+                throw cv::Exception(0, "Failed to load image", "TiledImageReader", __FILE__, __LINE__);
+            }
+            size_ = decoded_.size();
+            cerr << "Warning: " << path << " is not a binary PGM/PPM, decoding the whole image into memory" << endl;
+        }
     }
 
-    try {
-        auto start_time = chrono::high_resolution_clock::now();
-        
-        Mat processed_image = backtrackingEdgeEnhancementSegmentation(input_image);
-        
-        auto end_time = chrono::high_resolution_clock::now();
-        double elapsed_time = chrono::duration<double, milli>(end_time - start_time).count();
+    Size size() const { return size_; }
+    bool streaming() const { return decoded_.empty(); }
+
+    // BGR pixels of region; safe to call from several threads at once
+    Mat read(const Rect& region) const {
+        if (!streaming()) {
+            return decoded_(region).clone();
+        }
+
+        ifstream file(path_, ios::binary);
+        Mat raw(region.height, region.width, CV_8UC(channels_));
+        const size_t rowBytes = (size_t)region.width * channels_;
+        for (int y = 0; y < region.height; y++) {
+            streamoff offset = data_offset_ +
+                ((streamoff)(region.y + y) * size_.width + region.x) * channels_;
+            file.seekg(offset);
+            file.read((char *)raw.ptr<uchar>(y), rowBytes);
+        }
+        if (!file) {
+            throw cv::Exception(0, "Truncated image data in " + path_, "TiledImageReader::read", __FILE__, __LINE__);
+        }
+
+        Mat bgr;
+        cvtColor(raw, bgr, channels_ == 1 ? COLOR_GRAY2BGR : COLOR_RGB2BGR);
+        return bgr;
+    }
+
+private:
+    // Parse a binary 8-bit PGM (P5) or PPM (P6) header
+    bool openNetpbm() {
+        ifstream file(path_, ios::binary);
+        char magic[2] = {0, 0};
+        if (!file.read(magic, 2) || magic[0] != 'P' || (magic[1] != '5' && magic[1] != '6')) {
+            return false;
+        }
+
+        int values[3];
+        for (int& value : values) {
+            file >> ws;
+            while (file.peek() == '#') {
+                string comment;
+                getline(file, comment);
+                file >> ws;
+            }
+            if (!(file >> value)) {
+                return false;
+            }
+        }
+        if (values[2] != 255) {
+            return false; // 16-bit samples: let imread handle it
+        }
+        file.get(); // Single whitespace before the pixel data
+
+        channels_ = magic[1] == '5' ? 1 : 3;
+        size_ = Size(values[0], values[1]);
+        data_offset_ = file.tellg();
+        return true;
+    }
+
+    string path_;
+    Size size_;
+    int channels_ = 3;
+    streamoff data_offset_ = 0;
+    Mat decoded_;
+};
+
+// Writes a binary PGM/PPM one tile at a time. The file is sized up front and
+// every tile's rows are written in place, so tiles may arrive in any order.
+class TiledImageWriter {
+public:
+    TiledImageWriter(const string& path, Size size, int channels)
+        : size_(size), channels_(channels) {
+        {
+            ofstream header(path, ios::binary | ios::trunc);
+            header << (channels == 1 ? "P5" : "P6") << "\n" << size.width << " " << size.height << "\n255\n";
+            data_offset_ = header.tellp();
+            if (!header) {
+                throw cv::Exception(0, "Failed to write " + path, "TiledImageWriter", __FILE__, __LINE__);
+            }
+        }
+        filesystem::resize_file(path, data_offset_ + (uintmax_t)size.area() * channels);
+        file_.open(path, ios::binary | ios::in | ios::out);
+    }
+
+    // Write a gray or BGR tile whose top-left pixel is at origin
+    void write(const Mat& tile, Point origin) {
+        Mat converted;
+        if (channels_ == 1) {
+            converted = tile;
+        } else {
+            cvtColor(tile, converted, COLOR_BGR2RGB);
+        }
 
-        if (!processed_image.empty()) {
-            string temp_filename = string(filename) + "_processed.jpg";
-            imwrite(temp_filename, processed_image);
+        lock_guard<mutex> guard(lock_);
+        const size_t rowBytes = (size_t)tile.cols * channels_;
+        for (int y = 0; y < tile.rows; y++) {
+            file_.seekp(data_offset_ + ((streamoff)(origin.y + y) * size_.width + origin.x) * channels_);
+            file_.write((const char *)converted.ptr<uchar>(y), rowBytes);
+        }
+        if (!file_) {
+            throw cv::Exception(0, "Failed to write output tile", "TiledImageWriter::write", __FILE__, __LINE__);
+        }
+    }
+
+private:
+    Size size_;
+    int channels_;
+    streamoff data_offset_ = 0;
+    fstream file_;
+    mutex lock_;
+};
+
+// Row-major grid of tiles covering imageSize
+static vector<Rect> tileGrid(Size imageSize, int tileSize) {
+    vector<Rect> tiles;
+    for (int y = 0; y < imageSize.height; y += tileSize) {
+        for (int x = 0; x < imageSize.width; x += tileSize) {
+            tiles.push_back(Rect(x, y, min(tileSize, imageSize.width - x), min(tileSize, imageSize.height - y)));
+        }
+    }
+    return tiles;
+}
 
-            GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file_at_scale(temp_filename.c_str(), 
-                                                             400, 400, 
-                                                             TRUE, 
-                                                             NULL);
-            if (pixbuf) {
-                gtk_image_set_from_pixbuf(GTK_IMAGE(processed_image_view), pixbuf);
-                g_object_unref(pixbuf);
-                
-                gtk_label_set_text(GTK_LABEL(status_label), 
-                    g_strdup_printf("Processing Time: %.2f ms", elapsed_time));
-                
-                gtk_label_set_text(GTK_LABEL(threshold_label), 
-                    g_strdup_printf("Parameters:\nBacktracking threshold: %d\nEdge enhancement: Canny + Adaptive", 
-                    BACKTRACKING_THRESHOLD));
+// Run body(tile, index) for every tile on options.threads threads. The first
+// exception stops the remaining tiles and is rethrown.
+static void forEachTile(const vector<Rect>& tiles, const TiledOptions& options,
+                        const function<void(const Rect&, size_t)>& body) {
+    atomic<size_t> next_tile(0);
+    mutex error_lock;
+    exception_ptr error;
+    auto worker = [&]() {
+        for (size_t i = next_tile++; i < tiles.size(); i = next_tile++) {
+            try {
+                body(tiles[i], i);
+            } catch (...) {
+                lock_guard<mutex> guard(error_lock);
+                if (!error) {
+                    error = current_exception();
+                }
+                next_tile = tiles.size();
             }
         }
-    } catch (const cv::Exception& e) {
-        gtk_label_set_text(GTK_LABEL(status_label), g_strdup_printf("Error: %s", e.what()));
+    };
+
+    int threads = max(1, min(options.threads, (int)tiles.size()));
+    vector<thread> pool;
+    for (int t = 1; t < threads; t++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (thread& t : pool) {
+        t.join();
+    }
+    if (error) {
+        rethrow_exception(error);
+    }
+}
+
+// Gray-level histogram of the whole image, accumulated tile by tile
+static void tiledGrayHistogram(const TiledImageReader& reader, const vector<Rect>& tiles, const TiledOptions& options,
+                               double histogram[256]) {
+    vector<vector<double>> partial(tiles.size(), vector<double>(256, 0.0));
+    forEachTile(tiles, options, [&](const Rect& tile, size_t index) {
+        Mat gray;
+        cvtColor(reader.read(tile), gray, COLOR_BGR2GRAY);
+        computeHistogram(gray, partial[index].data());
+    });
+
+    fill(histogram, histogram + 256, 0.0);
+    for (const vector<double>& counts : partial) {
+        for (int v = 0; v < 256; v++) {
+            histogram[v] += counts[v];
+        }
     }
 }
 
+// Tiled Segmentation Implementation: streams the image tile by tile, runs the
+// per-pixel stages of an algorithm on each tile in parallel and writes the
+// output tiles as they finish. Global statistics (histograms, cluster
+// centers) come from a streamed pre-pass. Only algorithms whose output
+// depends on a tile's neighbourhood alone are supported, plus the threshold
+// stages of TILED_STAGE_NAMES; the Backtracking algorithms themselves need a
+// region fill over the whole image. The output (when outputPath is not empty)
+// is a binary PPM, 3-channel like the non-tiled output.
+void tiledSegmentation(const string& algorithm, const string& inputPath, const string& outputPath,
+                       const TiledOptions& options, const SegmentationParams& params) {
+    if (options.tile_size < 16 || options.halo < 0) {
+        throw cv::Exception(0, "Tile size must be at least 16 and halo non-negative", "tiledSegmentation", __FILE__, __LINE__);
+    }
 
+    StageTimer stages("tiledSegmentation");
+    stages.begin("Open input");
+    TiledImageReader reader(inputPath);
+    const Size imageSize = reader.size();
+    const Rect bounds(Point(0, 0), imageSize);
+    const vector<Rect> tiles = tileGrid(imageSize, options.tile_size);
+
+    // Step 1: Global pre-pass and the per-tile stage of the chosen algorithm
+    stages.begin("Global pre-pass");
+    function<Mat(const Mat&, Point)> stage;
+    int halo = 0;
+    if (algorithm == "Otsu Thresholding") {
+        double histogram[256];
+        tiledGrayHistogram(reader, tiles, options, histogram);
+        Mat classLut = otsuClassLut(otsuThresholds(histogram, params.otsu_levels));
+        stage = [classLut](const Mat& tile, Point) {
+            Mat gray, segmented, colored;
+            cvtColor(tile, gray, COLOR_BGR2GRAY);
+            LUT(gray, classLut, segmented);
+            cvtColor(segmented, colored, COLOR_GRAY2BGR);
+            return colored;
+        };
+    } else if (algorithm == "K-Means") {
+        double histogram[256];
+        tiledGrayHistogram(reader, tiles, options, histogram);
+        vector<uchar> clusterValues = histogramKMeans(histogram, params.kmeans_clusters, 3, params.kmeansCriteria());
+        stage = [clusterValues](const Mat& tile, Point) {
+            Mat gray, segmented, colored;
+            cvtColor(tile, gray, COLOR_BGR2GRAY);
+            LUT(gray, Mat(1, 256, CV_8U, (void *)clusterValues.data()), segmented);
+            applyColorMap(segmented, colored, COLORMAP_JET);
+            return colored;
+        };
+    } else if (algorithm == "K-Means (Color)") {
+        if (params.kmeans_clusters < 2 || params.kmeans_clusters > 255) {
+            throw cv::Exception(0, "K-Means needs between 2 and 255 clusters", "tiledSegmentation", __FILE__, __LINE__);
+        }
+        const KMeansColorSpace colorSpace = params.kmeans_color_space;
+        auto toColors = [colorSpace](const Mat& tile) {
+            Mat colors;
+            if (colorSpace == KMEANS_LAB) {
+                cvtColor(tile, colors, COLOR_BGR2Lab);
+            } else {
+                colors = tile;
+            }
+            return colors;
+        };
+
+        auto model = make_shared<ColorKMeansModel>(
+            makeColorKMeansModel(imageSize, colorSpace, params.kmeans_spatial_weight));
+        const int cell = colorSampleCell(imageSize);
+        // Samples are kept per tile and seeded per tile so the fit does not
+        // depend on which thread handled which tile
+        const uint64 seed = theRNG().state;
+        vector<vector<float>> partial(tiles.size());
+        forEachTile(tiles, options, [&](const Rect& tile, size_t index) {
+            RNG rng(seed + index);
+            sampleColorFeatures(toColors(reader.read(tile)), tile.tl(), cell, *model, rng, partial[index]);
+        });
+        vector<float> sampleData;
+        for (const vector<float>& samples : partial) {
+            sampleData.insert(sampleData.end(), samples.begin(), samples.end());
+        }
+        fitColorKMeans(*model, sampleData, params.kmeans_clusters, params.kmeansCriteria());
+
+        stage = [model, toColors](const Mat& tile, Point origin) {
+            return paintColorClusters(toColors(tile), origin, *model);
+        };
+    } else if (algorithm == "Threshold") {
+        int threshValue = params.backtracking_threshold;
+        stage = [threshValue](const Mat& tile, Point) {
+            Mat gray, segmented, colored;
+            cvtColor(tile, gray, COLOR_BGR2GRAY);
+            threshold(gray, segmented, threshValue, 255, THRESH_BINARY);
+            cvtColor(segmented, colored, COLOR_GRAY2BGR);
+            return colored;
+        };
+    } else if (algorithm == "Smoothed Threshold") {
+        int threshValue = params.backtracking_threshold;
+        SmoothingFilter filter = params.smoothing_filter;
+        stage = [threshValue, filter](const Mat& tile, Point origin) {
+            Mat gray, segmented, colored;
+            cvtColor(tile, gray, COLOR_BGR2GRAY);
+            threshold(edgePreservingSmooth(gray, filter, origin), segmented, threshValue, 255, THRESH_BINARY);
+            cvtColor(segmented, colored, COLOR_GRAY2BGR);
+            return colored;
+        };
+        // The 9x9 bilateral filter needs a halo of 4 to hide seams, the
+        // bilateral grid one of 3 cells (6 pixels)
+        halo = options.halo;
+    } else {
+        throw cv::Exception(0, algorithm + " is not supported in tiled mode", "tiledSegmentation", __FILE__, __LINE__);
+    }
 
+    // Step 2: Process every tile with its halo and write the cropped result
+    stages.begin("Process tiles");
+    unique_ptr<TiledImageWriter> writer;
+    if (!outputPath.empty()) {
+        writer.reset(new TiledImageWriter(outputPath, imageSize, 3));
+    }
+    forEachTile(tiles, options, [&](const Rect& tile, size_t) {
+        Rect padded = Rect(tile.x - halo, tile.y - halo, tile.width + 2 * halo, tile.height + 2 * halo) & bounds;
+        Mat result = stage(reader.read(padded), padded.tl());
+        Mat cropped = result(Rect(tile.x - padded.x, tile.y - padded.y, tile.width, tile.height));
+        if (writer) {
+            writer->write(cropped, tile.tl());
+        }
+    });
+}